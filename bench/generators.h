@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace humming::bench {
+
+// Bijective 64 bit mix (splitmix64 finalizer), spreads record indices over
+// the keyspace without collisions.
+inline uint64_t scramble(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Sizes drawn uniformly from [_min, _max].
+struct SizeRange {
+  size_t _min = 0;
+  size_t _max = 0;
+
+  size_t pick(std::mt19937_64 &random) const {
+    return _min == _max
+               ? _min
+               : std::uniform_int_distribution<size_t>(_min, _max)(random);
+  }
+  // the same size for every draw of seed, so a record keeps its key size
+  size_t pick(uint64_t seed) const {
+    return _min + scramble(seed) % (_max - _min + 1);
+  }
+};
+
+// Keys of records are 16 hex digits of their scrambled index padded to their
+// size, so they are unique, deterministic and not ordered like indices.
+// Indices from k_missing_base on are never written and make misses.
+class KeyFormat {
+private:
+  SizeRange _size;
+
+public:
+  static constexpr size_t k_min_size = 16;
+  static constexpr uint64_t k_missing_base = uint64_t(1) << 62;
+
+  explicit KeyFormat(SizeRange size) : _size(size) {}
+
+  string_view format(uint64_t index, string &k) const {
+    static constexpr char k_digits[] = "0123456789abcdef";
+    k.assign(std::max(k_min_size, _size.pick(index ^ k_missing_base)), '.');
+    uint64_t bits = scramble(index);
+    for (size_t i = 0; i < k_min_size; ++i, bits >>= 4)
+      k[k_min_size - 1 - i] = k_digits[bits & 15];
+    return k;
+  }
+};
+
+// Ranks in [0, n) following a zipfian distribution, rank 0 is the most
+// popular. Uses the method of Gray et al. "Quickly Generating Billion-Record
+// Synthetic Databases" like YCSB; setup sums n terms once, every draw is
+// constant time.
+class ZipfianGenerator {
+private:
+  uint64_t _n;
+  double _theta;
+  double _alpha;
+  double _zeta_n;
+  double _eta;
+
+  static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i)
+      sum += 1 / std::pow(double(i), theta);
+    return sum;
+  }
+
+public:
+  ZipfianGenerator(uint64_t n, double theta)
+      : _n(std::max<uint64_t>(n, 2)), _theta(theta),
+        _alpha(1 / (1 - theta)), _zeta_n(zeta(_n, theta)),
+        _eta((1 - std::pow(2.0 / _n, 1 - theta)) /
+             (1 - zeta(2, theta) / _zeta_n)) {}
+
+  uint64_t next(std::mt19937_64 &random) const {
+    const double u = std::uniform_real_distribution<double>()(random);
+    const double uz = u * _zeta_n;
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + std::pow(0.5, _theta))
+      return 1;
+    return std::min<uint64_t>(
+        _n - 1, uint64_t(_n * std::pow(_eta * u - _eta + 1, _alpha)));
+  }
+};
+
+enum class Distribution { k_uniform, k_zipfian, k_latest };
+
+// Picks indices of existing records. Zipfian ranks are scrambled, so popular
+// records are spread over files and shards; latest favours records inserted
+// last, which grow in number while the workload inserts.
+class KeyChooser {
+private:
+  Distribution _distribution;
+  const std::atomic<uint64_t> &_records_num;
+  ZipfianGenerator _zipfian;
+
+public:
+  KeyChooser(Distribution distribution,
+             const std::atomic<uint64_t> &records_num, double zipf_constant)
+      : _distribution(distribution), _records_num(records_num),
+        _zipfian(records_num.load(), zipf_constant) {}
+
+  uint64_t next(std::mt19937_64 &random) const {
+    const uint64_t n = _records_num.load(std::memory_order_relaxed);
+    switch (_distribution) {
+    case Distribution::k_uniform:
+      return std::uniform_int_distribution<uint64_t>(0, n - 1)(random);
+    case Distribution::k_zipfian:
+      return scramble(_zipfian.next(random)) % n;
+    case Distribution::k_latest:
+      return n - 1 - std::min(n - 1, _zipfian.next(random));
+    }
+    return 0;
+  }
+};
+
+} // namespace humming::bench
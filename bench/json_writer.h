@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "util/perf/histogram.h"
+#include "util/perf/metrics.h"
+
+using namespace std;
+
+namespace humming::bench {
+
+// Streams nested JSON objects, commas and escaping are handled here. Values
+// are written right after their key, objects are closed in reverse order.
+class JsonWriter {
+private:
+  std::ostream &_out;
+  // per open object, whether it already has a member
+  vector<bool> _has_members;
+
+  void separate() {
+    if (_has_members.empty())
+      return;
+    if (_has_members.back())
+      _out << ',';
+    _has_members.back() = true;
+    _out << '\n' << std::string(2 * _has_members.size(), ' ');
+  }
+  void quoted(string_view s) {
+    _out << '"';
+    for (const char c : s) {
+      if (c == '"' || c == '\\') {
+        _out << '\\' << c;
+      } else if (uint8_t(c) < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        _out << escaped;
+      } else {
+        _out << c;
+      }
+    }
+    _out << '"';
+  }
+  void key(string_view k) {
+    separate();
+    quoted(k);
+    _out << ": ";
+  }
+
+public:
+  explicit JsonWriter(std::ostream &out) : _out(out) {}
+
+  void beginObject() {
+    _out << '{';
+    _has_members.push_back(false);
+  }
+  void beginObject(string_view k) {
+    key(k);
+    beginObject();
+  }
+  void endObject() {
+    const bool had_members = _has_members.back();
+    _has_members.pop_back();
+    if (had_members)
+      _out << '\n' << std::string(2 * _has_members.size(), ' ');
+    _out << '}';
+    if (_has_members.empty())
+      _out << '\n';
+  }
+  void value(string_view k, string_view v) {
+    key(k);
+    quoted(v);
+  }
+  void value(string_view k, const char *v) { value(k, string_view(v)); }
+  void value(string_view k, bool v) {
+    key(k);
+    _out << (v ? "true" : "false");
+  }
+  void value(string_view k, double v) {
+    key(k);
+    if (!std::isfinite(v)) {
+      _out << "null";
+      return;
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "%.6g", v);
+    _out << number;
+  }
+  template <typename T>
+    requires std::is_integral_v<T>
+  void value(string_view k, T v) {
+    key(k);
+    _out << v;
+  }
+
+  // count, mean and percentiles of h
+  void histogram(string_view k, const util::perf::Histogram &h) {
+    beginObject(k);
+    value("count", h.count());
+    value("mean", h.mean());
+    value("min", h.min());
+    value("p50", h.percentile(0.5));
+    value("p90", h.percentile(0.9));
+    value("p99", h.percentile(0.99));
+    value("p99.9", h.percentile(0.999));
+    value("max", h.max());
+    endObject();
+  }
+
+  // counters and non-empty histograms of metrics, by their names
+  template <typename CounterId, typename HistogramId>
+  void metrics(string_view k,
+               const util::perf::MetricSet<CounterId, HistogramId> &metrics) {
+    beginObject(k);
+    beginObject("counters");
+    for (size_t i = 0; i < size_t(CounterId::k_num); ++i)
+      value(metricName(CounterId(i)), metrics.count(CounterId(i)));
+    endObject();
+    beginObject("histograms");
+    for (size_t i = 0; i < size_t(HistogramId::k_num); ++i) {
+      const auto &h = metrics.histogram(HistogramId(i));
+      if (h.count() > 0)
+        histogram(metricName(HistogramId(i)), h);
+    }
+    endObject();
+    endObject();
+  }
+};
+
+} // namespace humming::bench
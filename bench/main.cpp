@@ -0,0 +1,285 @@
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "plog/Appenders/ConsoleAppender.h"
+#include "plog/Formatters/TxtFormatter.h"
+#include "plog/Init.h"
+#include "plog/Log.h"
+
+#include "bench/json_writer.h"
+#include "bench/micro.h"
+#include "bench/workload.h"
+
+using namespace std;
+using namespace humming;
+
+namespace {
+
+constexpr const char *k_usage = R"(usage: humming_bench [--name=value]...
+  --workload=a|b|c|d|e|f|load  YCSB core workload (a)
+  --records=N                  records loaded before the run (1000000)
+  --operations=N               operations of the run (1000000)
+  --threads=N                  client threads (4)
+  --distribution=uniform|zipfian|latest
+                               keys of operations (set by the workload)
+  --zipf=C                     zipfian constant (0.99)
+  --key-size=MIN[:MAX]         key bytes, at least 16 (16)
+  --value-size=MIN[:MAX]       value bytes (100)
+  --miss-ratio=R               share of reads of missing keys (0)
+  --max-scan-length=N          entries of the longest scan (100)
+  --cold                       evict data files from caches before the run
+  --direct-io                  read and write data files with O_DIRECT
+  --compression=none|lz4|zstd  codec of blocks of records of data files (none)
+  --block-size=N               bytes of records per compressed block (16384)
+  --page-cache-mb=N            page cache of index pages and records (0)
+  --key-cache-mb=N             cache of hot values (0)
+  --shards=N                   shards of the database (4)
+  --wal-sync                   updates wait for their log to be synced
+  --directory=PATH             emptied before the load (/tmp/humming_bench/)
+  --seed=N                     seed of all generators (42)
+  --micro                      also run microbenchmarks after the load
+  --output=PATH                JSON report, stdout if not given
+)";
+
+[[noreturn]] void fail(string_view message) {
+  std::cerr << "humming_bench: " << message << "\n\n" << k_usage;
+  exit(1);
+}
+
+template <typename T> T parseNumber(string_view name, string_view value) {
+  T result{};
+  const auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (error != std::errc() || end != value.data() + value.size())
+    fail("bad value of --" + std::string(name) + ": " + std::string(value));
+  return result;
+}
+
+bench::SizeRange parseSizeRange(string_view name, string_view value) {
+  const size_t colon = value.find(':');
+  bench::SizeRange range;
+  range._min = parseNumber<size_t>(name, value.substr(0, colon));
+  range._max = colon == string_view::npos
+                   ? range._min
+                   : parseNumber<size_t>(name, value.substr(colon + 1));
+  if (range._max < range._min)
+    fail("empty range of --" + std::string(name));
+  return range;
+}
+
+bench::Distribution parseDistribution(string_view value) {
+  if (value == "uniform")
+    return bench::Distribution::k_uniform;
+  if (value == "zipfian")
+    return bench::Distribution::k_zipfian;
+  if (value == "latest")
+    return bench::Distribution::k_latest;
+  fail("unknown distribution " + std::string(value));
+}
+
+util::io::Compression parseCompression(string_view value) {
+  if (value == "none")
+    return util::io::Compression::k_none;
+  if (value == "lz4")
+    return util::io::Compression::k_lz4;
+  if (value == "zstd")
+    return util::io::Compression::k_zstd;
+  fail("unknown compression " + std::string(value));
+}
+
+string_view compressionName(util::io::Compression compression) {
+  switch (compression) {
+  case util::io::Compression::k_none:
+    return "none";
+  case util::io::Compression::k_lz4:
+    return "lz4";
+  case util::io::Compression::k_zstd:
+    return "zstd";
+  }
+  return "";
+}
+
+string_view distributionName(bench::Distribution distribution) {
+  switch (distribution) {
+  case bench::Distribution::k_uniform:
+    return "uniform";
+  case bench::Distribution::k_zipfian:
+    return "zipfian";
+  case bench::Distribution::k_latest:
+    return "latest";
+  }
+  return "";
+}
+
+void writePhase(bench::JsonWriter &json, string_view name,
+                const bench::PhaseResult &result) {
+  json.beginObject(name);
+  json.value("operations", result._operations_num);
+  json.value("seconds", result._seconds);
+  json.value("ops_per_sec", result._operations_num / result._seconds);
+  json.value("not_found", result._not_found);
+  json.beginObject("latency_ns");
+  for (size_t o = 0; o < result._latencies.size(); ++o) {
+    if (result._latencies[o].count() > 0)
+      json.histogram(bench::operationName(bench::Operation(o)),
+                     result._latencies[o]);
+  }
+  json.endObject();
+  json.endObject();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  static plog::ConsoleAppender<plog::TxtFormatter> console_appender(
+      plog::streamStdErr);
+  plog::init(plog::warning, &console_appender);
+
+  bench::WorkloadOptions options;
+  // updates are durable only when asked for, like in most YCSB bindings
+  options._database._bucket._wal_sync = false;
+  std::optional<bench::Distribution> distribution;
+  bool micro = false;
+  std::string output;
+  for (int i = 1; i < argc; ++i) {
+    const string_view arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      std::cout << k_usage;
+      return 0;
+    }
+    if (!arg.starts_with("--"))
+      fail("unexpected argument " + std::string(arg));
+    const size_t equals = arg.find('=');
+    const string_view name = arg.substr(2, equals - 2);
+    const bool has_value = equals != string_view::npos;
+    const string_view value = has_value ? arg.substr(equals + 1) : "";
+    // flags are switches without a value
+    auto flag = [&] {
+      if (has_value)
+        fail("--" + std::string(name) + " takes no value");
+      return true;
+    };
+    if (!has_value && name != "cold" && name != "direct-io" &&
+        name != "wal-sync" && name != "micro")
+      fail("--" + std::string(name) + " needs a value");
+
+    if (name == "workload") {
+      options._workload = value;
+    } else if (name == "records") {
+      options._records_num = parseNumber<uint64_t>(name, value);
+    } else if (name == "operations") {
+      options._operations_num = parseNumber<uint64_t>(name, value);
+    } else if (name == "threads") {
+      options._threads_num = parseNumber<size_t>(name, value);
+    } else if (name == "distribution") {
+      distribution = parseDistribution(value);
+    } else if (name == "zipf") {
+      options._zipf_constant = parseNumber<double>(name, value);
+    } else if (name == "key-size") {
+      options._key_size = parseSizeRange(name, value);
+    } else if (name == "value-size") {
+      options._value_size = parseSizeRange(name, value);
+    } else if (name == "miss-ratio") {
+      options._miss_ratio = parseNumber<double>(name, value);
+    } else if (name == "max-scan-length") {
+      options._max_scan_length = parseNumber<size_t>(name, value);
+    } else if (name == "cold") {
+      options._cold = flag();
+    } else if (name == "direct-io") {
+      options._database._bucket._direct_io = flag();
+    } else if (name == "compression") {
+      options._database._bucket._compression = parseCompression(value);
+    } else if (name == "block-size") {
+      options._database._bucket._block_size = parseNumber<size_t>(name, value);
+    } else if (name == "page-cache-mb") {
+      options._page_cache_mb = parseNumber<size_t>(name, value);
+    } else if (name == "key-cache-mb") {
+      options._key_cache_mb = parseNumber<size_t>(name, value);
+    } else if (name == "shards") {
+      options._database._shards_num = parseNumber<size_t>(name, value);
+    } else if (name == "wal-sync") {
+      options._database._bucket._wal_sync = flag();
+    } else if (name == "directory") {
+      options._directory = value;
+    } else if (name == "seed") {
+      options._seed = parseNumber<uint64_t>(name, value);
+    } else if (name == "micro") {
+      micro = flag();
+    } else if (name == "output") {
+      output = value;
+    } else {
+      fail("unknown option --" + std::string(name));
+    }
+  }
+  if (!bench::findMix(options._workload, options._mix))
+    fail("unknown workload " + options._workload);
+  if (distribution)
+    options._mix._distribution = *distribution;
+  if (options._records_num == 0)
+    fail("--records must be positive");
+  if (options._database._bucket._block_size == 0)
+    fail("--block-size must be positive");
+  if (options._key_size._min < bench::KeyFormat::k_min_size)
+    fail("keys have at least 16 bytes");
+  if (options._zipf_constant <= 0 || options._zipf_constant >= 1)
+    fail("--zipf must be in (0, 1)");
+  if (options._miss_ratio < 0 || options._miss_ratio > 1)
+    fail("--miss-ratio must be in [0, 1]");
+  if (options._database._shards_num == 0 ||
+      (options._database._shards_num & (options._database._shards_num - 1)))
+    fail("--shards must be a power of two");
+  // data files get key indexes, otherwise every scan reads whole files
+  options._database._bucket._key_index = true;
+
+  std::ofstream output_file;
+  if (!output.empty()) {
+    output_file.open(output);
+    if (!output_file)
+      fail("can't open " + output);
+  }
+  bench::JsonWriter json(output.empty() ? std::cout : output_file);
+  json.beginObject();
+  json.value("workload", options._workload);
+  json.beginObject("options");
+  json.value("records", options._records_num);
+  json.value("operations", options._operations_num);
+  json.value("threads", options._threads_num);
+  json.value("distribution", distributionName(options._mix._distribution));
+  json.value("zipf", options._zipf_constant);
+  json.value("key_size_min", options._key_size._min);
+  json.value("key_size_max", options._key_size._max);
+  json.value("value_size_min", options._value_size._min);
+  json.value("value_size_max", options._value_size._max);
+  json.value("miss_ratio", options._miss_ratio);
+  json.value("max_scan_length", options._max_scan_length);
+  json.value("cold", options._cold);
+  json.value("direct_io", options._database._bucket._direct_io);
+  json.value("compression",
+             compressionName(options._database._bucket._compression));
+  json.value("block_size", options._database._bucket._block_size);
+  json.value("page_cache_mb", options._page_cache_mb);
+  json.value("key_cache_mb", options._key_cache_mb);
+  json.value("shards", options._database._shards_num);
+  json.value("wal_sync", options._database._bucket._wal_sync);
+  json.value("seed", options._seed);
+  json.endObject();
+
+  bench::Workload workload(options);
+  writePhase(json, "load", workload.load());
+  if (micro)
+    bench::runMicroBenchmarks(workload, json);
+  if (options._workload != "load") {
+    if (options._cold)
+      json.value("cache_drop", workload.dropCaches());
+    DB::ReadMetrics read_metrics;
+    writePhase(json, "run", workload.run(read_metrics));
+    json.metrics("read_metrics", read_metrics);
+  }
+  json.metrics("write_metrics", workload.database().writeMetrics());
+  json.endObject();
+  return 0;
+}
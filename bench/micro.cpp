@@ -0,0 +1,168 @@
+#include "bench/micro.h"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+
+#include "util/io/buffered_file_input.h"
+#include "util/io/buffered_file_output.h"
+
+using namespace std;
+
+namespace humming::bench {
+
+namespace {
+
+constexpr size_t k_file_size = size_t(256) << 20;
+constexpr size_t k_block_size = 4096;
+constexpr size_t k_random_reads = 100000;
+constexpr size_t k_view_size = 128;
+constexpr size_t k_lookups = 200000;
+
+// Times body() doing ops operations of bytes bytes in total and writes ns per
+// operation and throughput as object name.
+template <typename Body>
+void measure(JsonWriter &json, string_view name, uint64_t ops, uint64_t bytes,
+             Body &&body) {
+  const auto start = std::chrono::steady_clock::now();
+  body();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  json.beginObject(name);
+  json.value("ops", ops);
+  json.value("seconds", seconds);
+  json.value("ns_per_op", seconds * 1e9 / std::max<uint64_t>(1, ops));
+  if (bytes > 0)
+    json.value("mb_per_sec", bytes / seconds / (1 << 20));
+  json.endObject();
+}
+
+void fileBenchmarks(const std::string &path, JsonWriter &json) {
+  vector<char> block(k_block_size, 'b');
+  {
+    util::io::BufferedFileOutput out(1 << 20);
+    if (out.open(path) == -1)
+      return;
+    measure(json, "buffered_output_write_4k", k_file_size / k_block_size,
+            k_file_size, [&] {
+              for (size_t written = 0; written < k_file_size;
+                   written += k_block_size)
+                out.write(block.data(), block.size());
+              out.close();
+            });
+  }
+
+  util::io::BufferedFileInput in(1 << 20);
+  if (in.open(path) == -1)
+    return;
+  measure(json, "buffered_input_read_4k", k_file_size / k_block_size,
+          k_file_size, [&] {
+            while (in.read(block.data(), block.size()) > 0) {
+            }
+          });
+  std::mt19937_64 random(1);
+  vector<off_t> offsets(k_random_reads);
+  for (auto &offset : offsets)
+    offset = random() % (k_file_size / k_block_size) * k_block_size;
+  measure(json, "buffered_input_pread_4k", offsets.size(),
+          offsets.size() * k_block_size, [&] {
+            for (const off_t offset : offsets)
+              in.pread(block.data(), block.size(), offset);
+          });
+  measure(json, "buffered_input_pread_view", offsets.size(),
+          offsets.size() * k_view_size, [&] {
+            for (const off_t offset : offsets)
+              in.preadView(offset + 100, k_view_size);
+          });
+  in.close();
+  std::error_code error;
+  std::filesystem::remove(path, error);
+}
+
+void indexBenchmarks(Workload &workload, JsonWriter &json) {
+  DB::Database &database = workload.database();
+  DB::ReadContext context;
+  DB::PageIterator &pages = context._index_iterator;
+
+  // every entry of every data file, in file order
+  uint64_t entries_num = 0;
+  vector<shared_ptr<const DataFileMetadata>> files;
+  for (size_t s = 0; s < database.shardsNum(); ++s) {
+    for (const auto &file : *database.shard(s).files()) {
+      entries_num += file->entriesCount();
+      files.push_back(file);
+    }
+  }
+  if (files.empty())
+    return;
+  auto setFile = [&](const DataFileMetadata &file) {
+    if (!file.mapping().mapped())
+      context._in.passFd(file.fd(), file.directIo());
+    pages.setFile(file, nullptr);
+  };
+  measure(json, "page_iterator_inc", entries_num, 0, [&] {
+    for (const auto &file : files) {
+      setFile(*file);
+      if (!pages.init(0, file->indexOffset(), file->entriesCount()))
+        continue;
+      while (pages.inc()) {
+      }
+    }
+  });
+
+  std::mt19937_64 random(2);
+  vector<pair<size_t, size_t>> page_ids(k_random_reads);
+  for (auto &[f, page_id] : page_ids) {
+    f = random() % files.size();
+    const size_t entries = std::max<size_t>(1, files[f]->entriesCount());
+    page_id = random() % entries / DB::IndexPage::k_entries_num;
+  }
+  measure(json, "page_iterator_set_page_id", page_ids.size(), 0, [&] {
+    for (const auto &[f, page_id] : page_ids) {
+      const auto &file = *files[f];
+      setFile(file);
+      pages.init(page_id * DB::IndexPage::k_entries_num, file.indexOffset(),
+                 file.entriesCount());
+    }
+  });
+
+  // hashes of loaded keys looked up in every file of their shard, like point
+  // reads without fetching records
+  vector<size_t> hashes(k_lookups);
+  std::string k;
+  for (auto &hash : hashes)
+    hash = DB::hashKey(
+        workload.keys().format(random() % workload.recordsNum(), k));
+  uint64_t searches = 0;
+  measure(json, "get_hash_offsets", hashes.size(), 0, [&] {
+    for (const size_t hash : hashes) {
+      const auto shard_files = database.shard(database.shardOf(hash)).files();
+      for (const auto &file : *shard_files) {
+        DB::PageSearch search;
+        if (!DB::PageSearch::create(*file, hash, search))
+          continue;
+        setFile(*file);
+        DB::getHashOffsets(context, file->entriesCount(), search,
+                           file->indexOffset());
+        ++searches;
+      }
+    }
+  });
+  json.value("get_hash_offsets_files_searched", searches);
+  pages.release();
+}
+
+} // namespace
+
+void runMicroBenchmarks(Workload &workload, JsonWriter &json) {
+  json.beginObject("micro");
+  fileBenchmarks(
+      (std::filesystem::path(workload.options()._directory) / "micro.tmp")
+          .string(),
+      json);
+  indexBenchmarks(workload, json);
+  json.endObject();
+}
+
+} // namespace humming::bench
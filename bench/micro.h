@@ -0,0 +1,15 @@
+#pragma once
+
+#include "bench/json_writer.h"
+#include "bench/workload.h"
+
+using namespace std;
+
+namespace humming::bench {
+
+// Writes results of microbenchmarks of the buffered file classes, into a
+// scratch file in the workload's directory, and of index page iteration and
+// getHashOffsets over data files of the loaded workload.
+void runMicroBenchmarks(Workload &workload, JsonWriter &json);
+
+} // namespace humming::bench
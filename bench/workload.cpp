@@ -0,0 +1,266 @@
+#include "bench/workload.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+#include "util/perf/cycle_clock.h"
+
+using namespace std;
+
+namespace humming::bench {
+
+namespace {
+
+constexpr size_t k_load_batch_size = 1 << 20;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+string_view operationName(Operation operation) {
+  static constexpr string_view k_names[] = {
+      "read",
+      "update",
+      "insert",
+      "scan",
+      "read_modify_write"};
+  static_assert(std::size(k_names) == size_t(Operation::k_num));
+  return k_names[size_t(operation)];
+}
+
+bool findMix(string_view name, Mix &mix) {
+  auto proportion = [&](Operation operation) -> double & {
+    return mix._proportions[size_t(operation)];
+  };
+  mix = Mix();
+  if (name == "a") {
+    proportion(Operation::k_read) = 0.5;
+    proportion(Operation::k_update) = 0.5;
+    mix._distribution = Distribution::k_zipfian;
+  } else if (name == "b") {
+    proportion(Operation::k_read) = 0.95;
+    proportion(Operation::k_update) = 0.05;
+    mix._distribution = Distribution::k_zipfian;
+  } else if (name == "c") {
+    proportion(Operation::k_read) = 1;
+    mix._distribution = Distribution::k_zipfian;
+  } else if (name == "d") {
+    proportion(Operation::k_read) = 0.95;
+    proportion(Operation::k_insert) = 0.05;
+    mix._distribution = Distribution::k_latest;
+  } else if (name == "e") {
+    proportion(Operation::k_scan) = 0.95;
+    proportion(Operation::k_insert) = 0.05;
+    mix._distribution = Distribution::k_zipfian;
+  } else if (name == "f") {
+    proportion(Operation::k_read) = 0.5;
+    proportion(Operation::k_read_modify_write) = 0.5;
+    mix._distribution = Distribution::k_zipfian;
+  } else if (name != "load") {
+    return false;
+  }
+  return true;
+}
+
+Workload::Workload(WorkloadOptions options)
+    : _options(std::move(options)), _keys(_options._key_size),
+      _value(_options._value_size._max, 'v') {}
+
+Workload::~Workload() = default;
+
+void Workload::open() {
+  DB::DatabaseOptions database_options = _options._database;
+  database_options._directories = {_options._directory};
+  // caches start empty with every opening
+  if (_options._page_cache_mb > 0)
+    database_options._bucket._page_cache =
+        std::make_shared<util::io::PageCache>(_options._page_cache_mb << 20);
+  if (_options._key_cache_mb > 0)
+    database_options._bucket._key_cache =
+        std::make_shared<DB::KeyCache>(_options._key_cache_mb << 20);
+  _database = std::make_unique<DB::Database>(std::move(database_options));
+}
+
+PhaseResult Workload::load() {
+  _database.reset();
+  std::error_code error;
+  std::filesystem::remove_all(_options._directory, error);
+  open();
+
+  PhaseResult result;
+  std::mt19937_64 random(_options._seed);
+  const auto start = std::chrono::steady_clock::now();
+  DB::KVBatch batch;
+  std::string k;
+  for (uint64_t i = 0; i < _options._records_num;) {
+    const uint64_t end =
+        std::min<uint64_t>(_options._records_num, i + k_load_batch_size);
+    batch.clear();
+    batch.reserve(end - i);
+    for (; i < end; ++i) {
+      _keys.format(i, k);
+      batch.add(k, string_view(_value).substr(
+                       0, _options._value_size.pick(random)));
+    }
+    const uint64_t batch_start = util::perf::CycleClock::now();
+    _database->insert(batch);
+    // every record of the batch gets the mean latency of its batch
+    const uint64_t nanos = util::perf::CycleClock::toNanos(
+        util::perf::CycleClock::now() - batch_start);
+    result._latencies[size_t(Operation::k_insert)].record(
+        nanos / batch.size(), batch.size());
+  }
+  result._seconds = secondsSince(start);
+  result._operations_num = _options._records_num;
+  _records_num = _next_record = _options._records_num;
+  return result;
+}
+
+string_view Workload::dropCaches() {
+  _database.reset();
+  ::sync();
+  string_view method = "drop_caches";
+  std::ofstream drop_caches("/proc/sys/vm/drop_caches");
+  if (!drop_caches || !(drop_caches << "3" << std::flush)) {
+    // not root, the files of the database are still evicted as they were
+    // just synced
+    method = "fadvise";
+    std::error_code error;
+    for (const auto &entry :
+         std::filesystem::recursive_directory_iterator(_options._directory,
+                                                       error)) {
+      if (!entry.is_regular_file())
+        continue;
+      const int fd = ::open(entry.path().c_str(), O_RDONLY);
+      if (fd == -1)
+        continue;
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      ::close(fd);
+    }
+  }
+  open();
+  return method;
+}
+
+PhaseResult Workload::run(DB::ReadMetrics &read_metrics) {
+  const size_t threads_num = std::max<size_t>(1, _options._threads_num);
+  vector<DB::ReadContext> contexts(threads_num);
+  vector<PhaseResult> results(threads_num);
+  vector<std::thread> clients;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < threads_num; ++t) {
+    const uint64_t operations_num =
+        _options._operations_num / threads_num +
+        (t < _options._operations_num % threads_num);
+    clients.emplace_back([this, t, operations_num, &contexts, &results] {
+      runClient(t, operations_num, contexts[t], results[t]);
+    });
+  }
+  for (auto &client : clients)
+    client.join();
+
+  PhaseResult result;
+  result._seconds = secondsSince(start);
+  for (size_t t = 0; t < threads_num; ++t) {
+    read_metrics.merge(contexts[t]._metrics);
+    result._operations_num += results[t]._operations_num;
+    result._not_found += results[t]._not_found;
+    for (size_t o = 0; o < result._latencies.size(); ++o)
+      result._latencies[o].merge(results[t]._latencies[o]);
+  }
+  return result;
+}
+
+void Workload::runClient(size_t thread, uint64_t operations_num,
+                         DB::ReadContext &context, PhaseResult &result) {
+  std::mt19937_64 random(_options._seed + 1 + thread);
+  std::uniform_real_distribution<double> uniform;
+  const KeyChooser chooser(_options._mix._distribution, _records_num,
+                           _options._zipf_constant);
+  DB::ValueHandle handle;
+  std::string k;
+  auto value = [&] {
+    return std::string(_value, 0, _options._value_size.pick(random));
+  };
+  auto read = [&](uint64_t index) {
+    const bool found =
+        _database->get(_keys.format(index, k), context, handle);
+    handle.release();
+    return found;
+  };
+
+  for (uint64_t i = 0; i < operations_num; ++i) {
+    Operation operation = Operation::k_read;
+    double u = uniform(random);
+    for (size_t o = 0; o < size_t(Operation::k_num); ++o) {
+      if (u < _options._mix._proportions[o]) {
+        operation = Operation(o);
+        break;
+      }
+      u -= _options._mix._proportions[o];
+    }
+    const uint64_t start = util::perf::CycleClock::now();
+    switch (operation) {
+    case Operation::k_read:
+      if (uniform(random) < _options._miss_ratio) {
+        read(KeyFormat::k_missing_base +
+             random() % KeyFormat::k_missing_base);
+      } else if (!read(chooser.next(random))) {
+        ++result._not_found;
+      }
+      break;
+    case Operation::k_update:
+      _keys.format(chooser.next(random), k);
+      _database->put(k, value());
+      break;
+    case Operation::k_insert: {
+      const uint64_t index = _next_record.fetch_add(1);
+      _keys.format(index, k);
+      _database->put(k, value());
+      // readers only pick published records, so inserts finishing out of
+      // order wait for the ones started before them
+      uint64_t expected = index;
+      while (!_records_num.compare_exchange_weak(expected, index + 1)) {
+        expected = index;
+        std::this_thread::yield();
+      }
+      break;
+    }
+    case Operation::k_scan: {
+      const size_t length =
+          1 + random() % std::max<size_t>(1, _options._max_scan_length);
+      _keys.format(chooser.next(random), k);
+      // short scans need about one block of every key index, the default
+      // readahead would decode and fetch values of far more entries
+      auto it = _database->scan({._begin = k, ._end = ""},
+                                DB::KeyIndex::k_block_size);
+      for (size_t n = 0; n < length && it.valid(); ++n, it.next())
+        it.value();
+      break;
+    }
+    case Operation::k_read_modify_write: {
+      const uint64_t index = chooser.next(random);
+      if (!read(index))
+        ++result._not_found;
+      _database->put(k, value());
+      break;
+    }
+    case Operation::k_num:
+      break;
+    }
+    result._latencies[size_t(operation)].record(
+        util::perf::CycleClock::toNanos(util::perf::CycleClock::now() -
+                                         start));
+  }
+  result._operations_num = operations_num;
+}
+
+} // namespace humming::bench
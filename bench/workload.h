@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "bench/generators.h"
+#include "db/database.h"
+#include "util/perf/histogram.h"
+
+using namespace std;
+
+namespace humming::bench {
+
+enum class Operation : size_t {
+  k_read,
+  k_update,
+  k_insert,
+  k_scan,
+  k_read_modify_write,
+  k_num
+};
+
+string_view operationName(Operation operation);
+
+// Proportions of operations of a workload and the distribution of keys they
+// use, proportions add up to 1.
+struct Mix {
+  std::array<double, size_t(Operation::k_num)> _proportions{};
+  Distribution _distribution = Distribution::k_uniform;
+};
+
+// YCSB core workloads a-f, "load" runs only the load phase. Returns false
+// for an unknown name.
+bool findMix(string_view name, Mix &mix);
+
+struct WorkloadOptions {
+  std::string _workload = "a";
+  Mix _mix;
+  uint64_t _records_num = 1000000;
+  uint64_t _operations_num = 1000000;
+  size_t _threads_num = 4;
+  double _zipf_constant = 0.99;
+  SizeRange _key_size{16, 16};
+  SizeRange _value_size{100, 100};
+  // share of reads asking for keys that were never written
+  double _miss_ratio = 0;
+  // scans read a uniformly chosen number of entries in [1, this]
+  size_t _max_scan_length = 100;
+  // data files are dropped from the kernel cache between load and run
+  bool _cold = false;
+  uint64_t _seed = 42;
+  // emptied before the load
+  std::string _directory = "/tmp/humming_bench/";
+  size_t _page_cache_mb = 0;
+  size_t _key_cache_mb = 0;
+  DB::DatabaseOptions _database;
+};
+
+struct PhaseResult {
+  uint64_t _operations_num = 0;
+  double _seconds = 0;
+  // latencies in nanoseconds by Operation
+  std::array<util::perf::Histogram, size_t(Operation::k_num)> _latencies;
+  // reads of existing keys that found nothing, e.g. of an insert not done yet
+  uint64_t _not_found = 0;
+};
+
+// Loads records into a database and runs a mix of operations on them from
+// many client threads. Record i has the key KeyFormat::format(i) and the
+// inserts of the run phase continue the indices after the loaded records.
+class Workload {
+private:
+  WorkloadOptions _options;
+  KeyFormat _keys;
+  unique_ptr<DB::Database> _database;
+  // records visible to readers; inserts take indices from _next_record and
+  // publish them in order
+  std::atomic<uint64_t> _records_num{0};
+  std::atomic<uint64_t> _next_record{0};
+  // one buffer of 'v' bytes every value is a prefix of
+  std::string _value;
+
+  void open();
+  // operations of the run done by one client thread
+  void runClient(size_t thread, uint64_t operations_num,
+                 DB::ReadContext &context, PhaseResult &result);
+
+public:
+  explicit Workload(WorkloadOptions options);
+  ~Workload();
+
+  const WorkloadOptions &options() const { return _options; }
+  DB::Database &database() { return *_database; }
+  const KeyFormat &keys() const { return _keys; }
+  uint64_t recordsNum() const { return _records_num.load(); }
+
+  // empties the directory and inserts _records_num records in batches
+  PhaseResult load();
+  // Reopens the database with empty caches after evicting its files from
+  // the kernel cache, with /proc/sys/vm/drop_caches when permitted,
+  // otherwise file by file with posix_fadvise. Returns the method used.
+  string_view dropCaches();
+  // runs _operations_num operations split between client threads, reads of
+  // all clients are recorded into read_metrics
+  PhaseResult run(DB::ReadMetrics &read_metrics);
+};
+
+} // namespace humming::bench
@@ -1,9 +0,0 @@
-#include "db/KV.h"
-
-using namespace std;
-
-namespace humming::DB {
-
-hash<string> hasher;
-
-}
@@ -4,18 +4,18 @@
 #include <vector>
 #include <iostream>
 
+#include "db/key_hash.h"
+
 using namespace std;
 
 namespace humming::DB {
 
-extern hash<string> hasher;
-
 struct KV {
   string _k;
   string _v;
   size_t _hash;
   KV() {}
-  KV(string &&k, string &&v) : _k(k), _v(v), _hash(hasher(_k)) {}
+  KV(string &&k, string &&v) : _k(k), _v(v), _hash(hashKey(_k)) {}
   KV(KV &&other) = default;
   KV &operator=(KV &&) = default;
 };
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace humming::DB {
+
+// Blocked Bloom filter over precomputed key hashes. All probes of a key fall
+// into a single 64 byte block, so a lookup touches one cache line.
+class BloomFilter {
+public:
+  static constexpr size_t k_block_bytes = 64;
+  static constexpr size_t k_block_words = k_block_bytes / sizeof(uint64_t);
+  static constexpr size_t k_block_bits = k_block_bytes * 8;
+
+private:
+  vector<uint64_t> _words;
+  size_t _blocks_num = 0;
+  size_t _probes = 0;
+
+  // hash is mixed again, as its top bits are also used to place the key in
+  // the index
+  static uint64_t mix(size_t hash) {
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+  }
+  const uint64_t *block(uint64_t h) const {
+    return &_words[((h >> 32) * _blocks_num >> 32) * k_block_words];
+  }
+  // step between probed bits, independent of the bits selecting the block
+  static uint32_t delta(uint64_t h) {
+    return uint32_t((h * 0xC2B2AE3D27D4EB4Full) >> 32) | 1;
+  }
+
+public:
+  // empty filter, it accepts every key
+  BloomFilter() = default;
+  BloomFilter(size_t keys_num, size_t bits_per_key)
+      : _blocks_num(std::max<size_t>(
+            1, (keys_num * bits_per_key + k_block_bits - 1) / k_block_bits)),
+        // ln(2) * bits_per_key is optimal, blocking favours a bit fewer probes
+        _probes(std::clamp<size_t>(bits_per_key * 69 / 100, 1, 16)) {
+    _words.resize(_blocks_num * k_block_words);
+  }
+  // restores filter written by data()
+  BloomFilter(const char *data, size_t size, size_t probes)
+      : _words(size / sizeof(uint64_t)), _blocks_num(size / k_block_bytes),
+        _probes(probes) {
+    memcpy(_words.data(), data, _words.size() * sizeof(uint64_t));
+  }
+
+  void add(size_t hash) {
+    uint64_t h = mix(hash);
+    uint64_t *words = const_cast<uint64_t *>(block(h));
+    uint32_t bit = h, step = delta(h);
+    for (size_t i = 0; i < _probes; ++i, bit += step)
+      words[(bit % k_block_bits) / 64] |= uint64_t(1) << (bit % 64);
+  }
+
+  bool mayContain(size_t hash) const {
+    if (_blocks_num == 0)
+      return true;
+    uint64_t h = mix(hash);
+    const uint64_t *words = block(h);
+    uint32_t bit = h, step = delta(h);
+    for (size_t i = 0; i < _probes; ++i, bit += step) {
+      if (!(words[(bit % k_block_bits) / 64] & (uint64_t(1) << (bit % 64))))
+        return false;
+    }
+    return true;
+  }
+
+  bool empty() const { return _blocks_num == 0; }
+  const char *data() const { return (const char *)_words.data(); }
+  size_t byteSize() const { return _words.size() * sizeof(uint64_t); }
+  size_t probes() const { return _probes; }
+};
+
+} // namespace humming::DB
@@ -1,4 +1,5 @@
 #include "db/bucket.h"
+#include "util/simd/search.h"
 
 using namespace std;
 
@@ -6,12 +7,524 @@ namespace humming::DB {
 
 //vector<IndexPage> pages;
 
-void Bucket::insert(KVs &&kvs) {
-  write("/home/adam/KV/"s + std::to_string(_files.size()) + ".data",
-        std::move(kvs));
+Bucket::Bucket(BucketOptions options)
+    : _options(options), _compaction_limiter(options._compaction._rate_limit) {
+  recover();
+  if (_options._compaction._policy != CompactionOptions::k_none)
+    _compaction_thread = std::thread([this] { compactionLoop(); });
+  _flush_thread = std::thread([this] { flushLoop(); });
 }
 
-PageIterator::PageIterator(util::io::BufferedFileInput &in) : _in(in) {}
+Bucket::~Bucket() {
+  // memtables that were not flushed stay in their logs
+  {
+    std::lock_guard lock(_flush_mutex);
+    _stop_flush = true;
+  }
+  _flush_cv.notify_one();
+  _flush_thread.join();
+  if (_memtables.load()->size() == 1 && _memtable->empty()) {
+    for (const auto &path : _memtable->walPaths())
+      unlink(path.c_str());
+  }
+  if (!_compaction_thread.joinable())
+    return;
+  {
+    std::lock_guard lock(_compaction_mutex);
+    _stop_compaction = true;
+  }
+  _compaction_cv.notify_one();
+  _compaction_thread.join();
+}
+
+std::string Bucket::nextFilePath(const char *extension) {
+  size_t file_number = _next_file_number.fetch_add(1);
+  return (std::filesystem::path(_options._directory) /
+          (std::to_string(file_number) + extension))
+      .string();
+}
+
+void Bucket::recover() {
+  std::error_code error;
+  std::filesystem::create_directories(_options._directory, error);
+  vector<pair<size_t, std::string>> logs;
+  vector<pair<size_t, std::string>> manifests;
+  vector<pair<size_t, std::string>> data_files;
+  vector<pair<size_t, std::string>> value_logs;
+  size_t next_file_number = 0;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(_options._directory, error)) {
+    const auto &path = entry.path();
+    const std::string stem = path.stem().string();
+    if (stem.empty() || !std::all_of(stem.begin(), stem.end(), ::isdigit))
+      continue;
+    const size_t number = std::stoull(stem);
+    next_file_number = std::max(next_file_number, number + 1);
+    if (path.extension() == ".log")
+      logs.emplace_back(number, path.string());
+    if (path.extension() == ".manifest")
+      manifests.emplace_back(number, path.string());
+    if (path.extension() == ".data")
+      data_files.emplace_back(number, path.filename().string());
+    if (path.extension() == ".vlog")
+      value_logs.emplace_back(number, path.string());
+    if (path.extension() == ".run" && unlink(path.c_str()) != 0)
+      PLOGE << "could not remove run of unfinished bulk load " << path
+            << " because: " << strerror(errno);
+  }
+  if (error) {
+    PLOGE << "could not list " << _options._directory
+          << " because: " << error.message();
+    abort();
+  }
+  _next_file_number = next_file_number;
+
+  // newest manifest starting with a complete snapshot wins
+  std::sort(manifests.rbegin(), manifests.rend());
+  vector<Manifest::FileEntry> listed;
+  auto manifest = std::find_if(
+      manifests.begin(), manifests.end(),
+      [&listed](const auto &m) { return Manifest::replay(m.second, listed); });
+  std::sort(data_files.begin(), data_files.end());
+  if (manifest == manifests.end()) {
+    // directory written before manifests, or the manifest is lost
+    if (!data_files.empty())
+      PLOGW << "no manifest in " << _options._directory << ", adopting "
+            << data_files.size() << " data files at level 0";
+    for (const auto &[number, name] : data_files)
+      listed.push_back({._name = name, ._level = 0});
+  } else {
+    // files not listed are outputs of interrupted writes or inputs of
+    // finished compactions that were not removed yet
+    for (const auto &[number, name] : data_files) {
+      if (std::none_of(listed.begin(), listed.end(),
+                       [&name](const auto &f) { return f._name == name; }) &&
+          unlink((std::filesystem::path(_options._directory) / name).c_str()))
+        PLOGE << "could not remove unlisted " << name
+              << " because: " << strerror(errno);
+    }
+  }
+  openFiles(listed, value_logs);
+  rollManifest(*_files.load());
+  for (const auto &[number, path] : manifests) {
+    if (unlink(path.c_str()) != 0)
+      PLOGE << "could not remove " << path << " because: " << strerror(errno);
+  }
+
+  _memtable = std::make_shared<MemTable>(std::make_shared<WriteAheadLog>(
+      nextFilePath(".log"), _options._wal_buffer_size));
+  std::sort(logs.begin(), logs.end());
+  for (const auto &[number, path] : logs) {
+    const size_t replayed =
+        WriteAheadLog::replay(path, [this](string &&k, string &&v) {
+          const size_t hash = hashKey(k);
+          _memtable->put(hash, std::move(k), std::move(v));
+        });
+    PLOGI << "replayed " << replayed << " entries from " << path;
+    _memtable->addWalPath(path);
+  }
+  _memtables.store(std::make_shared<const MemTables>(MemTables{_memtable}));
+}
+
+void Bucket::openFiles(const vector<Manifest::FileEntry> &listed,
+                       const vector<pair<size_t, std::string>> &value_logs) {
+  vector<shared_ptr<DataFileMetadata>> opened(listed.size());
+  util::parallel::parallelFor(
+      listed.size(), util::parallel::defaultThreadsNum(),
+      [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          opened[i] = DataFileMetadata::load(
+              (std::filesystem::path(_options._directory) / listed[i]._name)
+                  .string(),
+              openOptions());
+          if (opened[i])
+            opened[i]->setLevel(listed[i]._level);
+        }
+      });
+  // logs are shared by files whose records point into them
+  unordered_map<uint64_t, std::string> log_paths(value_logs.begin(),
+                                                 value_logs.end());
+  unordered_map<uint64_t, shared_ptr<const ValueLog>> logs;
+  auto files = std::make_shared<DataFiles>();
+  for (size_t i = 0; i < opened.size(); ++i) {
+    auto &file_meta = opened[i];
+    if (!file_meta) {
+      // listed files hold published entries, e.g. of an older format
+      // version, so they are kept aside rather than dropped from the next
+      // manifest and then removed as unlisted
+      const auto path =
+          std::filesystem::path(_options._directory) / listed[i]._name;
+      auto damaged = path;
+      damaged.replace_extension(".damaged");
+      if (rename(path.c_str(), damaged.c_str()) != 0 && errno != ENOENT) {
+        PLOGE << "could not move " << path << " to " << damaged
+              << " because: " << strerror(errno);
+        abort();
+      }
+      continue;
+    }
+    const auto &refs = file_meta->valueLogRefs();
+    for (size_t i = 0; i < refs.size(); ++i) {
+      const uint64_t number = refs[i]._log;
+      auto [it, inserted] = logs.try_emplace(number);
+      if (inserted && log_paths.count(number) > 0)
+        it->second = ValueLog::open(number, log_paths[number]);
+      if (it->second)
+        file_meta->setValueLog(i, it->second);
+      else
+        PLOGE << "value log " << number << " of " << file_meta->path()
+              << " is missing";
+    }
+    files->push_back(std::move(file_meta));
+  }
+  // logs nothing points into were written for files that were not published
+  // or that were removed by compaction, files that can't be opened may
+  // point into any of them
+  for (const auto &[number, path] : value_logs) {
+    if (files->size() == listed.size() && logs.count(number) == 0 &&
+        unlink(path.c_str()) != 0)
+      PLOGE << "could not remove unreferenced " << path
+            << " because: " << strerror(errno);
+  }
+  if (files->size() < listed.size())
+    PLOGE << listed.size() - files->size() << " of " << listed.size()
+          << " data files in " << _options._directory
+          << " can't be opened, they are renamed to .damaged";
+  if (!files->empty())
+    PLOGI << "opened " << files->size() << " data files in "
+          << _options._directory;
+  _files.store(std::move(files), std::memory_order_release);
+}
+
+void Bucket::rollManifest(const DataFiles &files) {
+  // the new manifest and its directory entry are durable once it's
+  // constructed, only then older ones may go
+  auto manifest = std::make_unique<Manifest>(nextFilePath(".manifest"), files);
+  if (_manifest && unlink(_manifest->path().c_str()) != 0)
+    PLOGE << "could not remove " << _manifest->path()
+          << " because: " << strerror(errno);
+  _manifest = std::move(manifest);
+}
+
+void Bucket::pinBackgroundThread() const {
+  if (_options._background_cpu >= 0)
+    util::parallel::pinCurrentThread(_options._background_cpu);
+}
+
+void Bucket::requestCompaction() {
+  if (!_compaction_thread.joinable())
+    return;
+  {
+    std::lock_guard lock(_compaction_mutex);
+    _compaction_requested = true;
+  }
+  _compaction_cv.notify_one();
+}
+
+template <typename Entries>
+void Bucket::invalidateCached(const Entries &kvs) {
+  KeyCache *cache = _options._key_cache.get();
+  if (!cache)
+    return;
+  // a batch of more keys than the cache holds would evict most of it anyway
+  if (kvs.size() > cache->capacity()) {
+    cache->clear();
+    return;
+  }
+  for (const auto &kv : kvs)
+    cache->invalidate(kv._hash, kv._k);
+}
+
+bool Bucket::fits(string_view k, string_view v) {
+  if (IndexPage::fits(k.size(), v.size()))
+    return true;
+  PLOGE << "entry of " << k.size() << " byte key and " << v.size()
+        << " byte value is larger than keys of "
+        << IndexPage::k_max_key_size << " and values of "
+        << IndexPage::k_max_value_size << " bytes";
+  return false;
+}
+
+bool Bucket::insert(KVs &&kvs) {
+  if (!fits(kvs))
+    return false;
+  WriteMetrics &metrics = _write_metrics.local();
+  auto _ = metrics.time(WriteHistogram::k_insert);
+  metrics.add(WriteCounter::k_inserted_entries, kvs.size());
+  // lookups take memtables as newer than files, earlier puts are flushed
+  // so the file published next is newer than them
+  flush();
+  write(nextFilePath(), kvs);
+  // cached values are dropped once the file is published
+  invalidateCached(kvs);
+  requestCompaction();
+  return true;
+}
+
+bool Bucket::insert(const KVBatch &batch) {
+  if (!fits(batch))
+    return false;
+  WriteMetrics &metrics = _write_metrics.local();
+  auto _ = metrics.time(WriteHistogram::k_insert);
+  metrics.add(WriteCounter::k_inserted_entries, batch.size());
+  flush();
+  write(nextFilePath(), batch);
+  invalidateCached(batch);
+  requestCompaction();
+  return true;
+}
+
+bool Bucket::put(string k, string v) {
+  // a logged entry that data files can't hold would fail every flush and
+  // every replay of the log
+  if (!fits(k, v))
+    return false;
+  WriteMetrics &metrics = _write_metrics.local();
+  auto _ = metrics.time(WriteHistogram::k_put);
+  metrics.add(WriteCounter::k_puts);
+  metrics.add(WriteCounter::k_put_bytes, k.size() + v.size());
+  const size_t hash = hashKey(k);
+  // k moves into the memtable, cached values are dropped after that
+  const string cached_k = _options._key_cache ? k : string();
+  shared_ptr<WriteAheadLog> wal;
+  uint64_t seq;
+  bool full;
+  {
+    // log and memtable of the entry must be the same, so flush of memtable
+    // may remove the log
+    std::shared_lock lock(_memtable_mutex);
+    wal = _memtable->wal();
+    auto append_timer = metrics.time(WriteHistogram::k_wal_append);
+    seq = wal->append(k, v);
+    append_timer.stop();
+    auto insert_timer = metrics.time(WriteHistogram::k_memtable_insert);
+    full = _memtable->put(hash, std::move(k), std::move(v)) >=
+           _options._memtable_byte_size;
+  }
+  if (_options._key_cache)
+    _options._key_cache->invalidate(hash, cached_k);
+  if (_options._wal_sync) {
+    auto sync_timer = metrics.time(WriteHistogram::k_wal_sync);
+    wal->sync(seq);
+  }
+  if (full)
+    switchMemTable(false);
+  return true;
+}
+
+void Bucket::flush() {
+  switchMemTable(true);
+  flushFrozen();
+}
+
+void Bucket::switchMemTable(bool force) {
+  WriteMetrics &metrics = _write_metrics.local();
+  {
+    // puts wait for the switch, including for the lock
+    auto _ = metrics.time(WriteHistogram::k_memtable_switch);
+    std::unique_lock lock(_memtable_mutex);
+    if (_memtable->empty() ||
+        (!force && _memtable->byteSize() < _options._memtable_byte_size))
+      return;
+    metrics.add(WriteCounter::k_memtable_switches);
+    auto memtables = std::make_shared<MemTables>(*_memtables.load());
+    _memtable = std::make_shared<MemTable>(std::make_shared<WriteAheadLog>(
+        nextFilePath(".log"), _options._wal_buffer_size));
+    memtables->push_back(_memtable);
+    _memtables.store(std::move(memtables), std::memory_order_release);
+  }
+  {
+    std::lock_guard lock(_flush_mutex);
+    _flush_requested = true;
+  }
+  _flush_cv.notify_one();
+}
+
+void Bucket::flushFrozen() {
+  std::lock_guard run_lock(_flush_run_mutex);
+  while (true) {
+    const auto memtables = _memtables.load(std::memory_order_acquire);
+    if (memtables->size() < 2)
+      return;
+    const auto &frozen = memtables->front();
+    WriteMetrics &metrics = _write_metrics.local();
+    auto _ = metrics.time(WriteHistogram::k_flush);
+    metrics.add(WriteCounter::k_flushes);
+    KVBatch batch;
+    frozen->copyTo(batch);
+    shared_ptr<const DataFileMetadata> file_meta =
+        writeFile(nextFilePath(), batch, _options._filter_bits_per_key,
+                  openOptions(), true, valueSeparation());
+    frozen->setFlushedFile(file_meta->id());
+    // the memtable is dropped before a compaction may remove the file, see
+    // readSnapshot()
+    publish([&](DataFiles &files) { files.push_back(std::move(file_meta)); },
+            [&] {
+              std::unique_lock lock(_memtable_mutex);
+              auto updated = std::make_shared<MemTables>(*_memtables.load());
+              updated->erase(updated->begin());
+              _memtables.store(std::move(updated), std::memory_order_release);
+            });
+    for (const auto &path : frozen->walPaths()) {
+      if (unlink(path.c_str()) != 0)
+        PLOGE << "could not remove " << path << " because: " << strerror(errno);
+    }
+    requestCompaction();
+  }
+}
+
+void Bucket::flushLoop() {
+  pinBackgroundThread();
+  std::unique_lock lock(_flush_mutex);
+  while (!_stop_flush) {
+    _flush_requested = false;
+    lock.unlock();
+    flushFrozen();
+    lock.lock();
+    _flush_cv.wait(lock,
+                   [this] { return _stop_flush || _flush_requested; });
+  }
+}
+
+void Bucket::compact() {
+  while (compactOnce())
+    ;
+}
+
+bool Bucket::compactOnce() {
+  std::lock_guard run_lock(_compaction_run_mutex);
+  const auto files = _files.load(std::memory_order_acquire);
+  const auto job = pickCompaction(*files, _options._compaction);
+  if (!job)
+    return collectValueLog(*files);
+  span<const shared_ptr<const DataFileMetadata>> inputs(
+      files->begin() + job->_begin, files->begin() + job->_end);
+  if (inputs.size() == 1) {
+    publish(
+        [&](DataFiles &) { inputs.front()->setLevel(job->_output_level); });
+    return true;
+  }
+  util::perf::Timer _("compaction of "s + std::to_string(inputs.size()) +
+                      " files: ");
+  WriteMetrics &metrics = _write_metrics.local();
+  auto compaction_timer = metrics.time(WriteHistogram::k_compaction);
+  metrics.add(WriteCounter::k_compactions);
+  for (const auto &input : inputs)
+    metrics.add(WriteCounter::k_compacted_bytes, input->byteSize());
+  auto merged =
+      mergeDataFiles(inputs, nextFilePath(), _options._compaction,
+                     _compaction_limiter, _options._filter_bits_per_key,
+                     openOptions(), valueSeparation());
+  merged->setLevel(job->_output_level);
+  replaceFiles(inputs, std::move(merged));
+  return true;
+}
+
+bool Bucket::collectValueLog(const DataFiles &files) {
+  const double garbage_ratio = _options._compaction._value_log_garbage_ratio;
+  if (garbage_ratio <= 0)
+    return false;
+  // bytes of every log still pointed to, the rest of it is garbage left by
+  // records dropped by compactions
+  unordered_map<uint64_t, size_t> live_bytes;
+  for (const auto &file_meta : files) {
+    for (const auto &ref : file_meta->valueLogRefs())
+      live_bytes[ref._log] += ref._bytes;
+  }
+  shared_ptr<const ValueLog> victim;
+  size_t victim_garbage = 0;
+  for (const auto &file_meta : files) {
+    for (const auto &log : file_meta->valueLogs()) {
+      if (!log)
+        continue;
+      const size_t size = log->byteSize();
+      const size_t garbage = size - std::min(size, live_bytes[log->number()]);
+      if (garbage > victim_garbage && garbage >= garbage_ratio * size) {
+        victim = log;
+        victim_garbage = garbage;
+      }
+    }
+  }
+  if (!victim)
+    return false;
+  util::perf::Timer _("collection of "s + victim->path() + " with " +
+                      util::perf::printBytes(victim_garbage) + " garbage: ");
+  const uint64_t number = victim->number();
+  for (const auto &file_meta : files) {
+    if (!file_meta->valueLog(number))
+      continue;
+    // file keeps its place and level, so versions stay ordered
+    auto rewritten = mergeDataFiles(
+        span(&file_meta, 1), nextFilePath(), _options._compaction,
+        _compaction_limiter, _options._filter_bits_per_key, openOptions(),
+        valueSeparation(), span(&number, 1));
+    rewritten->setLevel(file_meta->level());
+    replaceFiles(span(&file_meta, 1), std::move(rewritten));
+  }
+  return true;
+}
+
+void Bucket::replaceFiles(
+    span<const shared_ptr<const DataFileMetadata>> inputs,
+    shared_ptr<const DataFileMetadata> merged) {
+  publish([&](DataFiles &current) {
+    // only compaction removes files, so inputs are still adjacent
+    auto first = std::find(current.begin(), current.end(), inputs.front());
+    auto it = current.erase(first, first + inputs.size());
+    current.insert(it, std::move(merged));
+  });
+  // readers still holding older snapshots keep inputs and their logs open;
+  // files published later point only into new logs
+  std::unordered_set<uint64_t> referenced;
+  for (const auto &file_meta : *_files.load(std::memory_order_acquire)) {
+    for (const auto &ref : file_meta->valueLogRefs())
+      referenced.insert(ref._log);
+  }
+  for (const auto &input : inputs) {
+    if (unlink(input->path().c_str()) != 0)
+      PLOGE << "could not remove " << input->path()
+            << " because: " << strerror(errno);
+    for (const auto &log : input->valueLogs()) {
+      if (log && referenced.insert(log->number()).second &&
+          unlink(log->path().c_str()) != 0)
+        PLOGE << "could not remove " << log->path()
+              << " because: " << strerror(errno);
+    }
+  }
+}
+
+void Bucket::compactionLoop() {
+  pinBackgroundThread();
+  std::unique_lock lock(_compaction_mutex);
+  while (!_stop_compaction) {
+    _compaction_requested = false;
+    lock.unlock();
+    while (compactOnce()) {
+      std::lock_guard stop_lock(_compaction_mutex);
+      if (_stop_compaction)
+        return;
+    }
+    lock.lock();
+    _compaction_cv.wait(
+        lock, [this] { return _stop_compaction || _compaction_requested; });
+  }
+}
+
+PageIterator::PageIterator(util::io::BufferedFileInput &in,
+                           ReadMetrics &metrics)
+    : _in(in), _metrics(metrics) {}
+
+void PageIterator::setFile(const DataFileMetadata &file_meta,
+                           util::io::PageCache *cache) {
+  _cache = cache;
+  _file_id = file_meta.id();
+  _mapping = file_meta.mapping().mapped() ? &file_meta.mapping() : nullptr;
+}
+
+void PageIterator::release() {
+  _cached_page.release();
+  _page = _own_page;
+}
 
 // returns false if loading did not succeed
 bool PageIterator::init(size_t page_for_entry, const size_t index_offset,
@@ -34,8 +547,8 @@ bool PageIterator::setPageId(size_t page_id) {
   return load();
 }
 
-const IndexEntry &PageIterator::current() const {
-  return _page->_entries[_curr_entry_in_block];
+IndexEntry PageIterator::current() const {
+  return _page->entry(_curr_entry_in_block);
 }
 bool PageIterator::dec() {
   if (_curr_entry_in_block > 0) {
@@ -47,7 +560,7 @@ bool PageIterator::dec() {
   --_page_id;
   _size = IndexPage::k_entries_num;
   _curr_entry_in_block = _size - 1;
-  return !load();
+  return load();
 }
 bool PageIterator::inc() {
   if (_curr_entry_in_block + 1 < _size) {
@@ -61,200 +574,1767 @@ bool PageIterator::inc() {
     _size = _entries_num - _page_id * IndexPage::k_entries_num;
   }
   _curr_entry_in_block = 0;
-  return !load();
+  return load();
 }
 
 bool PageIterator::load() {
-  //  _page = &pages[_page_id];
-  //  return false;
-  return _in.pread((char *)_page, sizeof(IndexPage),
-                   _index_offset + _page_id * sizeof(IndexPage)) !=
-         sizeof(IndexPage);
+  const size_t offset = _index_offset + _page_id * sizeof(IndexPage);
+  _metrics.add(ReadCounter::k_index_pages);
+  if (_mapping) {
+    _cached_page.release();
+    _page = reinterpret_cast<const IndexPage *>(
+        _mapping->view(offset, sizeof(IndexPage)));
+    if (_page != nullptr)
+      return true;
+    _page = _own_page;
+    return false;
+  }
+  auto load_page = [&](char *page) {
+    return _in.pread(page, sizeof(IndexPage), offset) == sizeof(IndexPage);
+  };
+  if (_cache) {
+    bool loaded = false;
+    _cached_page = _cache->get(_file_id, offset, [&](char *page) {
+      loaded = true;
+      return load_page(page);
+    });
+    _metrics.add(loaded ? ReadCounter::k_page_cache_misses
+                        : ReadCounter::k_page_cache_hits);
+    if (_cached_page) {
+      _page = reinterpret_cast<const IndexPage *>(_cached_page.data());
+      return true;
+    }
+  }
+  _cached_page.release();
+  _page = _own_page;
+  return load_page((char *)_own_page);
 }
 
-void getHashOffsets(ReadContext &context, size_t size, size_t hash,
-                    size_t offset) {
+PageSearch::PageSearch(size_t hash, size_t entries_num)
+    : _hash(hash), _lo(0), _hi(IndexPage::pagesNum(entries_num) - 1) {
   // estimated initial position of key
-  size_t curr_entry = (hash >> 32) * size / (size_t(1) << 32);
-  PageIterator &block = context._index_iterator;
-  block.init(curr_entry, offset, size);
+  size_t curr_entry = (hash >> 32) * entries_num / (size_t(1) << 32);
+  _page_id = curr_entry / IndexPage::k_entries_num;
+}
 
-  const auto curr_hash = block.current()._hash;
+bool PageSearch::create(const DataFileMetadata &file_meta, size_t hash,
+                        PageSearch &search) {
+  if (file_meta.entriesCount() == 0 || !file_meta.filter().mayContain(hash))
+    return false;
+  search = PageSearch(hash, file_meta.entriesCount());
+  if (!file_meta.fences().empty()) {
+    if (!file_meta.fences().find(hash, search._page_id))
+      return false;
+    search._lo = search._hi = search._page_id;
+  } else if (!file_meta.model().empty()) {
+    // hash present in the file is within error of predicted entry
+    const auto &model = file_meta.model();
+    const size_t entry = model.predict(hash);
+    search._page_id = entry / IndexPage::k_entries_num;
+    search._lo = (entry - std::min(entry, model.error())) /
+                 IndexPage::k_entries_num;
+    search._hi =
+        std::min(entry + model.error(), file_meta.entriesCount() - 1) /
+        IndexPage::k_entries_num;
+  }
+  return true;
+}
+
+bool PageSearch::step(const IndexPage &page, size_t size, size_t &begin,
+                      size_t &end) {
+  begin = end = 0;
+  if (_hash < page._first_hash) { // let's search for hash on left side
+    if (_page_id == _lo)
+      return true;
+    size_t preceding_hashes_num =
+        std::min(_page_id - _lo, IndexPage::k_hashes_num);
+    // preceding hashes descend, so p counts the pages above hash
+    size_t p = util::simd::countGreater((const uint64_t *)page._pre_hashes,
+                                        preceding_hashes_num, _hash);
+    if (p == preceding_hashes_num && _page_id - p == _lo)
+      return true; // there is no page meeting the criteria
+    _hi = _page_id - p - 1;
+    if (p < preceding_hashes_num)
+      _lo = _hi; // this page starts at or below hash, next one above it
+    _page_id = _hi;
+    return false;
+  }
+  if (_hash > page._last_hash) { // let's search on right side
+    if (_page_id == _hi)
+      return true;
+    size_t following_hashes_num =
+        std::min(_hi - _page_id, IndexPage::k_hashes_num);
+    size_t p = util::simd::countLess((const uint64_t *)page._post_hashes,
+                                     following_hashes_num, _hash);
+    if (p == following_hashes_num && _page_id + p == _hi)
+      return true; // there is no page meeting the criteria
+    _lo = _page_id + p + 1;
+    if (p < following_hashes_num)
+      _hi = _lo; // this page ends at or above hash, previous one below it
+    _page_id = _lo;
+    return false;
+  }
+  // entries sharing truncated hash may have other hashes, their keys tell
+  const uint32_t hash = page.truncate(_hash);
+  begin = util::simd::lowerBound(page._hashes, size, hash);
+  end = begin;
+  while (end < size && page._hashes[end] == hash)
+    ++end;
+  return true;
+}
+
+void getHashOffsets(ReadContext &context, size_t size, PageSearch search,
+                    size_t offset) {
   context._result.clear();
-  if (curr_hash == hash) { // let's search for a range
-    context._result.emplace_back(block.current()._offset);
-    while (block.dec() && block.current()._hash == hash) {
-      context._result.emplace_back(block.current()._offset);
+  const size_t hash = search._hash;
+  PageIterator &block = context._index_iterator;
+  if (!block.init(search._page_id * IndexPage::k_entries_num, offset, size))
+    return;
+  size_t begin, end;
+  while (!search.step(*block._page, block._size, begin, end)) {
+    if (!block.setPageId(search._page_id))
+      return;
+  }
+  for (size_t i = begin; i < end; ++i)
+    context._result.push_back(block._page->entry(i));
+  if (begin == end)
+    return;
+
+  // run of equal hashes may continue on neighbouring pages if it reaches a
+  // boundary of this page
+  const size_t page_id = block._page_id;
+  const size_t page_size = block._size;
+  const bool at_first = block._page->_first_hash == hash;
+  const bool at_last = block._page->_last_hash == hash;
+  if (begin == 0 && at_first) {
+    block._curr_entry_in_block = 0;
+    while (block.dec() &&
+           block._page->mayHaveHash(block._curr_entry_in_block, hash))
+      context._result.push_back(block.current());
+  }
+  if (end == page_size && at_last) {
+    if (block._page_id != page_id && !block.setPageId(page_id))
+      return;
+    block._curr_entry_in_block = end - 1;
+    while (block.inc() &&
+           block._page->mayHaveHash(block._curr_entry_in_block, hash))
+      context._result.push_back(block.current());
+  }
+}
+
+namespace {
+
+// Destination of a value read for a key, either a KV appended to KVs or views
+// into arena of a KVBatch. value(size) returns buffer for the whole value,
+// commit() keeps the entry once the value is filled.
+struct KVsSink {
+  KVs &_result;
+  string_view _k;
+  size_t _hash;
+  KV _kv = {};
+
+  char *value(size_t size) {
+    _kv._v.resize(size);
+    return _kv._v.data();
+  }
+  void commit() {
+    _kv._k = _k;
+    _kv._hash = _hash;
+    _result.emplace_back(std::move(_kv));
+    _kv = KV();
+  }
+};
+
+struct KVBatchSink {
+  KVBatch &_result;
+  string_view _k;
+  size_t _hash;
+  // key is copied to the arena once, all versions share it
+  string_view _arena_k = {};
+  string_view _v = {};
+
+  char *value(size_t size) {
+    char *v = _result.arena().allocate(size);
+    _v = {v, size};
+    return v;
+  }
+  void commit() {
+    if (_arena_k.size() != _k.size())
+      _arena_k = _result.arena().copy(_k);
+    _result.addView({._k = _arena_k, ._v = _v, ._hash = _hash});
+  }
+};
+
+// Value copied into a string, by getAsync().
+struct StringSink {
+  string &_v;
+
+  char *value(size_t size) {
+    _v.resize(size);
+    return _v.data();
+  }
+  void commit() {}
+};
+
+// Value written to memory given by the caller of get().
+struct BufferSink {
+  const std::function<char *(size_t)> &_buffer;
+  // last value returned, kept for the key cache
+  const char *_v = nullptr;
+  size_t _size = 0;
+
+  char *value(size_t size) {
+    _size = size;
+    char *v = _buffer(size);
+    _v = v;
+    return v;
+  }
+  void commit() {}
+};
+
+// Passes values to another sink and keeps copies of committed ones, which
+// fill the key cache after a read.
+template <typename Sink> struct CachingSink {
+  Sink &_sink;
+  vector<string> _values = {};
+  const char *_v = nullptr;
+  size_t _size = 0;
+
+  char *value(size_t size) {
+    _size = size;
+    char *v = _sink.value(size);
+    _v = v;
+    return v;
+  }
+  void commit() {
+    // sink may move the value away on commit
+    _values.emplace_back(_v, _size);
+    _sink.commit();
+  }
+};
+
+// Value read into memory of a handle, which points at it once committed.
+struct HandleSink {
+  ValueHandle &_handle;
+  char *_value = nullptr;
+  size_t _size = 0;
+
+  char *value(size_t size) {
+    _size = size;
+    return _value = _handle.buffer(size);
+  }
+  void commit() { _handle.addPart(_value, _size); }
+};
+
+// Pointer held by a record whose value was moved to a value log, read like
+// any value before the value itself is read from the log.
+struct PointerSink {
+  char _encoded[ValuePointer::k_max_encoded_size];
+  size_t _size = 0;
+
+  // records holding more than a pointer are corrupted
+  static bool fits(const IndexEntry &entry) {
+    return entry._value_size <= ValuePointer::k_max_encoded_size;
+  }
+  char *value(size_t size) {
+    _size = size;
+    return _encoded;
+  }
+  void commit() {}
+
+  // reads value pointed to into sink, returns false if the pointer or its
+  // log are broken
+  template <typename Sink>
+  bool readValue(const DataFileMetadata &file_meta, Sink &sink,
+                 ReadMetrics &metrics) const {
+    ValuePointer pointer;
+    if (!pointer.decode(string_view(_encoded, _size)))
+      return false;
+    const auto &log = file_meta.valueLog(pointer._log);
+    if (!log)
+      return false;
+    auto _ = metrics.time(ReadHistogram::k_value_log);
+    metrics.add(ReadCounter::k_value_log_reads);
+    metrics.add(ReadCounter::k_syscalls);
+    metrics.add(ReadCounter::k_bytes_read, pointer._size);
+    return log->read(pointer, sink.value(pointer._size));
+  }
+};
+
+// Compares k with key stored at offset in chunks, read(buffer, size, offset)
+// fetches bytes of the record.
+template <typename Read>
+bool keyMatches(Read &&read, size_t offset, string_view k) {
+  char chunk[256];
+  for (size_t done = 0; done < k.size(); done += sizeof(chunk)) {
+    const size_t size = std::min(sizeof(chunk), k.size() - done);
+    if (!read(chunk, size, offset + done) ||
+        memcmp(chunk, k.data() + done, size) != 0)
+      return false;
+  }
+  return true;
+}
+
+// Reads ranges of a file through the page cache, loading missing pages with
+// preads of the context and counting hits and misses of the cache.
+struct CachedFileReader {
+  util::io::PageCache &_cache;
+  uint64_t _file_id;
+  ReadContext &_context;
+
+  // loads k_sector_size page, zeroing its part past the end of the file
+  bool load(char *page, size_t page_offset) {
+    _context._metrics.add(ReadCounter::k_page_cache_misses);
+    ssize_t bytes_read =
+        _context._in.pread(page, util::io::k_sector_size, page_offset);
+    if (bytes_read <= 0)
+      return false;
+    memset(page + bytes_read, 0, util::io::k_sector_size - bytes_read);
+    return true;
+  }
+  bool read(char *out, size_t size, size_t offset) {
+    constexpr size_t k_page = util::io::k_sector_size;
+    size_t loaded = 0;
+    const bool read = _cache.read(_file_id, offset, out, size,
+                                  [&](char *page, size_t page_offset) {
+                                    ++loaded;
+                                    return load(page, page_offset);
+                                  });
+    const size_t pages =
+        size == 0 ? 0 : (offset + size - 1) / k_page - offset / k_page + 1;
+    _context._metrics.add(ReadCounter::k_page_cache_hits,
+                          pages - std::min(pages, loaded));
+    return read;
+  }
+  // pinned page, empty if it can't get a frame
+  util::io::PageCache::Handle get(size_t page_offset) {
+    bool loaded = false;
+    auto page = _cache.get(_file_id, page_offset, [&](char *frame) {
+      loaded = true;
+      return load(frame, page_offset);
+    });
+    if (!loaded && page)
+      _context._metrics.add(ReadCounter::k_page_cache_hits);
+    return page;
+  }
+};
+
+// Reads value of record of entry into sink through page cache. Returns false
+// if record holds other key than k or could not be read.
+template <typename Sink>
+bool readCachedRecord(util::io::PageCache &cache,
+                      const DataFileMetadata &file_meta, ReadContext &context,
+                      const IndexEntry &entry, string_view k, Sink &sink) {
+  CachedFileReader reader{
+      ._cache = cache, ._file_id = file_meta.id(), ._context = context};
+  auto read = [&](char *out, size_t size, size_t offset) {
+    return reader.read(out, size, offset);
+  };
+  return keyMatches(read, entry.keyOffset(), k) &&
+         read(sink.value(entry._value_size), entry._value_size,
+              entry.valueOffset());
+}
+
+// Reads value of record of entry into sink straight from mapping of the file.
+// Returns false if record holds other key than k or lies outside the file.
+template <typename Sink>
+bool readMappedRecord(const util::io::MmapFileInput &mapping,
+                      const IndexEntry &entry, string_view k, Sink &sink) {
+  const char *body = mapping.view(entry.keyOffset(), entry.bodySize());
+  if (body == nullptr || memcmp(body, k.data(), k.size()) != 0)
+    return false;
+  memcpy(sink.value(entry._value_size), body + entry._key_size,
+         entry._value_size);
+  return true;
+}
+
+// Reads value of record of entry into sink if it holds k. Sizes come from
+// the index, so key and value are fetched with one exact size read skipping
+// the record header: small ones through the sectors buffered by
+// ReadContext::_in, larger ones with preadv placing the value straight into
+// the sink. Only positional reads are used, so descriptor may be shared
+// between threads.
+template <typename Sink>
+bool readRecord(ReadContext &context, const IndexEntry &entry, string_view k,
+                Sink &sink) {
+  auto &in = context._in;
+  const size_t body_end = entry.keyOffset() + entry.bodySize();
+  if (entry.bodySize() <= ReadContext::k_record_window) {
+    const char *body = in.preadView(entry.keyOffset(), entry.bodySize());
+    if (body == nullptr || memcmp(body, k.data(), k.size()) != 0)
+      return false;
+    memcpy(sink.value(entry._value_size), body + entry._key_size,
+           entry._value_size);
+    return true;
+  }
+  if (in.directIo()) {
+    // covering sectors are read into aligned memory with one direct read
+    constexpr size_t k_sector = util::io::k_sector_size;
+    const size_t begin = entry.keyOffset() / k_sector * k_sector;
+    const size_t size = util::io::calculate_aligned_size(body_end - begin);
+    char *mem = context.batchBuffer(size);
+    if (in.pread(mem, size, begin) < ssize_t(body_end - begin))
+      return false;
+    const char *body = mem + (entry.keyOffset() - begin);
+    if (memcmp(body, k.data(), k.size()) != 0)
+      return false;
+    memcpy(sink.value(entry._value_size), body + entry._key_size,
+           entry._value_size);
+    return true;
+  }
+  char *window = context._record_window.get();
+  char *value = sink.value(entry._value_size);
+  if (k.size() <= ReadContext::k_record_window) {
+    iovec parts[] = {{window, k.size()}, {value, entry._value_size}};
+    return in.preadv(parts, 2, entry.keyOffset()) ==
+               ssize_t(entry.bodySize()) &&
+           memcmp(window, k.data(), k.size()) == 0;
+  }
+  // key longer than the window is compared in chunks
+  auto read = [&](char *out, size_t size, size_t offset) {
+    return in.pread(out, size, offset) == ssize_t(size);
+  };
+  return keyMatches(read, entry.keyOffset(), k) &&
+         read(value, entry._value_size, entry.valueOffset());
+}
+
+// Points handle at value of record of entry inside mapping of the file.
+bool viewMappedRecord(const util::io::MmapFileInput &mapping,
+                      const IndexEntry &entry, string_view k,
+                      ValueHandle &handle) {
+  const char *body = mapping.view(entry.keyOffset(), entry.bodySize());
+  if (body == nullptr || memcmp(body, k.data(), k.size()) != 0)
+    return false;
+  handle.addPart(body + entry._key_size, entry._value_size);
+  return true;
+}
+
+// Pins cached pages holding value of record of entry and points handle at
+// them, one part per page. If a page can't get a frame, e.g. because all of
+// its shard are pinned, the value is copied into memory of the handle.
+bool viewCachedRecord(util::io::PageCache &cache,
+                      const DataFileMetadata &file_meta, ReadContext &context,
+                      const IndexEntry &entry, string_view k,
+                      ValueHandle &handle) {
+  constexpr size_t k_page = util::io::k_sector_size;
+  CachedFileReader reader{
+      ._cache = cache, ._file_id = file_meta.id(), ._context = context};
+  auto read = [&](char *out, size_t size, size_t offset) {
+    return reader.read(out, size, offset);
+  };
+  if (!keyMatches(read, entry.keyOffset(), k))
+    return false;
+  size_t offset = entry.valueOffset();
+  const size_t end = offset + entry._value_size;
+  while (offset < end) {
+    const size_t page_offset = offset / k_page * k_page;
+    auto page = reader.get(page_offset);
+    if (!page) {
+      handle.release();
+      char *value = handle.buffer(entry._value_size);
+      if (!read(value, entry._value_size, entry.valueOffset()))
+        return false;
+      handle.addPart(value, entry._value_size);
+      return true;
+    }
+    const size_t in_page =
+        std::min(end - offset, k_page - (offset - page_offset));
+    handle.addPart(page.data() + (offset - page_offset), in_page);
+    handle.pinPage(std::move(page));
+    offset += in_page;
+  }
+  return true;
+}
+
+// Reads value of record of entry into memory of the handle, with direct I/O
+// the covering sectors are read there and the handle points into them
+// instead of copying the value out.
+bool viewRecord(ReadContext &context, const IndexEntry &entry, string_view k,
+                ValueHandle &handle) {
+  auto &in = context._in;
+  if (in.directIo() && entry.bodySize() > ReadContext::k_record_window) {
+    constexpr size_t k_sector = util::io::k_sector_size;
+    const size_t begin = entry.keyOffset() / k_sector * k_sector;
+    const size_t body_end = entry.keyOffset() + entry.bodySize();
+    const size_t size = util::io::calculate_aligned_size(body_end - begin);
+    char *mem = handle.buffer(size);
+    if (in.pread(mem, size, begin) < ssize_t(body_end - begin))
+      return false;
+    const char *body = mem + (entry.keyOffset() - begin);
+    if (memcmp(body, k.data(), k.size()) != 0)
+      return false;
+    handle.addPart(body + entry._key_size, entry._value_size);
+    return true;
+  }
+  HandleSink sink{._handle = handle};
+  if (!readRecord(context, entry, k, sink))
+    return false;
+  sink.commit();
+  return true;
+}
+
+// Returns records of block b of a compressed file, read through mapping of
+// the file, cache or preads and decompressed into memory of the context.
+// nullptr if the block could not be read or is corrupted.
+const char *loadBlock(util::io::PageCache *cache,
+                      const DataFileMetadata &file_meta, ReadContext &context,
+                      size_t b) {
+  const DataBlocks &blocks = file_meta.blocks();
+  const BlockHandle &handle = blocks.handle(b);
+  const auto &mapping = file_meta.mapping();
+  const char *stored;
+  if (mapping.mapped()) {
+    stored = mapping.view(handle._offset, handle._size);
+  } else if (cache) {
+    CachedFileReader reader{
+        ._cache = *cache, ._file_id = file_meta.id(), ._context = context};
+    char *mem = context.batchBuffer(handle._size);
+    stored = reader.read(mem, handle._size, handle._offset) ? mem : nullptr;
+  } else {
+    // with direct I/O the covering sectors are read
+    constexpr size_t k_sector = util::io::k_sector_size;
+    const bool direct = context._in.directIo();
+    const size_t begin =
+        direct ? handle._offset / k_sector * k_sector : handle._offset;
+    const size_t end = handle._offset + handle._size;
+    const size_t size =
+        direct ? util::io::calculate_aligned_size(end - begin) : end - begin;
+    char *mem = context.batchBuffer(size);
+    stored = context._in.pread(mem, size, begin) >= ssize_t(end - begin)
+                 ? mem + (handle._offset - begin)
+                 : nullptr;
+  }
+  if (stored == nullptr)
+    return nullptr;
+  if (handle.compressed())
+    context._metrics.add(ReadCounter::k_blocks_decompressed);
+  return blocks.restore(b, stored, context.blockBuffer(handle._raw_size));
+}
+
+// Reads value of record of entry of a compressed file into sink if it holds
+// k, through the whole block of the record.
+template <typename Sink>
+bool readBlockRecord(util::io::PageCache *cache,
+                     const DataFileMetadata &file_meta, ReadContext &context,
+                     const IndexEntry &entry, string_view k, Sink &sink) {
+  const DataBlocks &blocks = file_meta.blocks();
+  if (!blocks.holds(entry))
+    return false;
+  const char *records =
+      loadBlock(cache, file_meta, context, blocks.block(entry.offset()));
+  if (records == nullptr)
+    return false;
+  const char *body = records + blocks.keySlot(entry);
+  if (memcmp(body, k.data(), k.size()) != 0)
+    return false;
+  memcpy(sink.value(entry._value_size), body + entry._key_size,
+         entry._value_size);
+  return true;
+}
+
+// Reads value of record of entry into sink if it holds k, through mapping of
+// the file, cache or preads, decompressing its block in compressed files.
+// Value of a separated record is read from its value log once the pointer is
+// read from the record.
+template <typename Sink>
+bool readValue(util::io::PageCache *cache, const DataFileMetadata &file_meta,
+               ReadContext &context, const IndexEntry &entry, string_view k,
+               Sink &sink) {
+  auto read_record = [&](auto &record_sink) {
+    const auto &mapping = file_meta.mapping();
+    return !file_meta.blocks().empty()
+               ? readBlockRecord(cache, file_meta, context, entry, k,
+                                 record_sink)
+           : mapping.mapped()
+               ? readMappedRecord(mapping, entry, k, record_sink)
+           : cache ? readCachedRecord(*cache, file_meta, context, entry, k,
+                                      record_sink)
+                   : readRecord(context, entry, k, record_sink);
+  };
+  if (!entry.separated())
+    return read_record(sink);
+  PointerSink pointer;
+  return PointerSink::fits(entry) && read_record(pointer) &&
+         pointer.readValue(file_meta, sink, context._metrics);
+}
+
+// appends entries of k from memtables, oldest first like files
+template <typename Sink>
+void readMemTables(const MemTables &memtables, size_t hash, string_view k,
+                   Sink &sink, ReadMetrics &metrics) {
+  auto _ = metrics.time(ReadHistogram::k_memtables);
+  for (const auto &memtable : memtables) {
+    if (memtable->visit(hash, k, [&](const string &v) {
+          memcpy(sink.value(v.size()), v.data(), v.size());
+        })) {
+      metrics.add(ReadCounter::k_memtable_hits);
+      sink.commit();
+    }
+  }
+}
+
+// Counts a lookup of one key and times it, recording bytes and syscalls it
+// took once it's done.
+class LookupScope {
+private:
+  ReadMetrics &_metrics;
+  util::perf::ScopedTimer _timer;
+  uint64_t _syscalls;
+  uint64_t _bytes_read;
+
+public:
+  LookupScope(ReadMetrics &metrics, ReadHistogram stage)
+      : _metrics(metrics), _timer(metrics.time(stage)),
+        _syscalls(metrics.count(ReadCounter::k_syscalls)),
+        _bytes_read(metrics.count(ReadCounter::k_bytes_read)) {
+    _metrics.add(ReadCounter::k_lookups);
+  }
+  ~LookupScope() {
+    _metrics.record(ReadHistogram::k_lookup_syscalls,
+                    _metrics.count(ReadCounter::k_syscalls) - _syscalls);
+    _metrics.record(ReadHistogram::k_lookup_bytes,
+                    _metrics.count(ReadCounter::k_bytes_read) - _bytes_read);
+  }
+  LookupScope(const LookupScope &) = delete;
+  LookupScope &operator=(const LookupScope &) = delete;
+};
+
+// Looks k up in the key cache, timing it and counting the outcome.
+template <typename Found>
+bool findCached(KeyCache &cache, size_t hash, string_view k,
+                bool all_versions, ReadMetrics &metrics, Found &&found) {
+  auto _ = metrics.time(ReadHistogram::k_key_cache);
+  const bool hit = cache.find(hash, k, all_versions, found);
+  metrics.add(hit ? ReadCounter::k_key_cache_hits
+                  : ReadCounter::k_key_cache_misses);
+  return hit;
+}
+
+} // namespace
+
+template <typename ReadRecord>
+bool Bucket::findRecord(const DataFileMetadata &file_meta, string_view k,
+                        size_t hash, ReadContext &context,
+                        ReadRecord &&read_record) {
+  ReadMetrics &metrics = context._metrics;
+  PageSearch search;
+  if (!PageSearch::create(file_meta, hash, search)) {
+    metrics.add(ReadCounter::k_filter_negatives);
+    return false;
+  }
+  auto _ = metrics.time(ReadHistogram::k_file);
+  metrics.add(ReadCounter::k_files_searched);
+  const size_t syscalls = context._in.syscallsNum();
+  const size_t bytes_read = context._in.bytesRead();
+  const auto &mapping = file_meta.mapping();
+  if (!mapping.mapped())
+    context._in.passFd(file_meta.fd(), file_meta.directIo());
+  context._index_iterator.setFile(file_meta, _options._page_cache.get());
+  auto search_timer = metrics.time(ReadHistogram::k_index_search);
+  getHashOffsets(context, file_meta.entriesCount(), search,
+                 file_meta.indexOffset());
+  search_timer.stop();
+  bool found = false;
+  for (const auto &entry : context._result) {
+    if (!entry.mayHold(k))
+      continue;
+    metrics.add(ReadCounter::k_records_read);
+    auto record_timer = metrics.time(ReadHistogram::k_record);
+    if (read_record(entry)) {
+      found = true;
+      break;
+    }
+  }
+  context._index_iterator.release();
+  if (!mapping.mapped())
+    context._in.close();
+  if (!found)
+    metrics.add(ReadCounter::k_false_positives);
+  metrics.add(ReadCounter::k_syscalls, context._in.syscallsNum() - syscalls);
+  metrics.add(ReadCounter::k_bytes_read, context._in.bytesRead() - bytes_read);
+  return found;
+}
+
+template <typename Sink>
+bool Bucket::readFile(const DataFileMetadata &file_meta, string_view k,
+                      size_t hash, ReadContext &context, Sink &sink) {
+  auto read_record = [&](const IndexEntry &entry) {
+    return readValue(_options._page_cache.get(), file_meta, context, entry, k,
+                     sink);
+  };
+  if (!findRecord(file_meta, k, hash, context, read_record))
+    return false;
+  sink.commit();
+  return true;
+}
+
+template <typename FindInMemTable, typename FindInFile>
+bool Bucket::findNewest(FindInMemTable &&find_in_memtable,
+                        FindInFile &&find_in_file) {
+  const auto [memtables, files] = readSnapshot();
+  for (auto it = memtables->rbegin(); it != memtables->rend(); ++it) {
+    if (find_in_memtable(**it))
+      return true;
+  }
+  for (auto it = files->rbegin(); it != files->rend(); ++it) {
+    if (find_in_file(*it))
+      return true;
+  }
+  return false;
+}
+
+bool Bucket::get(string_view k, ReadContext &context, ValueHandle &handle) {
+  handle.release();
+  ReadMetrics &metrics = context._metrics;
+  LookupScope lookup(metrics, ReadHistogram::k_get);
+  const size_t hash = hashKey(k);
+  KeyCache *cache = _options._key_cache.get();
+  auto copy_cached = [&](span<const string> values) {
+    const string &v = values.back();
+    char *value = handle.buffer(v.size());
+    memcpy(value, v.data(), v.size());
+    handle.addPart(value, v.size());
+  };
+  if (cache && findCached(*cache, hash, k, false, metrics, copy_cached))
+    return true;
+  const uint64_t ticket = cache ? cache->ticket(hash) : 0;
+  auto find_in_memtable = [&](const MemTable &memtable) {
+    auto _ = metrics.time(ReadHistogram::k_memtables);
+    // memtable values may be overwritten, so they are copied
+    const bool found = memtable.visit(hash, k, [&](const string &v) {
+      char *value = handle.buffer(v.size());
+      memcpy(value, v.data(), v.size());
+      handle.addPart(value, v.size());
+    });
+    if (found)
+      metrics.add(ReadCounter::k_memtable_hits);
+    return found;
+  };
+  auto find_in_file = [&](const shared_ptr<const DataFileMetadata> &file) {
+    const auto &mapping = file->mapping();
+    auto view_record = [&](const IndexEntry &entry) {
+      if (entry.separated() || !file->blocks().empty()) {
+        // values in value logs and compressed blocks are read into memory of
+        // the handle
+        HandleSink sink{._handle = handle};
+        if (!readValue(_options._page_cache.get(), *file, context, entry, k,
+                       sink))
+          return false;
+        sink.commit();
+        return true;
+      }
+      return mapping.mapped() ? viewMappedRecord(mapping, entry, k, handle)
+             : _options._page_cache
+                 ? viewCachedRecord(*_options._page_cache, *file, context,
+                                    entry, k, handle)
+                 : viewRecord(context, entry, k, handle);
+    };
+    if (!findRecord(*file, k, hash, context, view_record))
+      return false;
+    if (mapping.mapped())
+      handle.pinFile(file);
+    return true;
+  };
+  if (!findNewest(find_in_memtable, find_in_file))
+    return false;
+  if (cache) {
+    vector<string> values(1, string(handle.size(), '\0'));
+    handle.copyTo(values[0].data());
+    cache->fill(hash, k, std::move(values), false, ticket);
+  }
+  return true;
+}
+
+bool Bucket::get(string_view k, ReadContext &context,
+                 const std::function<char *(size_t)> &buffer) {
+  BufferSink sink{._buffer = buffer};
+  ReadMetrics &metrics = context._metrics;
+  LookupScope lookup(metrics, ReadHistogram::k_get);
+  const size_t hash = hashKey(k);
+  KeyCache *cache = _options._key_cache.get();
+  auto copy_cached = [&](span<const string> values) {
+    const string &v = values.back();
+    memcpy(buffer(v.size()), v.data(), v.size());
+  };
+  if (cache && findCached(*cache, hash, k, false, metrics, copy_cached))
+    return true;
+  const uint64_t ticket = cache ? cache->ticket(hash) : 0;
+  auto find_in_memtable = [&](const MemTable &memtable) {
+    auto _ = metrics.time(ReadHistogram::k_memtables);
+    const bool found = memtable.visit(hash, k, [&](const string &v) {
+      memcpy(sink.value(v.size()), v.data(), v.size());
+    });
+    if (found)
+      metrics.add(ReadCounter::k_memtable_hits);
+    return found;
+  };
+  auto find_in_file = [&](const shared_ptr<const DataFileMetadata> &file) {
+    return readFile(*file, k, hash, context, sink);
+  };
+  if (!findNewest(find_in_memtable, find_in_file))
+    return false;
+  if (cache)
+    cache->fill(hash, k, {string(sink._v, sink._size)}, false, ticket);
+  return true;
+}
+
+template <typename Sink>
+void Bucket::read(string_view k, size_t hash, ReadContext &context,
+                  Sink &sink) {
+  LookupScope lookup(context._metrics, ReadHistogram::k_read);
+  KeyCache *cache = _options._key_cache.get();
+  if (!cache) {
+    readUncached(k, hash, context, sink);
+    return;
+  }
+  auto copy_cached = [&](span<const string> values) {
+    for (const auto &v : values) {
+      memcpy(sink.value(v.size()), v.data(), v.size());
+      sink.commit();
     }
-    block.init(curr_entry, offset, size);
-    while (block.inc() && block.current()._hash == hash) {
-      context._result.emplace_back(block.current()._offset);
+  };
+  if (findCached(*cache, hash, k, true, context._metrics, copy_cached))
+    return;
+  const uint64_t ticket = cache->ticket(hash);
+  CachingSink<Sink> caching{._sink = sink};
+  readUncached(k, hash, context, caching);
+  cache->fill(hash, k, std::move(caching._values), true, ticket);
+}
+
+template <typename Sink>
+void Bucket::readUncached(string_view k, size_t hash, ReadContext &context,
+                          Sink &sink) {
+  const auto [memtables, files] = readSnapshot();
+  for (const auto &file_meta : *files)
+    readFile(*file_meta, k, hash, context, sink);
+  readMemTables(*memtables, hash, k, sink, context._metrics);
+}
+
+KVs Bucket::read(const string &k, ReadContext &context) {
+  KVs result;
+  KVsSink sink{._result = result, ._k = k, ._hash = hashKey(k)};
+  read(k, sink._hash, context, sink);
+  return result;
+}
+
+size_t Bucket::read(string_view k, ReadContext &context, KVBatch &result) {
+  const size_t size = result.size();
+  KVBatchSink sink{._result = result, ._k = k, ._hash = hashKey(k)};
+  read(k, sink._hash, context, sink);
+  return result.size() - size;
+}
+
+void Bucket::publish(const std::function<void(DataFiles &)> &update,
+                     const std::function<void()> &published) {
+  auto _ = _write_metrics.local().time(WriteHistogram::k_publish);
+  std::lock_guard lock(_publish_mutex);
+  const auto current = _files.load();
+  auto files = std::make_shared<DataFiles>(*current);
+  update(*files);
+  // data files and value logs the edit lists are found after a crash only
+  // once their directory entries are durable
+  if (util::io::sync_directory(_options._directory.c_str()) != 0) {
+    PLOGE << "could not sync " << _options._directory
+          << " because: " << strerror(errno);
+    abort();
+  }
+  _manifest->record(*current, *files);
+  if (_manifest->editsNum() > std::max(k_manifest_edits, files->size()))
+    rollManifest(*files);
+  _files.store(std::move(files), std::memory_order_release);
+  if (published)
+    published();
+}
+
+pair<shared_ptr<const MemTables>, shared_ptr<const DataFiles>>
+Bucket::readSnapshot() const {
+  while (true) {
+    // memtables are loaded before files, so an entry being flushed is in one
+    // of the snapshots
+    auto memtables = _memtables.load(std::memory_order_acquire);
+    auto files = _files.load(std::memory_order_acquire);
+    // a flushed memtable is dropped before its file may be compacted away,
+    // with memtables unchanged files hold the file once it's published
+    if (_memtables.load(std::memory_order_acquire) != memtables)
+      continue;
+    const uint64_t flushed = memtables->front()->flushedFile();
+    if (flushed != MemTable::k_not_flushed &&
+        std::any_of(files->begin(), files->end(), [flushed](const auto &f) {
+          return f->id() == flushed;
+        }))
+      memtables =
+          std::make_shared<MemTables>(memtables->begin() + 1, memtables->end());
+    return {std::move(memtables), std::move(files)};
+  }
+}
+
+char *ReadContext::batchBuffer(size_t size) {
+  if (size > _batch_mem_size) {
+    _batch_mem_size = util::io::calculate_aligned_size(size);
+    _batch_mem.reset(util::io::allocate_aligned_buffer(_batch_mem_size));
+  }
+  return _batch_mem.get();
+}
+
+char *ReadContext::blockBuffer(size_t size) {
+  if (size > _block_mem_size) {
+    _block_mem_size = util::io::calculate_aligned_size(size);
+    _block_mem.reset(util::io::allocate_aligned_buffer(_block_mem_size));
+  }
+  return _block_mem.get();
+}
+
+char *AsyncReadContext::recordBuffer(size_t size) {
+  if (size > _record_mem_size) {
+    _record_mem_size = util::io::calculate_aligned_size(size);
+    _record_mem.reset(util::io::allocate_aligned_buffer(_record_mem_size));
+  }
+  return _record_mem.get();
+}
+
+char *AsyncReadContext::blockBuffer(size_t size) {
+  if (size > _block_mem_size) {
+    _block_mem_size = util::io::calculate_aligned_size(size);
+    _block_mem.reset(util::io::allocate_aligned_buffer(_block_mem_size));
+  }
+  return _block_mem.get();
+}
+
+namespace {
+
+constexpr size_t k_record_window = ReadContext::k_record_window;
+
+// lookup of one key within one data file
+struct BatchLookup {
+  size_t _key_id;
+  PageSearch _search = {};
+  size_t _page_slot = 0; // slot of _search._page_id in current round
+};
+
+// record of a data file that may hold a key
+struct BatchCandidate {
+  size_t _key_id;
+  IndexEntry _entry;
+  // request reading value of a record too large for the record window
+  size_t _value_request = 0;
+};
+
+} // namespace
+
+vector<KVs> Bucket::multiGet(span<const string> keys, ReadContext &context) {
+  ReadMetrics &metrics = context._metrics;
+  // lookups of a batch share reads, so they get no per lookup sizes
+  auto _ = metrics.time(ReadHistogram::k_multi_get);
+  metrics.add(ReadCounter::k_lookups, keys.size());
+  KeyCache *cache = _options._key_cache.get();
+  if (!cache)
+    return multiGetUncached(keys, context);
+  vector<KVs> results(keys.size());
+  // keys missing in the cache are looked up as one smaller batch
+  vector<size_t> missed;
+  vector<uint64_t> tickets;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const size_t hash = hashKey(keys[i]);
+    auto copy_values = [&](span<const string> values) {
+      for (const auto &v : values) {
+        KV kv;
+        kv._k = keys[i];
+        kv._v = v;
+        kv._hash = hash;
+        results[i].emplace_back(std::move(kv));
+      }
+    };
+    if (!findCached(*cache, hash, keys[i], true, metrics, copy_values)) {
+      missed.push_back(i);
+      tickets.push_back(cache->ticket(hash));
+    }
+  }
+  if (missed.empty())
+    return results;
+  vector<string> missed_keys;
+  if (missed.size() < keys.size()) {
+    missed_keys.reserve(missed.size());
+    for (size_t i : missed)
+      missed_keys.push_back(keys[i]);
+  }
+  vector<KVs> found = multiGetUncached(
+      missed_keys.empty() ? keys : span<const string>(missed_keys), context);
+  for (size_t j = 0; j < missed.size(); ++j) {
+    KVs &kvs = found[j];
+    if (!kvs.empty()) {
+      vector<string> values;
+      values.reserve(kvs.size());
+      for (const auto &kv : kvs)
+        values.push_back(kv._v);
+      cache->fill(kvs[0]._hash, kvs[0]._k, std::move(values), true,
+                  tickets[j]);
     }
-  } else if (curr_hash < hash) { // let's search for hash on right side
-    while (block._page_id + 1 < block._pages_num &&
-           block._page->_entries[block._size - 1]._hash < hash) {
-      size_t following_hashes_num =
-          std::min(block._pages_num - block._page_id, IndexPage::k_hashes_num);
-      size_t p = 0;
-      for (; p < following_hashes_num && block._page->_post_hashes[p] < hash;
-           ++p)
-        ;
-
-      if (p == block._page_id)
-        return; // there is no page meeting the criteria
-      ++p;
-      block.setPageId(block._page_id + p);
-      block._curr_entry_in_block = 0;
+    results[missed[j]] = std::move(kvs);
+  }
+  return results;
+}
+
+vector<KVs> Bucket::multiGetUncached(span<const string> keys,
+                                     ReadContext &context) {
+  vector<KVs> results(keys.size());
+  ReadMetrics &metrics = context._metrics;
+  if (!context._async_in)
+    context._async_in = util::io::makeAsyncFileInput();
+  auto submit = [&](vector<util::io::ReadRequest> &requests) {
+    if (context._async_in->submit(requests.data(), requests.size()) == -1)
+      abort();
+    metrics.add(ReadCounter::k_async_reads, requests.size());
+    for (const auto &request : requests)
+      metrics.add(ReadCounter::k_bytes_read,
+                  std::max<ssize_t>(0, request._result));
+  };
+  vector<size_t> hashes(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i)
+    hashes[i] = hashKey(keys[i]);
+
+  vector<BatchLookup> pending, next;
+  vector<BatchCandidate> candidates;
+  vector<util::io::ReadRequest> requests;
+  vector<const char *> pages;
+  vector<util::io::PageCache::Handle> pinned;
+  vector<char> matched(keys.size());
+  // values of records too large for the record window
+  vector<string> large_values;
+  // blocks of candidates in compressed files and their records
+  vector<size_t> block_ids;
+  vector<string> block_records;
+  vector<const char *> restored;
+  util::io::PageCache *cache = _options._page_cache.get();
+  const auto [memtables, files] = readSnapshot();
+  for (const auto &file_ptr : *files) {
+    const DataFileMetadata &file_meta = *file_ptr;
+    const int fd = file_meta.fd();
+    const size_t size = file_meta.entriesCount();
+    if (size == 0)
+      continue;
+    if (file_meta.mapping().mapped()) {
+      // lookups in a mapped file are plain memory accesses, there is nothing
+      // to batch
+      for (size_t i = 0; i < keys.size(); ++i) {
+        KVsSink sink{._result = results[i], ._k = keys[i], ._hash = hashes[i]};
+        readFile(file_meta, keys[i], hashes[i], context, sink);
+      }
+      continue;
+    }
+    const size_t pages_num = IndexPage::pagesNum(size);
+    const size_t index_offset = file_meta.indexOffset();
+
+    pending.clear();
+    candidates.clear();
+    for (size_t i = 0; i < keys.size(); ++i) {
+      BatchLookup lookup{._key_id = i};
+      if (PageSearch::create(file_meta, hashes[i], lookup._search))
+        pending.push_back(lookup);
     }
-    do {
-      if (block.current()._hash == hash) {
-        context._result.emplace_back(block.current()._offset);
+    const size_t searched = pending.size();
+    metrics.add(ReadCounter::k_filter_negatives, keys.size() - searched);
+    metrics.add(ReadCounter::k_files_searched, searched);
+    while (!pending.empty()) {
+      std::sort(pending.begin(), pending.end(),
+                [](const BatchLookup &l, const BatchLookup &r) {
+                  return l._search._page_id < r._search._page_id;
+                });
+      // every distinct page needed in this round is taken from cache or
+      // loaded once
+      pages.clear();
+      pinned.clear();
+      requests.clear();
+      size_t last_page_id = pages_num;
+      for (auto &lookup : pending) {
+        if (lookup._search._page_id != last_page_id) {
+          last_page_id = lookup._search._page_id;
+          const off_t page_offset =
+              index_offset + last_page_id * sizeof(IndexPage);
+          util::io::PageCache::Handle page;
+          metrics.add(ReadCounter::k_index_pages);
+          if (cache)
+            page = cache->find(file_meta.id(), page_offset);
+          if (cache)
+            metrics.add(page ? ReadCounter::k_page_cache_hits
+                             : ReadCounter::k_page_cache_misses);
+          if (page) {
+            pages.push_back(page.data());
+            pinned.push_back(std::move(page));
+          } else {
+            pages.push_back(nullptr);
+            requests.push_back({._fd = fd,
+                                ._buffer = nullptr,
+                                ._size = sizeof(IndexPage),
+                                ._offset = page_offset});
+          }
+        }
+        lookup._page_slot = pages.size() - 1;
+      }
+      char *mem = context.batchBuffer(requests.size() * sizeof(IndexPage));
+      for (size_t r = 0; r < requests.size(); ++r)
+        requests[r]._buffer = mem + r * sizeof(IndexPage);
+      submit(requests);
+      for (size_t p = 0, r = 0; p < pages.size(); ++p) {
+        if (pages[p] != nullptr)
+          continue;
+        const auto &request = requests[r++];
+        if (request._result != sizeof(IndexPage)) {
+          PLOGE << "could not load index page of " << file_meta.path()
+                << " because: "
+                << (request._result < 0 ? strerror(-request._result)
+                                        : "end of file");
+          continue;
+        }
+        pages[p] = request._buffer;
+        if (cache)
+          cache->get(file_meta.id(), request._offset, [&](char *frame) {
+            memcpy(frame, request._buffer, sizeof(IndexPage));
+            return true;
+          });
+      }
+
+      next.clear();
+      for (auto &lookup : pending) {
+        if (pages[lookup._page_slot] == nullptr)
+          continue;
+        const auto &page =
+            *reinterpret_cast<const IndexPage *>(pages[lookup._page_slot]);
+        const size_t page_id = lookup._search._page_id;
+        const size_t page_size = IndexPage::entriesInPage(page_id, size);
+        size_t begin, end;
+        if (!lookup._search.step(page, page_size, begin, end)) {
+          next.push_back(lookup);
+          continue;
+        }
+        const size_t hash = hashes[lookup._key_id];
+        if (begin < end &&
+            ((begin == 0 && page_id > 0 && page._first_hash == hash) ||
+             (end == page_size && page_id + 1 < pages_num &&
+              page._last_hash == hash))) {
+          // run of equal hashes may continue on neighbouring pages, this is
+          // rare enough to be resolved synchronously
+          const size_t syscalls = context._in.syscallsNum();
+          const size_t bytes_read = context._in.bytesRead();
+          context._in.passFd(fd, file_meta.directIo());
+          PageSearch search;
+          PageSearch::create(file_meta, hashes[lookup._key_id], search);
+          context._index_iterator.setFile(file_meta, cache);
+          getHashOffsets(context, size, search, index_offset);
+          context._index_iterator.release();
+          metrics.add(ReadCounter::k_syscalls,
+                      context._in.syscallsNum() - syscalls);
+          metrics.add(ReadCounter::k_bytes_read,
+                      context._in.bytesRead() - bytes_read);
+          for (const auto &entry : context._result) {
+            if (entry.mayHold(keys[lookup._key_id]))
+              candidates.push_back({lookup._key_id, entry});
+          }
+          continue;
+        }
+        for (size_t e = begin; e < end; ++e) {
+          const IndexEntry entry = page.entry(e);
+          if (entry.mayHold(keys[lookup._key_id]))
+            candidates.push_back({lookup._key_id, entry});
+        }
       }
-      if (block.current()._hash > hash) {
+      pending.swap(next);
+    }
+    if (candidates.empty()) {
+      metrics.add(ReadCounter::k_false_positives, searched);
+      continue;
+    }
+    metrics.add(ReadCounter::k_records_read, candidates.size());
+
+    // keeps record of candidate whose key starts at body if it holds the key,
+    // a value too large for the record window is in large_value instead
+    std::fill(matched.begin(), matched.end(), 0);
+    auto take_record = [&](const BatchCandidate &candidate, const char *body,
+                           string *large_value) {
+      const IndexEntry &entry = candidate._entry;
+      const size_t key_id = candidate._key_id;
+      const string &k = keys[key_id];
+      if (memcmp(body, k.data(), k.size()) != 0)
+        return;
+      matched[key_id] = 1;
+      if (entry.separated()) {
+        // pointer matched the key, the value is read from its log
+        const string_view encoded =
+            large_value ? string_view(*large_value)
+                        : string_view(body + k.size(), entry._value_size);
+        PointerSink pointer;
+        KVsSink sink{._result = results[key_id], ._k = k,
+                     ._hash = hashes[key_id]};
+        if (PointerSink::fits(entry))
+          memcpy(pointer.value(encoded.size()), encoded.data(),
+                 encoded.size());
+        if (PointerSink::fits(entry) &&
+            pointer.readValue(file_meta, sink, metrics))
+          sink.commit();
+        else
+          PLOGE << "could not read separated value from " << file_meta.path();
         return;
       }
-    } while (block.inc());
-  } else { // curr_hash > hash -> let's search for hash on left side
-    while (block._page_id > 0 && block._page->_entries[0]._hash > hash) {
-      size_t preceding_hashes_num =
-          std::min(block._page_id, IndexPage::k_hashes_num);
-      size_t p = 0;
-      for (; p < preceding_hashes_num && block._page->_pre_hashes[p] > hash;
-           ++p)
-        ;
-
-      if (p == block._page_id)
-        return; // there is no page meeting the criteria
-      ++p;
-      block.setPageId(block._page_id - p);
+      KV &result = results[key_id].emplace_back();
+      result._k = k;
+      result._hash = hashes[key_id];
+      if (large_value)
+        result._v = std::move(*large_value);
+      else
+        result._v.assign(body + k.size(), entry._value_size);
+    };
+
+    const DataBlocks &blocks = file_meta.blocks();
+    if (!blocks.empty()) {
+      // every distinct block of candidates is read and decompressed once,
+      // with its covering sectors under O_DIRECT
+      block_ids.clear();
+      for (const auto &candidate : candidates) {
+        if (blocks.holds(candidate._entry))
+          block_ids.push_back(blocks.block(candidate._entry.offset()));
+      }
+      std::sort(block_ids.begin(), block_ids.end());
+      block_ids.erase(std::unique(block_ids.begin(), block_ids.end()),
+                      block_ids.end());
+      constexpr size_t k_sector = util::io::k_sector_size;
+      const bool direct = file_meta.directIo();
+      requests.clear();
+      size_t mem_size = 0;
+      for (const size_t b : block_ids) {
+        const BlockHandle &handle = blocks.handle(b);
+        const size_t begin =
+            direct ? handle._offset / k_sector * k_sector : handle._offset;
+        const size_t end = handle._offset + handle._size;
+        const size_t size = direct
+                                ? util::io::calculate_aligned_size(end - begin)
+                                : end - begin;
+        requests.push_back({._fd = fd,
+                            ._buffer = nullptr,
+                            ._size = size,
+                            ._offset = off_t(begin)});
+        mem_size += size;
+      }
+      char *mem = context.batchBuffer(mem_size);
+      for (auto &request : requests) {
+        request._buffer = mem;
+        mem += request._size;
+      }
+      submit(requests);
+      block_records.resize(block_ids.size());
+      restored.assign(block_ids.size(), nullptr);
+      for (size_t r = 0; r < block_ids.size(); ++r) {
+        const BlockHandle &handle = blocks.handle(block_ids[r]);
+        const auto &request = requests[r];
+        if (request._result <
+            ssize_t(handle._offset + handle._size - request._offset)) {
+          PLOGE << "could not read block from " << file_meta.path();
+          continue;
+        }
+        if (handle.compressed())
+          metrics.add(ReadCounter::k_blocks_decompressed);
+        block_records[r].resize(handle._raw_size);
+        restored[r] = blocks.restore(
+            block_ids[r], request._buffer + (handle._offset - request._offset),
+            block_records[r].data());
+        if (restored[r] == nullptr)
+          PLOGE << "block of " << file_meta.path() << " is corrupted";
+      }
+      for (const auto &candidate : candidates) {
+        const IndexEntry &entry = candidate._entry;
+        if (matched[candidate._key_id] || !blocks.holds(entry))
+          continue;
+        const size_t r =
+            std::lower_bound(block_ids.begin(), block_ids.end(),
+                             blocks.block(entry.offset())) -
+            block_ids.begin();
+        if (restored[r] != nullptr)
+          take_record(candidate, restored[r] + blocks.keySlot(entry),
+                      nullptr);
+      }
+      metrics.add(ReadCounter::k_false_positives,
+                  searched - std::count(matched.begin(), matched.end(), 1));
+      continue;
+    }
+
+    // Sizes come from the index, so every record is read with exact size at
+    // once: small records whole into batch memory, keys of large ones into
+    // batch memory and their values straight into a string. Under O_DIRECT
+    // every record is read whole with its covering sectors instead.
+    const bool direct = file_meta.directIo();
+    auto whole = [&](const IndexEntry &entry) {
+      return direct || entry.bodySize() <= k_record_window;
+    };
+    auto request_range = [&](const IndexEntry &entry, off_t &offset,
+                             size_t &size) {
+      offset = entry.keyOffset();
+      size = whole(entry) ? entry.bodySize() : entry._key_size;
+      if (direct) {
+        offset = offset / util::io::k_sector_size * util::io::k_sector_size;
+        size = util::io::calculate_aligned_size(entry.keyOffset() +
+                                                entry.bodySize() - offset);
+      }
+    };
+    size_t mem_size = 0;
+    for (const auto &candidate : candidates) {
+      off_t offset;
+      size_t size;
+      request_range(candidate._entry, offset, size);
+      mem_size += size;
     }
-    const auto &entries = block._page->_entries;
-    unsigned int bot, mid, top;
-    bot = 0;
-    top = block._size;
-    //    PLOGD << 1;
-    while (top > 1) {
-      mid = top / 2;
-      if (hash >= entries[bot + mid]._hash)
-        bot += mid;
-      top -= mid;
+    char *mem = context.batchBuffer(mem_size);
+    requests.clear();
+    for (const auto &candidate : candidates) {
+      off_t offset;
+      size_t size;
+      request_range(candidate._entry, offset, size);
+      requests.push_back(
+          {._fd = fd, ._buffer = mem, ._size = size, ._offset = offset});
+      mem += size;
     }
-    if (hash != entries[bot]._hash)
-      return;
-    while (bot + 1 < block._size && entries[bot + 1]._hash == hash)
-      ++bot;
-    while (entries[bot]._hash == hash) {
-      context._result.emplace_back(entries[bot]._offset);
-      if (bot > 0) {
-        --bot;
+    large_values.clear();
+    large_values.reserve(candidates.size());
+    for (auto &candidate : candidates) {
+      const IndexEntry &entry = candidate._entry;
+      if (whole(entry))
+        continue;
+      candidate._value_request = requests.size();
+      requests.push_back({._fd = fd,
+                          ._buffer = large_values.emplace_back(
+                                         entry._value_size, '\0').data(),
+                          ._size = entry._value_size,
+                          ._offset = off_t(entry.valueOffset())});
+    }
+    submit(requests);
+
+    for (size_t c = 0, large = 0; c < candidates.size(); ++c) {
+      const BatchCandidate &candidate = candidates[c];
+      const IndexEntry &entry = candidate._entry;
+      const bool is_whole = whole(entry);
+      string *large_value = is_whole ? nullptr : &large_values[large++];
+      if (matched[candidate._key_id])
+        continue;
+      const auto &request = requests[c];
+      if (request._result != ssize_t(request._size) ||
+          (!is_whole && requests[candidate._value_request]._result !=
+                         ssize_t(entry._value_size))) {
+        PLOGE << "could not read record from " << file_meta.path();
         continue;
       }
-      if (block._page_id == 0)
-        return;
-      --block._page_id;
-      block._size = IndexPage::k_entries_num;
-      bot = IndexPage::k_entries_num - 1;
-      block.load();
+      take_record(candidate,
+                  request._buffer + (entry.keyOffset() - request._offset),
+                  large_value);
     }
+    metrics.add(ReadCounter::k_false_positives,
+                searched - std::count(matched.begin(), matched.end(), 1));
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    KVsSink sink{._result = results[i], ._k = keys[i], ._hash = hashes[i]};
+    readMemTables(*memtables, hashes[i], keys[i], sink, metrics);
   }
+  return results;
 }
 
-KVs Bucket::read(const string &k, ReadContext &context) {
-  size_t hash = hasher(k);
-  vector<KV> result;
-  KV kv;
-  for (auto &file_meta : _files) {
-    context._in.passFd(file_meta.fd(), false);
-    size_t size = file_meta.entriesCount();
-    size_t file_size = file_meta.byteSize();
-    size_t index_size = (size + IndexPage::k_entries_num - 1) /
-                        IndexPage::k_entries_num * sizeof(IndexPage);
-    getHashOffsets(context, size, hash, file_size - index_size);
-    for (const auto offset : context._result) {
-      context._in.seek(offset);
-      context._in.readString(kv._k);
-      if (kv._k == k) {
-        context._in.readString(kv._v);
-        result.emplace_back(std::move(kv));
-        break;
-      }
+util::parallel::Task<bool> Bucket::getAsync(string_view k,
+                                            AsyncReadContext &context,
+                                            string &value) {
+  ReadMetrics &metrics = *context._metrics;
+  LookupScope lookup(metrics, ReadHistogram::k_get);
+  const size_t hash = hashKey(k);
+  KeyCache *cache = _options._key_cache.get();
+  auto copy_cached = [&](span<const string> values) { value = values.back(); };
+  if (cache && findCached(*cache, hash, k, false, metrics, copy_cached))
+    co_return true;
+  const uint64_t ticket = cache ? cache->ticket(hash) : 0;
+  // newest first like findNewest(), which can't await lookups in files
+  const auto [memtables, files] = readSnapshot();
+  bool found = false;
+  for (auto it = memtables->rbegin(); !found && it != memtables->rend();
+       ++it) {
+    auto _ = metrics.time(ReadHistogram::k_memtables);
+    found = (*it)->visit(hash, k, [&](const string &v) { value = v; });
+    if (found)
+      metrics.add(ReadCounter::k_memtable_hits);
+  }
+  for (auto it = files->rbegin(); !found && it != files->rend(); ++it)
+    found = co_await readFileAsync(**it, k, hash, context, value);
+  if (found && cache)
+    cache->fill(hash, k, {value}, false, ticket);
+  co_return found;
+}
+
+util::parallel::Task<bool>
+Bucket::readFileAsync(const DataFileMetadata &file_meta, string_view k,
+                      size_t hash, AsyncReadContext &context,
+                      string &value) {
+  ReadMetrics &metrics = *context._metrics;
+  PageSearch search;
+  if (!PageSearch::create(file_meta, hash, search)) {
+    metrics.add(ReadCounter::k_filter_negatives);
+    co_return false;
+  }
+  auto _ = metrics.time(ReadHistogram::k_file);
+  metrics.add(ReadCounter::k_files_searched);
+  {
+    auto search_timer = metrics.time(ReadHistogram::k_index_search);
+    co_await getHashOffsetsAsync(file_meta, search, context);
+  }
+  context._cached_page.release();
+  for (const auto &entry : context._result) {
+    if (!entry.mayHold(k))
+      continue;
+    metrics.add(ReadCounter::k_records_read);
+    auto record_timer = metrics.time(ReadHistogram::k_record);
+    if (co_await readRecordAsync(file_meta, entry, k, context, value))
+      co_return true;
+  }
+  metrics.add(ReadCounter::k_false_positives);
+  co_return false;
+}
+
+util::parallel::Task<void>
+Bucket::getHashOffsetsAsync(const DataFileMetadata &file_meta,
+                            PageSearch search, AsyncReadContext &context) {
+  context._result.clear();
+  const size_t hash = search._hash;
+  const size_t size = file_meta.entriesCount();
+  const IndexPage *page =
+      co_await loadPageAsync(file_meta, search._page_id, context);
+  if (page == nullptr)
+    co_return;
+  size_t begin, end;
+  while (!search.step(*page, IndexPage::entriesInPage(search._page_id, size),
+                      begin, end)) {
+    page = co_await loadPageAsync(file_meta, search._page_id, context);
+    if (page == nullptr)
+      co_return;
+  }
+  for (size_t i = begin; i < end; ++i)
+    context._result.push_back(page->entry(i));
+  if (begin == end)
+    co_return;
+
+  // run of equal hashes may continue on neighbouring pages if it reaches a
+  // boundary of this page
+  const size_t page_id = search._page_id;
+  const size_t page_size = IndexPage::entriesInPage(page_id, size);
+  const bool at_first = page->_first_hash == hash;
+  const bool at_last = page->_last_hash == hash;
+  for (size_t p = page_id; begin == 0 && at_first && p-- > 0;) {
+    if ((page = co_await loadPageAsync(file_meta, p, context)) == nullptr)
+      co_return;
+    for (size_t e = IndexPage::k_entries_num; begin == 0 && e-- > 0;) {
+      if (page->mayHaveHash(e, hash))
+        context._result.push_back(page->entry(e));
+      else
+        begin = e + 1;
+    }
+  }
+  const size_t pages_num = IndexPage::pagesNum(size);
+  for (size_t p = page_id + 1; end == page_size && at_last && p < pages_num;
+       ++p) {
+    if ((page = co_await loadPageAsync(file_meta, p, context)) == nullptr)
+      co_return;
+    const size_t entries = IndexPage::entriesInPage(p, size);
+    for (size_t e = 0; end == page_size && e < entries; ++e) {
+      if (page->mayHaveHash(e, hash))
+        context._result.push_back(page->entry(e));
+      else
+        end = e;
     }
-    context._in.close();
   }
-  return result;
 }
 
-void Bucket::write(std::string path, KVs &&kvs) {
-  std::sort(kvs.begin(), kvs.end(),
-            [](const KV &l, const KV &r) { return l._hash < r._hash; });
-  util::io::BufferedFileOutput out(1 << 12);
-  if (out.open(path, false) == -1) {
-    PLOGE << "could not open a file " << path
-          << " because: " << strerror(errno);
-    abort();
+util::parallel::Task<const IndexPage *>
+Bucket::loadPageAsync(const DataFileMetadata &file_meta, size_t page_id,
+                      AsyncReadContext &context) {
+  ReadMetrics &metrics = *context._metrics;
+  const size_t offset = file_meta.indexOffset() + page_id * sizeof(IndexPage);
+  metrics.add(ReadCounter::k_index_pages);
+  context._cached_page.release();
+  // mapped files are read through the ring too, a page fault would stall
+  // every lookup of the thread
+  util::io::PageCache *cache = _options._page_cache.get();
+  if (cache) {
+    context._cached_page = cache->find(file_meta.id(), offset);
+    metrics.add(context._cached_page ? ReadCounter::k_page_cache_hits
+                                     : ReadCounter::k_page_cache_misses);
+    if (context._cached_page)
+      co_return reinterpret_cast<const IndexPage *>(
+          context._cached_page.data());
   }
-  // write elements
-  size_t size = kvs.size();
-  vector<size_t> offsets;
-  offsets.reserve(size);
-  size_t offset = 0;
-  for (const auto &kv : kvs) {
-    out.writeString(kv._k);
-    out.writeString(kv._v);
-    offsets.push_back(offset);
-    offset += sizeof(size_t) * 2 + kv._k.size() + kv._v.size();
-  }
-  // add padding so index will be sector size aligned
-  if (offset % util::io::k_sector_size > 0) {
-    char padding[util::io::k_sector_size];
-    memset(padding, 0, util::io::k_sector_size);
-    out.write(padding,
-              util::io::k_sector_size - (offset % util::io::k_sector_size));
-  }
-
-  // write hashes and offsets for given hash
-  IndexPage page;
-  size_t page_entry = 0;
-  const size_t entries_num = kvs.size();
-  for (size_t i = 0; i < entries_num; ++i) {
-    page._entries[page_entry] = {._hash = kvs[i]._hash, ._offset = offsets[i]};
-    ++page_entry;
-    if (page_entry == IndexPage::k_entries_num || i + 1 == entries_num) {
-      {
-        // Fill last hash for following pages
-        size_t pages_ahead = (entries_num + IndexPage::k_entries_num - 1) /
-                             IndexPage::k_entries_num;
-        size_t hashes_ahead = std::min(IndexPage::k_hashes_num, pages_ahead);
-        size_t pos = i + IndexPage::k_entries_num;
-        for (size_t k = 0; k < hashes_ahead; ++k) {
-          page._post_hashes[k] = kvs[pos]._hash;
-          pos += IndexPage::k_entries_num;
-        }
-      }
-      {
-        // Fill first hash for preceding pages
-        size_t pages_preceding =
-            (i + 1 - IndexPage::k_entries_num) / IndexPage::k_entries_num;
-        size_t hashes_preceding =
-            std::min(IndexPage::k_hashes_num, pages_preceding);
-        size_t pos = i - IndexPage::k_entries_num * 2 + 1;
-        for (size_t k = 0; k < hashes_preceding; ++k) {
-          page._pre_hashes[k] = kvs[pos]._hash;
-          pos -= IndexPage::k_entries_num;
-        }
-      }
-//      pages.push_back(page);
-      out.write((const char *)&page, sizeof(IndexPage));
-      page_entry = 0;
+  char *page = context._page_mem.get();
+  const ssize_t bytes_read = co_await context._ring->read(
+      file_meta.fd(), page, sizeof(IndexPage), offset);
+  metrics.add(ReadCounter::k_async_reads);
+  metrics.add(ReadCounter::k_bytes_read, std::max<ssize_t>(0, bytes_read));
+  if (bytes_read != sizeof(IndexPage)) {
+    PLOGE << "could not load index page of " << file_meta.path()
+          << " because: "
+          << (bytes_read < 0 ? strerror(-bytes_read) : "end of file");
+    co_return nullptr;
+  }
+  if (cache)
+    cache->get(file_meta.id(), offset, [&](char *frame) {
+      memcpy(frame, page, sizeof(IndexPage));
+      return true;
+    });
+  co_return reinterpret_cast<const IndexPage *>(page);
+}
+
+util::parallel::Task<bool>
+Bucket::readRecordAsync(const DataFileMetadata &file_meta,
+                        const IndexEntry &entry, string_view k,
+                        AsyncReadContext &context, string &value) {
+  ReadMetrics &metrics = *context._metrics;
+  // a record of a compressed file is read with its whole block
+  const DataBlocks &blocks = file_meta.blocks();
+  if (!blocks.empty() && !blocks.holds(entry))
+    co_return false;
+  const size_t block = blocks.empty() ? 0 : blocks.block(entry.offset());
+  const size_t begin =
+      blocks.empty() ? entry.keyOffset() : blocks.handle(block)._offset;
+  const size_t stored_size =
+      blocks.empty() ? entry.bodySize() : blocks.handle(block)._size;
+  // sizes come from the index, so the record is read whole at once, with its
+  // covering sectors under O_DIRECT; mapped files too, like index pages
+  off_t offset = begin;
+  size_t size = stored_size;
+  if (file_meta.directIo()) {
+    offset = offset / util::io::k_sector_size * util::io::k_sector_size;
+    size = util::io::calculate_aligned_size(begin + stored_size - offset);
+  }
+  char *buffer = context.recordBuffer(size);
+  const ssize_t bytes_read =
+      co_await context._ring->read(file_meta.fd(), buffer, size, offset);
+  metrics.add(ReadCounter::k_async_reads);
+  metrics.add(ReadCounter::k_bytes_read, std::max<ssize_t>(0, bytes_read));
+  if (bytes_read != ssize_t(size)) {
+    PLOGE << "could not read record from " << file_meta.path();
+    co_return false;
+  }
+  const char *body = buffer + (begin - offset);
+  if (!blocks.empty()) {
+    const BlockHandle &handle = blocks.handle(block);
+    if (handle.compressed())
+      metrics.add(ReadCounter::k_blocks_decompressed);
+    const char *records = blocks.restore(
+        block, body, context.blockBuffer(handle._raw_size));
+    if (records == nullptr) {
+      PLOGE << "block of " << file_meta.path() << " is corrupted";
+      co_return false;
     }
+    body = records + blocks.keySlot(entry);
   }
-  if (out.close() == -1) {
-    PLOGE << "could not close a file " << path
-          << " because: " << strerror(errno);
-    abort();
+  if (memcmp(body, k.data(), k.size()) != 0)
+    co_return false;
+  const string_view v(body + k.size(), entry._value_size);
+  if (!entry.separated()) {
+    value.assign(v);
+    co_return true;
+  }
+  // pointer matched the key, the value is awaited from its log like records
+  ValuePointer pointer;
+  const bool decoded = PointerSink::fits(entry) && pointer.decode(v);
+  const shared_ptr<const ValueLog> *log =
+      decoded ? &file_meta.valueLog(pointer._log) : nullptr;
+  if (log == nullptr || !*log || !(*log)->holds(pointer)) {
+    PLOGE << "could not read separated value from " << file_meta.path();
+    co_return false;
+  }
+  auto _ = metrics.time(ReadHistogram::k_value_log);
+  metrics.add(ReadCounter::k_value_log_reads);
+  value.resize(pointer._size);
+  for (size_t done = 0; done < pointer._size;) {
+    const ssize_t value_read = co_await context._ring->read(
+        (*log)->fd(), value.data() + done, pointer._size - done,
+        pointer._offset + done);
+    metrics.add(ReadCounter::k_async_reads);
+    if (value_read <= 0) {
+      PLOGE << "could not read separated value from " << (*log)->path();
+      co_return false;
+    }
+    metrics.add(ReadCounter::k_bytes_read, value_read);
+    done += value_read;
+  }
+  co_return true;
+}
+
+Iterator Bucket::scan(const KeyRange &range, size_t buffer_size) {
+  vector<unique_ptr<Iterator::Source>> sources;
+  addScanSources(range, buffer_size, sources);
+  return Iterator(std::move(sources));
+}
+
+void Bucket::addScanSources(
+    const KeyRange &range, size_t buffer_size,
+    vector<unique_ptr<Iterator::Source>> &sources) const {
+  const auto [memtables, files] = readSnapshot();
+  for (const auto &file_meta : *files) {
+    if (file_meta->entriesCount() == 0)
+      continue;
+    if (file_meta->keyIndex().empty())
+      sources.push_back(SortedSource::scan(*file_meta, range, buffer_size));
+    else
+      sources.push_back(
+          std::make_unique<KeyIndexSource>(file_meta, range, buffer_size));
+  }
+  // runs of one memtable hold distinct keys, their order doesn't matter
+  for (const auto &memtable : *memtables) {
+    for (auto &run : memtable->keyOrder())
+      sources.push_back(
+          std::make_unique<MemTableSource>(memtable, std::move(run), range));
+  }
+}
+
+template <typename Entries>
+shared_ptr<DataFileMetadata>
+Bucket::writeFile(std::string path, const Entries &kvs,
+                  size_t filter_bits_per_key,
+                  const DataFileOpenOptions &open_options, bool sync,
+                  const ValueSeparation &separation) {
+  WriteMetrics &metrics = _write_metrics.local();
+  auto _ = metrics.time(WriteHistogram::k_file_write);
+  // sorting 16 byte pairs instead of entries avoids moving them around, records
+  // are then written in the permuted order
+  struct SortEntry {
+    size_t _hash;
+    size_t _index;
+  };
+  vector<SortEntry> order(kvs.size());
+  util::parallel::parallelFor(
+      kvs.size(), _options._write_threads,
+      [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+          order[i] = {._hash = kvs[i]._hash, ._index = i};
+      },
+      1 << 16);
+  const size_t shared_bits = _options._shared_hash_bits;
+  util::parallel::parallelRadixSort(
+      order,
+      [shared_bits](const SortEntry &e) { return e._hash << shared_bits; },
+      _options._write_threads);
+  // radix sort holds two copies of order
+  const size_t sort_memory = 2 * order.size() * sizeof(SortEntry);
+
+  DataFileWriter out(path, _options._file_write, filter_bits_per_key,
+                     open_options, _options._write_threads, separation);
+  out.reserve(kvs.size());
+  for (const auto &entry : order) {
+    const auto &kv = kvs[entry._index];
+    out.add(kv._hash, kv._k, kv._v);
+  }
+  auto file_meta = out.finish(sync);
+  metrics.add(WriteCounter::k_files_written);
+  metrics.add(WriteCounter::k_bytes_written, file_meta->byteSize());
+  PLOGD << "wrote " << order.size() << " entries to " << path
+        << ", peak memory on top of entries: "
+        << util::perf::printBytes(std::max(
+               sort_memory,
+               order.size() * sizeof(SortEntry) + out.peakMemory()));
+  return file_meta;
+}
+
+template <typename Entries>
+void Bucket::write(std::string path, const Entries &kvs) {
+  // the manifest must never list a file that is not durable
+  shared_ptr<const DataFileMetadata> file_meta =
+      writeFile(std::move(path), kvs, _options._filter_bits_per_key,
+                openOptions(), true, valueSeparation());
+  publish([&](DataFiles &files) { files.push_back(std::move(file_meta)); });
+}
+
+Bucket::BulkLoad::BulkLoad(Bucket &bucket, size_t run_byte_size)
+    : _bucket(bucket), _run_byte_size(run_byte_size) {}
+
+Bucket::BulkLoad::~BulkLoad() {
+  for (const auto &run : _runs) {
+    if (unlink(run->path().c_str()) != 0)
+      PLOGE << "could not remove " << run->path()
+            << " because: " << strerror(errno);
+  }
+}
+
+bool Bucket::BulkLoad::add(string_view k, string_view v) {
+  if (!fits(k, v))
+    return false;
+  _run.add(k, v);
+  if (_run.byteSize() >= _run_byte_size)
+    spill();
+  return true;
+}
+
+DataFileOpenOptions Bucket::BulkLoad::runOptions() const {
+  // runs are only scanned by merges, so they need no filter or fences, and
+  // keep values inline until the final merge separates them
+  return {._fence_index = false, ._direct_io = _bucket._options._direct_io};
+}
+
+void Bucket::BulkLoad::spill() {
+  if (_run.empty())
+    return;
+  _runs.push_back(_bucket.writeFile(_bucket.nextFilePath(".run"), _run, 0,
+                                    runOptions(), false, {}));
+  _run.clear();
+}
+
+void Bucket::BulkLoad::finish() {
+  if (_runs.empty()) {
+    // everything fit in one run
+    if (!_run.empty()) {
+      // loaded entries must be newer than earlier puts, like in insert()
+      _bucket.flush();
+      _bucket.write(_bucket.nextFilePath(), _run);
+      _bucket.invalidateCached(_run);
+    }
+    _run.clear();
+    _bucket.requestCompaction();
+    return;
+  }
+  spill();
+  // runs are merged in passes of at most _max_merge_width runs, so the
+  // number of open scanners and their buffers stay bounded
+  const size_t width =
+      std::max<size_t>(2, _bucket._options._compaction._max_merge_width);
+  while (_runs.size() > width) {
+    vector<shared_ptr<const DataFileMetadata>> merged;
+    for (size_t begin = 0; begin < _runs.size(); begin += width) {
+      const size_t end = std::min(begin + width, _runs.size());
+      merged.push_back(end - begin == 1
+                           ? _runs[begin]
+                           : merge(begin, end, _bucket.nextFilePath(".run"),
+                                   0, runOptions(), {}));
+    }
+    _runs.swap(merged);
+  }
+  shared_ptr<const DataFileMetadata> file_meta =
+      merge(0, _runs.size(), _bucket.nextFilePath(),
+            _bucket._options._filter_bits_per_key, _bucket.openOptions(),
+            _bucket.valueSeparation());
+  _runs.clear();
+  _bucket.flush();
+  _bucket.publish(
+      [&](DataFiles &files) { files.push_back(std::move(file_meta)); });
+  // loads are large, values of all keys are dropped at once
+  if (_bucket._options._key_cache)
+    _bucket._options._key_cache->clear();
+  _bucket.requestCompaction();
+}
+
+shared_ptr<DataFileMetadata>
+Bucket::BulkLoad::merge(size_t begin, size_t end, std::string path,
+                        size_t filter_bits_per_key,
+                        const DataFileOpenOptions &options,
+                        const ValueSeparation &separation) {
+  util::io::RateLimiter unlimited;
+  auto merged = mergeDataFiles(span(_runs).subspan(begin, end - begin),
+                               std::move(path), _bucket._options._compaction,
+                               unlimited, filter_bits_per_key, options,
+                               separation);
+  for (size_t r = begin; r < end; ++r) {
+    if (unlink(_runs[r]->path().c_str()) != 0)
+      PLOGE << "could not remove " << _runs[r]->path()
+            << " because: " << strerror(errno);
   }
-  _files.push_back(std::move(
-      DataFileMetadata{path, size, std::filesystem::file_size(path)}));
+  return merged;
 }
 
 } // namespace humming::Bucket
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "plog/Appenders/ColorConsoleAppender.h"
@@ -12,8 +21,14 @@
 #include "plog/Formatters/TxtFormatter.h"
 #include "plog/Init.h"
 #include "plog/Log.h"
+#include "util/io/async_file_input.h"
 #include "util/io/buffered_file_input.h"
 #include "util/io/buffered_file_output.h"
+#include "util/io/io_ring.h"
+#include "util/io/page_cache.h"
+#include "util/parallel/affinity.h"
+#include "util/parallel/radix_sort.h"
+#include "util/parallel/task.h"
 #include "util/perf/timer.h"
 #include <cstring>
 #include <fcntl.h>
@@ -21,67 +36,390 @@
 #include <unistd.h>
 
 #include "db/KV.h"
+#include "db/compaction.h"
 #include "db/data_file_metadata.h"
+#include "db/data_file_writer.h"
+#include "db/index_page.h"
+#include "db/iterator.h"
+#include "db/key_cache.h"
+#include "db/kv_batch.h"
+#include "db/manifest.h"
+#include "db/memtable.h"
+#include "db/metrics.h"
+#include "db/value_handle.h"
+#include "db/value_log.h"
+#include "db/wal.h"
 
 using namespace std;
 
 namespace humming::DB {
 
 struct ReadContext;
+struct AsyncReadContext;
+struct PageSearch;
 
+struct BucketOptions {
+  // holds data files and write ahead logs of the bucket, logs found there are
+  // replayed on start
+  std::string _directory = "./humming/";
+  // size of per file bloom filter, 0 disables filters
+  size_t _filter_bits_per_key = 10;
+  // keep first/last hash of every index page in memory, so a lookup reads at
+  // most one index page per file
+  bool _fence_index = true;
+  // cache of index pages and records, may be shared between buckets; nullptr
+  // reads everything straight from files. Not used for mapped files.
+  std::shared_ptr<util::io::PageCache> _page_cache;
+  // cache of values of hot keys checked before memtables and files, may be
+  // shared by buckets of disjoint keyspaces; nullptr disables it
+  std::shared_ptr<KeyCache> _key_cache;
+  // read data files through memory mappings instead of preads, best when
+  // files are mostly resident in memory
+  bool _mmap = false;
+  // write and read data files with O_DIRECT, bypassing kernel page cache;
+  // pair it with _page_cache to keep hot pages in memory. Logs are still
+  // written through the kernel cache. Reads of mapped files don't use it.
+  bool _direct_io = false;
+  // data files also get an index of their keys in key order, read by scan()
+  // instead of the whole file
+  bool _key_index = false;
+  // data files written by insert(), flushes and compactions group records in
+  // blocks of about _block_size bytes compressed each on its own; a lookup
+  // then reads and decompresses the whole block of its record
+  util::io::Compression _compression = util::io::Compression::k_none;
+  size_t _block_size = 16 << 10;
+  // merging of data files in background thread, k_none disables the thread
+  CompactionOptions _compaction;
+  // put() collects entries in a memtable of about this size, then it's
+  // flushed into a data file in background
+  size_t _memtable_byte_size = 64 << 20;
+  // put() returns once its entry is durable in the log, concurrent puts share
+  // fdatasync calls; otherwise the log is written when its buffer fills up
+  bool _wal_sync = true;
+  size_t _wal_buffer_size = 1 << 20;
+  // threads sorting entries and building index of a data file written by
+  // insert() or a memtable flush
+  size_t _write_threads = util::parallel::defaultThreadsNum();
+  // buffering of data files written by insert() or a memtable flush
+  DataFileWriteOptions _file_write;
+  // values of at least this many bytes are written to value logs next to
+  // data files and records keep pointers to them, so compaction moves only
+  // pointers; 0 keeps all values in data files. Value logs are read with
+  // preads through the kernel cache, without _page_cache, _mmap or
+  // _direct_io.
+  size_t _min_separated_value_size = 0;
+  // flush and compaction threads run only on this cpu, -1 leaves them to the
+  // scheduler
+  int _background_cpu = -1;
+  // number of top bits shared by hashes of every key of the bucket, like the
+  // shard bits of a Database; sorting skips them to keep radix buckets even
+  size_t _shared_hash_bits = 0;
+};
+
+// Readers may run concurrently with each other and with insert() and put(),
+// each reader thread needs its own ReadContext.
 class Bucket {
 private:
+  BucketOptions _options;
+  // current snapshot of files, readers load it without locking and keep
+  // files of their snapshot alive until they are done
+  std::atomic<shared_ptr<const DataFiles>> _files{
+      std::make_shared<const DataFiles>()};
+  std::atomic<size_t> _next_file_number{0};
+  // serializes publishers of new file sets
+  std::mutex _publish_mutex;
+  // log of published file sets, replaced by a new snapshot once it has more
+  // edits than max(k_manifest_edits, files)
+  static constexpr size_t k_manifest_edits = 1024;
+  unique_ptr<Manifest> _manifest;
+
+  util::io::RateLimiter _compaction_limiter;
+  // serializes compactions, so they never pick the same files
+  std::mutex _compaction_run_mutex;
+  std::mutex _compaction_mutex;
+  std::condition_variable _compaction_cv;
+  bool _compaction_requested = false;
+  bool _stop_compaction = false;
+  std::thread _compaction_thread;
+
+  // puts hold it shared while appending to log and memtable, switching
+  // memtables holds it exclusively
+  std::shared_mutex _memtable_mutex;
+  shared_ptr<MemTable> _memtable;
+  // active memtable and frozen ones waiting for a flush, readers check them
+  // after files
+  std::atomic<shared_ptr<const MemTables>> _memtables;
+  // serializes flushes of frozen memtables
+  std::mutex _flush_run_mutex;
+  std::mutex _flush_mutex;
+  std::condition_variable _flush_cv;
+  bool _flush_requested = false;
+  bool _stop_flush = false;
+  std::thread _flush_thread;
+
+  // per thread, every thread writing or running flushes and compactions of
+  // the bucket records into its own
+  util::perf::PerThread<WriteMetrics> _write_metrics;
+
 public:
-  std::vector<DataFileMetadata> _files;
-  void insert(KVs &&kvs);
+  Bucket(BucketOptions options = {});
+  ~Bucket();
+  shared_ptr<const DataFiles> files() const { return _files.load(); }
+  // metrics of writes of all threads so far, reads are recorded into their
+  // ReadContext
+  WriteMetrics writeMetrics() const { return _write_metrics.merged(); }
+  // Keys of written entries are at most IndexPage::k_max_key_size bytes and
+  // values at most IndexPage::k_max_value_size bytes, fits() checks both and
+  // logs the entry that doesn't fit.
+  static bool fits(string_view k, string_view v);
+  template <typename Entries> static bool fits(const Entries &kvs) {
+    return std::all_of(kvs.begin(), kvs.end(),
+                       [](const auto &kv) { return fits(kv._k, kv._v); });
+  }
+  // writes kvs straight into a new data file; returns false and writes
+  // nothing unless every entry fits()
+  bool insert(KVs &&kvs);
+  bool insert(const KVBatch &batch);
+  // logs entry and adds it to the memtable; returns false and logs nothing
+  // unless it fits()
+  bool put(string k, string v);
+  // moves all entries of memtables into data files
+  void flush();
   KVs read(const string &k, ReadContext &context);
+  // Appends entries of k to result as views into its arena, returns their
+  // number. Reusing result across reads avoids allocations.
+  size_t read(string_view k, ReadContext &context, KVBatch &result);
+  // Finds the newest value of k without copying it, returns false if there
+  // is none. handle pins the mapping or cached pages the value is read from,
+  // or holds the value read with pread, until it's released; reusing the
+  // handle across gets avoids allocations.
+  bool get(string_view k, ReadContext &context, ValueHandle &handle);
+  // Writes the newest value of k into memory returned by buffer(size),
+  // returns false if there is none. buffer may be called again when a
+  // candidate record turns out to hold another key, the value is then in the
+  // memory returned last.
+  bool get(string_view k, ReadContext &context,
+           const std::function<char *(size_t)> &buffer);
+  // Looks up a batch of keys, result[i] is the same as read(keys[i]). Index
+  // page loads and record reads are grouped per data file and submitted
+  // together through context's async backend.
+  vector<KVs> multiGet(span<const string> keys, ReadContext &context);
+  // Coroutine version of get() copying the newest value of k into value,
+  // suspends on every index page and record read awaited on context's ring
+  // so one thread can run many lookups at once. k must stay valid until the
+  // task is done. Values in value logs are awaited the same way, and mapped
+  // files are read through the ring rather than their mapping, so no lookup
+  // blocks the thread on a read or a page fault.
+  util::parallel::Task<bool> getAsync(string_view k, AsyncReadContext &context,
+                                      string &value);
+  // Iterates the newest value of every key in range, in key order, over a
+  // snapshot of files and of memtable keys taken now; memtable values are
+  // read once the iterator reaches them.
+  // Files with a key index are read from the first block of the range on
+  // with buffer_size readahead, other files are scanned whole.
+  Iterator scan(const KeyRange &range, size_t buffer_size = 256 << 10);
+  // sources of scan(), oldest first; Database merges sources of all shards
+  void addScanSources(const KeyRange &range, size_t buffer_size,
+                      vector<unique_ptr<Iterator::Source>> &sources) const;
+
+  // runs compactions picked by policy until there is nothing left to merge
+  void compact();
+
+  // Loads more entries than fit in memory. Entries are collected into runs of
+  // about run_byte_size, every full run is sorted and spilled into a
+  // temporary data file, and finish() merges runs into one data file
+  // published at once. Only one run and read buffers of merged runs are held
+  // in memory. Keys are expected to be unique, like in a single insert().
+  class BulkLoad {
+  private:
+    Bucket &_bucket;
+    size_t _run_byte_size;
+    KVBatch _run;
+    vector<shared_ptr<const DataFileMetadata>> _runs;
+
+    DataFileOpenOptions runOptions() const;
+    void spill();
+    // merges runs [begin, end) into one file at path and removes them
+    shared_ptr<DataFileMetadata> merge(size_t begin, size_t end,
+                                       std::string path,
+                                       size_t filter_bits_per_key,
+                                       const DataFileOpenOptions &options,
+                                       const ValueSeparation &separation);
+
+  public:
+    explicit BulkLoad(Bucket &bucket,
+                      size_t run_byte_size = size_t(256) << 20);
+    // removes runs of a load that was not finished
+    ~BulkLoad();
+    BulkLoad(const BulkLoad &) = delete;
+    BulkLoad &operator=(const BulkLoad &) = delete;
+
+    // returns false and adds nothing unless the entry fits()
+    bool add(string_view k, string_view v);
+    void finish();
+  };
 
 private:
-  void write(std::string path, KVs &&kvs);
+  std::string nextFilePath(const char *extension = ".data");
+  DataFileOpenOptions openOptions() const {
+    return {._fence_index = _options._fence_index,
+            ._mmap = _options._mmap,
+            ._direct_io = _options._direct_io,
+            ._key_index = _options._key_index,
+            ._compression = _options._compression,
+            ._block_size = _options._block_size};
+  }
+  // separation of values written into data files of the bucket
+  ValueSeparation valueSeparation() {
+    return {._min_value_size = _options._min_separated_value_size,
+            ._log_path = [this] { return nextFilePath(".vlog"); }};
+  }
+  // opens data files listed by the newest manifest of the directory, removes
+  // files it doesn't list and replays logs into the first memtable
+  void recover();
+  // opens listed data files in parallel, renaming the ones that can't be
+  // used, attaches value logs they point into and removes the other logs
+  void openFiles(const vector<Manifest::FileEntry> &listed,
+                 const vector<pair<size_t, std::string>> &value_logs);
+  // starts a new manifest with a snapshot of files, removes the previous one
+  void rollManifest(const DataFiles &files);
+  // sorts entries, KVs or KVBatch, into a new data file at path
+  template <typename Entries>
+  shared_ptr<DataFileMetadata>
+  writeFile(std::string path, const Entries &kvs, size_t filter_bits_per_key,
+            const DataFileOpenOptions &open_options, bool sync,
+            const ValueSeparation &separation);
+  // writes entries into a new durable data file and publishes it
+  template <typename Entries>
+  void write(std::string path, const Entries &kvs);
+  // calls read_record(entry) for records of file that may hold k until one
+  // returns true, returns false if none did
+  template <typename ReadRecord>
+  bool findRecord(const DataFileMetadata &file_meta, string_view k,
+                  size_t hash, ReadContext &context, ReadRecord &&read_record);
+  // appends newest entry of k in one file to sink, returns true if found
+  template <typename Sink>
+  bool readFile(const DataFileMetadata &file_meta, string_view k, size_t hash,
+                ReadContext &context, Sink &sink);
+  // tries memtables, then files, newest first, until a find returns true
+  template <typename FindInMemTable, typename FindInFile>
+  bool findNewest(FindInMemTable &&find_in_memtable,
+                  FindInFile &&find_in_file);
+  // passes every version of k, oldest first, to sink
+  template <typename Sink>
+  void read(string_view k, size_t hash, ReadContext &context, Sink &sink);
+  template <typename Sink>
+  void readUncached(string_view k, size_t hash, ReadContext &context,
+                    Sink &sink);
+  vector<KVs> multiGetUncached(span<const string> keys, ReadContext &context);
+  // steps of getAsync() in one file: finding the newest value of k,
+  // collecting index entries of hash into context._result, loading index
+  // page page_id (nullptr if it can't be read) and reading a candidate record
+  util::parallel::Task<bool> readFileAsync(const DataFileMetadata &file_meta,
+                                           string_view k, size_t hash,
+                                           AsyncReadContext &context,
+                                           string &value);
+  util::parallel::Task<void> getHashOffsetsAsync(
+      const DataFileMetadata &file_meta, PageSearch search,
+      AsyncReadContext &context);
+  util::parallel::Task<const IndexPage *>
+  loadPageAsync(const DataFileMetadata &file_meta, size_t page_id,
+                AsyncReadContext &context);
+  util::parallel::Task<bool> readRecordAsync(const DataFileMetadata &file_meta,
+                                             const IndexEntry &entry,
+                                             string_view k,
+                                             AsyncReadContext &context,
+                                             string &value);
+  // drops cached values of keys written by kvs
+  template <typename Entries> void invalidateCached(const Entries &kvs);
+  void requestCompaction();
+  // pins calling background thread to _background_cpu
+  void pinBackgroundThread() const;
+  // freezes active memtable if it's full, or non-empty when forced
+  void switchMemTable(bool force);
+  void flushFrozen();
+  void flushLoop();
+  // returns false if policy found nothing to merge and no value log needs
+  // collecting
+  bool compactOnce();
+  // Rewrites every file pointing into the value log with the most garbage
+  // above _value_log_garbage_ratio, moving its live values into new logs.
+  // Returns false if no log has enough garbage.
+  bool collectValueLog(const DataFiles &files);
+  // publishes merged in place of adjacent inputs, then removes inputs and
+  // value logs no file of the new set points into
+  void replaceFiles(span<const shared_ptr<const DataFileMetadata>> inputs,
+                    shared_ptr<const DataFileMetadata> merged);
+  void compactionLoop();
+  // replaces current file set with its copy modified by update, the change
+  // is durable in the manifest once it's visible to readers. published runs
+  // once it's visible, before any later change
+  void publish(const std::function<void(DataFiles &)> &update,
+               const std::function<void()> &published = {});
+  // memtables and files readers look into, a memtable already published in
+  // a file of the snapshot is left out, so no entry is seen twice
+  pair<shared_ptr<const MemTables>, shared_ptr<const DataFiles>>
+  readSnapshot() const;
 };
 
-struct IndexEntry {
+// Narrows down the range of index pages that may hold a hash, using
+// _pre_hashes/_post_hashes of every examined page to jump between pages.
+struct PageSearch {
   size_t _hash;
-  size_t _offset;
-};
+  size_t _lo;      // first page that may still hold the hash
+  size_t _hi;      // last page that may still hold the hash
+  size_t _page_id; // page that should be examined next
+
+  PageSearch() = default;
+  // starts at the page estimated by interpolation of hash
+  PageSearch(size_t hash, size_t entries_num);
+  // Creates search for hash in file, going straight to the only candidate
+  // page if file has fences, otherwise to the page predicted by its position
+  // model and bounded by the model's error. Returns false if filter or fences
+  // of the file rule out the hash without any I/O.
+  static bool create(const DataFileMetadata &file_meta, size_t hash,
+                     PageSearch &search);
 
-struct IndexPage {
-  // number of hashes for preceding and following IndexPages.
-  static constexpr size_t k_hashes_num = 8;
-  // number of entries in each index page
-  static constexpr size_t k_entries_num =
-      (util::io::k_sector_size - 2 * k_hashes_num * sizeof(size_t)) /
-      sizeof(IndexEntry);
-  // first hash of each of previous k_hashes_num index pages
-  size_t _pre_hashes[k_hashes_num];
-  // last hash of each of following k_hashes_num index pages
-  size_t _post_hashes[k_hashes_num];
-  // entries for each key
-  IndexEntry _entries[k_entries_num];
+  // Examines loaded page _page_id holding size entries. Returns true when the
+  // search is finished, entries that may have the hash are then [begin, end)
+  // (empty on miss). Otherwise _page_id is set to the next page to examine.
+  bool step(const IndexPage &page, size_t size, size_t &begin, size_t &end);
 };
 
 struct PageIterator {
-  static constexpr size_t k_entry_size = sizeof(IndexEntry);
   char _page_mem[sizeof(IndexPage) + util::io::k_sector_size - 1];
-  IndexPage *_page =
+  IndexPage *_own_page =
       reinterpret_cast<IndexPage *>((reinterpret_cast<uintptr_t>(_page_mem) +
                                      util::io::k_sector_size - 1) &
                                     ~(util::io::k_sector_size - 1));
+  // either _own_page, page pinned in _cache or page inside _mapping
+  const IndexPage *_page = _own_page;
+  util::io::PageCache *_cache = nullptr;
+  util::io::PageCache::Handle _cached_page;
+  const util::io::MmapFileInput *_mapping = nullptr;
+  uint64_t _file_id;
   size_t _curr_entry_in_block; // id of entry in block pointer by iterator
   size_t _size;                // number of entries loaded
   util::io::BufferedFileInput &_in;
+  // counts loaded pages and hits of the cache
+  ReadMetrics &_metrics;
   size_t _index_offset;
   size_t _entries_num;
   size_t _page_id;
   size_t _pages_num;
 
-  PageIterator(util::io::BufferedFileInput &in);
+  PageIterator(util::io::BufferedFileInput &in, ReadMetrics &metrics);
 
+  // pages are pointers into mapping of the file if it's mapped, otherwise
+  // they are read through cache when it isn't nullptr
+  void setFile(const DataFileMetadata &file_meta, util::io::PageCache *cache);
+  // unpins page held in cache
+  void release();
   // returns false if loading did not succeed
   bool init(size_t page_for_entry,
             const size_t index_offset, const size_t entries_num);
   bool setPageId(size_t page_id);
-  const IndexEntry &current() const;
+  IndexEntry current() const;
   bool dec();
   bool inc();
 
@@ -89,9 +427,61 @@ struct PageIterator {
 };
 
 struct ReadContext {
-  util::io::BufferedFileInput _in;
-  PageIterator _index_iterator{_in};
-  vector<size_t> _result;
+  // bytes fetched for every candidate record, most records fit in it entirely
+  static constexpr size_t k_record_window = util::io::k_sector_size;
+
+  // metrics of reads done with the context, any thread may copy or merge
+  // them while its reader records
+  ReadMetrics _metrics;
+  // a record of k_record_window bytes may span two sectors
+  util::io::BufferedFileInput _in{2 * k_record_window};
+  PageIterator _index_iterator{_in, _metrics};
+  // index entries of the hash being looked up
+  vector<IndexEntry> _result;
+  // holds keys of records larger than the window
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _record_window{
+      util::io::allocate_aligned_buffer(k_record_window)};
+  // used by multiGet, created on first use
+  std::unique_ptr<util::io::AsyncFileInput> _async_in;
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _batch_mem;
+  size_t _batch_mem_size = 0;
+  // decompressed block of a compressed data file
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _block_mem;
+  size_t _block_mem_size = 0;
+
+  // returns sector aligned buffer of at least size bytes, valid until next call
+  char *batchBuffer(size_t size);
+  // like batchBuffer(), for blocks decompressed by lookups
+  char *blockBuffer(size_t size);
 };
 
+// Buffers of one getAsync() lookup at a time, reads are awaited on _ring and
+// recorded into _metrics, which lookups run by one thread may share.
+struct AsyncReadContext {
+  util::io::IoRing *_ring = nullptr;
+  ReadMetrics *_metrics = nullptr;
+  // index page being searched, in _page_mem or pinned in the page cache
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _page_mem{
+      util::io::allocate_aligned_buffer(util::io::k_sector_size)};
+  util::io::PageCache::Handle _cached_page;
+  // index entries of the hash being looked up
+  vector<IndexEntry> _result;
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _record_mem;
+  size_t _record_mem_size = 0;
+  // decompressed block of a compressed data file
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _block_mem;
+  size_t _block_mem_size = 0;
+
+  // returns sector aligned buffer of at least size bytes, valid until next call
+  char *recordBuffer(size_t size);
+  // like recordBuffer(), for blocks decompressed by lookups
+  char *blockBuffer(size_t size);
+};
+
+// Fills context._result with index entries that may have search._hash in the
+// file whose size entries start at offset, through context._index_iterator
+// set to the file. Exposed for benchmarks of index searches.
+void getHashOffsets(ReadContext &context, size_t size, PageSearch search,
+                    size_t offset);
+
 } // namespace humming::Bucket
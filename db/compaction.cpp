@@ -0,0 +1,171 @@
+#include "db/compaction.h"
+
+#include <algorithm>
+
+#include "db/data_file_scanner.h"
+#include "db/data_file_writer.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+namespace {
+
+optional<CompactionJob> pickSizeTiered(const DataFiles &files,
+                                       const CompactionOptions &options) {
+  for (size_t begin = 0; begin < files.size(); ++begin) {
+    size_t smallest = files[begin]->byteSize();
+    size_t largest = smallest;
+    size_t end = begin + 1;
+    for (; end < files.size() && end - begin < options._max_merge_width;
+         ++end) {
+      const size_t size = files[end]->byteSize();
+      if (std::max(largest, size) >
+          options._size_ratio * std::min(smallest, size))
+        break;
+      smallest = std::min(smallest, size);
+      largest = std::max(largest, size);
+    }
+    if (end - begin >= options._min_merge_width)
+      return CompactionJob{begin, end, 0};
+  }
+  return nullopt;
+}
+
+// Levels are laid out from the deepest one, with one file per level above 0:
+// [L_n, ..., L_2, L_1, L_0, ..., L_0].
+optional<CompactionJob> pickLeveled(const DataFiles &files,
+                                    const CompactionOptions &options) {
+  size_t level0_begin = files.size();
+  while (level0_begin > 0 && files[level0_begin - 1]->level() == 0)
+    --level0_begin;
+  if (files.size() - level0_begin >= options._level0_trigger) {
+    size_t begin = level0_begin;
+    if (begin > 0 && files[begin - 1]->level() == 1)
+      --begin;
+    return CompactionJob{begin, files.size(), 1};
+  }
+  for (size_t i = level0_begin; i > 0; --i) {
+    const auto &file = files[i - 1];
+    size_t level_byte_size = options._level1_byte_size;
+    for (size_t level = 1; level < file->level(); ++level)
+      level_byte_size *= options._level_fanout;
+    if (file->byteSize() > level_byte_size) {
+      size_t begin = i - 1;
+      if (begin > 0 && files[begin - 1]->level() == file->level() + 1)
+        --begin;
+      return CompactionJob{begin, i, file->level() + 1};
+    }
+  }
+  return nullopt;
+}
+
+} // namespace
+
+optional<CompactionJob> pickCompaction(const DataFiles &files,
+                                       const CompactionOptions &options) {
+  switch (options._policy) {
+  case CompactionOptions::k_none:
+    return nullopt;
+  case CompactionOptions::k_size_tiered:
+    return pickSizeTiered(files, options);
+  case CompactionOptions::k_leveled:
+    return pickLeveled(files, options);
+  }
+  return nullopt;
+}
+
+shared_ptr<DataFileMetadata>
+mergeDataFiles(span<const shared_ptr<const DataFileMetadata>> inputs,
+               string path, const CompactionOptions &options,
+               util::io::RateLimiter &limiter, size_t filter_bits_per_key,
+               const DataFileOpenOptions &open_options,
+               const ValueSeparation &separation,
+               span<const uint64_t> relocated_logs) {
+  vector<unique_ptr<DataFileScanner>> scanners;
+  for (const auto &input : inputs)
+    scanners.push_back(
+        std::make_unique<DataFileScanner>(*input, options._read_buffer_size));
+  // heap of inputs by hash of their current record, on equal hashes newer
+  // input goes first
+  auto later = [&](size_t l, size_t r) {
+    const size_t l_hash = scanners[l]->current()._hash;
+    const size_t r_hash = scanners[r]->current()._hash;
+    return l_hash != r_hash ? l_hash > r_hash : l < r;
+  };
+  vector<size_t> heap;
+  for (size_t i = 0; i < scanners.size(); ++i) {
+    if (scanners[i]->next())
+      heap.push_back(i);
+  }
+  std::make_heap(heap.begin(), heap.end(), later);
+
+  DataFileWriter out(std::move(path), options._write, filter_bits_per_key,
+                     open_options, 1, separation);
+  // records sharing a hash, newest first, with the input they come from if
+  // their value is a pointer
+  struct Record {
+    KV _kv;
+    const DataFileMetadata *_separated_in;
+  };
+  vector<Record> group;
+  string relocated;
+  size_t unpaced_bytes = 0;
+  while (!heap.empty()) {
+    const size_t hash = scanners[heap.front()]->current()._hash;
+    group.clear();
+    while (!heap.empty() && scanners[heap.front()]->current()._hash == hash) {
+      std::pop_heap(heap.begin(), heap.end(), later);
+      auto &scanner = *scanners[heap.back()];
+      unpaced_bytes += scanner.currentByteSize();
+      KV &kv = scanner.current();
+      if (std::none_of(group.begin(), group.end(), [&](const Record &newer) {
+            return newer._kv._k == kv._k;
+          }))
+        group.push_back({std::move(kv), scanner.separated()
+                                            ? inputs[heap.back()].get()
+                                            : nullptr});
+      if (scanner.next())
+        std::push_heap(heap.begin(), heap.end(), later);
+      else
+        heap.pop_back();
+    }
+    for (const auto &[kv, separated_in] : group) {
+      string_view v = kv._v;
+      if (separated_in != nullptr) {
+        ValuePointer pointer;
+        if (!pointer.decode(v) || !separated_in->valueLog(pointer._log)) {
+          PLOGE << "broken value pointer in " << separated_in->path();
+          abort();
+        }
+        const auto &log = separated_in->valueLog(pointer._log);
+        if (std::find(relocated_logs.begin(), relocated_logs.end(),
+                      pointer._log) == relocated_logs.end()) {
+          out.add(kv._hash, kv._k, pointer, log);
+          unpaced_bytes += IndexEntry::headerSize(kv._k.size(), v.size()) +
+                           kv._k.size() + v.size();
+          continue;
+        }
+        relocated.resize(pointer._size);
+        if (!log->read(pointer, relocated.data())) {
+          PLOGE << "could not read value from " << log->path();
+          abort();
+        }
+        v = relocated;
+        unpaced_bytes += v.size();
+      }
+      out.add(kv._hash, kv._k, v);
+      unpaced_bytes += IndexEntry::headerSize(kv._k.size(), v.size()) +
+                       kv._k.size() + v.size();
+    }
+    if (unpaced_bytes >= (1 << 16)) {
+      limiter.request(unpaced_bytes);
+      unpaced_bytes = 0;
+    }
+  }
+  limiter.request(unpaced_bytes);
+  // inputs are removed once the output is published
+  return out.finish(true);
+}
+
+} // namespace humming::DB
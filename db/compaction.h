@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "db/data_file_metadata.h"
+#include "db/data_file_writer.h"
+#include "util/io/rate_limiter.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+struct CompactionOptions {
+  enum Policy { k_none, k_size_tiered, k_leveled };
+  Policy _policy = k_size_tiered;
+  // size tiered: merge between these numbers of adjacent files, whose sizes
+  // differ at most _size_ratio times
+  size_t _min_merge_width = 4;
+  size_t _max_merge_width = 32;
+  double _size_ratio = 4;
+  // leveled: number of flushed files triggering their merge into level 1
+  size_t _level0_trigger = 4;
+  // leveled: size above which level 1 is merged into level 2, each following
+  // level may be _level_fanout times larger than previous one
+  size_t _level1_byte_size = size_t(256) << 20;
+  size_t _level_fanout = 10;
+  // a value log is collected once at least this fraction of its bytes is
+  // not referenced by any data file, its live values are then moved into
+  // new value logs by rewriting files pointing into it; 0 disables it
+  double _value_log_garbage_ratio = 0.5;
+  // bytes read and written by compaction per second, 0 is unlimited
+  size_t _rate_limit = 0;
+  size_t _read_buffer_size = 1 << 20;
+  DataFileWriteOptions _write = {._buffer_size = 4 << 20,
+                                 ._bytes_per_sync = 1 << 20};
+};
+
+// Adjacent files [_begin, _end) of a DataFiles to be merged into one file. A
+// single file is moved to _output_level without rewriting it.
+struct CompactionJob {
+  size_t _begin;
+  size_t _end;
+  size_t _output_level;
+};
+
+// Picks next job according to options._policy, nullopt if there is nothing
+// worth merging. Jobs always cover adjacent files, so the merged file can take
+// their place without reordering versions of keys.
+optional<CompactionJob> pickCompaction(const DataFiles &files,
+                                       const CompactionOptions &options);
+
+// Streams a k-way merge of inputs (oldest first) into a new data file at path.
+// Only the newest record of every key is kept. Records pointing into value
+// logs keep their pointers, except the ones into relocated_logs, whose values
+// are written again like values of inline records: separated into a value log
+// of the output or inline.
+shared_ptr<DataFileMetadata>
+mergeDataFiles(span<const shared_ptr<const DataFileMetadata>> inputs,
+               string path, const CompactionOptions &options,
+               util::io::RateLimiter &limiter, size_t filter_bits_per_key,
+               const DataFileOpenOptions &open_options,
+               const ValueSeparation &separation = {},
+               span<const uint64_t> relocated_logs = {});
+
+} // namespace humming::DB
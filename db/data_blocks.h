@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "db/index_page.h"
+#include "util/io/compression.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Where a block of records of a compressed data file is stored. A block
+// whose compressed form isn't smaller is stored as it is, with _size equal
+// to _raw_size.
+struct BlockHandle {
+  uint64_t _offset;
+  uint32_t _size;
+  uint32_t _raw_size;
+
+  bool compressed() const { return _size != _raw_size; }
+};
+
+// Blocks of a data file written with a Compression. Records are grouped into
+// blocks of about the block size of the writer, each compressed on its own,
+// and IndexEntry::offset() of a record addresses (block, slot): the block
+// number above the low shift() bits and the offset of the record within the
+// decompressed block in them. A record larger than a block gets a block of
+// its own. Handles of all blocks are kept in memory, so a lookup reads one
+// block with one read.
+class DataBlocks {
+private:
+  util::io::Compression _compression = util::io::Compression::k_none;
+  size_t _shift = 0;
+  vector<BlockHandle> _handles;
+
+public:
+  // records stored one after another, offsets are file offsets
+  DataBlocks() = default;
+  DataBlocks(util::io::Compression compression, size_t shift,
+             vector<BlockHandle> handles)
+      : _compression(compression), _shift(shift),
+        _handles(std::move(handles)) {}
+
+  bool empty() const { return _compression == util::io::Compression::k_none; }
+  util::io::Compression compression() const { return _compression; }
+  size_t shift() const { return _shift; }
+  size_t blocksNum() const { return _handles.size(); }
+  const BlockHandle &handle(size_t block) const { return _handles[block]; }
+
+  static size_t address(size_t block, size_t slot, size_t shift) {
+    return block << shift | slot;
+  }
+  size_t block(size_t offset) const { return offset >> _shift; }
+  size_t slot(size_t offset) const {
+    return offset & ((size_t(1) << _shift) - 1);
+  }
+  // entry addresses a record of an existing block that lies within it
+  bool holds(const IndexEntry &entry) const {
+    const size_t b = block(entry.offset());
+    return b < _handles.size() &&
+           slot(entry.offset()) + entry.recordSize() <= _handles[b]._raw_size;
+  }
+  // key of record of entry starts there in its decompressed block
+  size_t keySlot(const IndexEntry &entry) const {
+    return slot(entry.offset()) + entry.headerSize();
+  }
+
+  // Returns records of block b from its stored bytes: stored itself if the
+  // block isn't compressed, otherwise raw, which must have room for
+  // handle(b)._raw_size bytes it's decompressed into. nullptr if the block is
+  // corrupted.
+  const char *restore(size_t b, const char *stored, char *raw) const {
+    const BlockHandle &handle = _handles[b];
+    if (!handle.compressed())
+      return stored;
+    return util::io::decompress(_compression, stored, handle._size, raw,
+                                handle._raw_size)
+               ? raw
+               : nullptr;
+  }
+  size_t memorySize() const {
+    return _handles.capacity() * sizeof(BlockHandle);
+  }
+};
+
+} // namespace humming::DB
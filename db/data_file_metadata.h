@@ -1,27 +1,266 @@
 #pragma once
 
+#include "db/bloom_filter.h"
+#include "db/data_blocks.h"
+#include "db/fence_index.h"
+#include "db/key_hash.h"
+#include "db/key_index.h"
+#include "db/position_model.h"
+#include "db/value_log.h"
+#include "plog/Log.h"
 #include "util/io/buffered_file_input.h"
+#include "util/io/crc32.h"
+#include "util/io/mmap_file_input.h"
+#include <atomic>
+#include <memory>
 #include <string>
+#include <sys/stat.h>
+#include <vector>
 
 using namespace std;
 
 namespace humming {
 
+// Fixed size trailer at the very end of every data file. Data file layout:
+// records or blocks of them, padding to sector size, index pages, key index,
+// filter, position model, references of value logs, key index fences, index
+// page fences, block handles, footer. The footer and the tail before it are
+// enough to open a file, no other part of it has to be scanned.
+struct DataFileFooter {
+  // 2 since IndexEntry holds key and value sizes and key fingerprint, 3 since
+  // record sizes are varints, 4 since position model follows the filter, 5
+  // since footer holds entries count, checksum and magic, 6 since records may
+  // point into value logs, 7 since files may have a key index, 8 since
+  // footer names the key hash, 9 since index pages store truncated hashes in
+  // columns, 10 since first and last hashes of index pages are in the tail,
+  // 11 since records may be grouped into compressed blocks, 12 since index
+  // pages store 16 bit key sizes
+  static constexpr size_t k_version = 12;
+  static constexpr uint64_t k_magic = 0x68756d6d696e6731; // "humming1"
+
+  size_t _entries_count;
+  size_t _index_offset;
+  size_t _filter_offset;
+  size_t _filter_size;
+  size_t _filter_probes;
+  size_t _model_size;
+  size_t _model_error;
+  // number of ValueLogRef following the model
+  size_t _value_logs_num;
+  // key index between index pages and filter, 0 if the file has none; its
+  // fences follow value log references
+  size_t _key_index_size = 0;
+  size_t _key_fences_size = 0;
+  // util::io::Compression of blocks of records, k_none stores records one
+  // after another and has no blocks; see DB::DataBlocks
+  size_t _compression = 0;
+  size_t _block_shift = 0;
+  size_t _blocks_num = 0;
+  // hash and seed records are ordered by
+  size_t _key_hash = DB::KeyHash::k_id;
+  size_t _key_hash_seed = DB::k_key_hash_seed;
+  // crc32c of filter, model, value log references, key and page fences,
+  // block handles and this footer with _checksum set to 0
+  size_t _checksum = 0;
+  size_t _version = k_version;
+  uint64_t _magic = k_magic;
+
+  size_t valueLogsSize() const {
+    return _value_logs_num * sizeof(DB::ValueLogRef);
+  }
+  // a FenceIndex::Fence of every index page
+  size_t pageFencesSize() const {
+    return DB::IndexPage::pagesNum(_entries_count) *
+           sizeof(DB::FenceIndex::Fence);
+  }
+  size_t blocksSize() const { return _blocks_num * sizeof(DB::BlockHandle); }
+  // bytes between the filter and the footer
+  size_t tailSize() const {
+    return _filter_size + _model_size + valueLogsSize() + _key_fences_size +
+           pageFencesSize() + blocksSize();
+  }
+  uint32_t checksum(const char *filter, const char *model,
+                    const char *value_logs, const char *key_fences,
+                    const char *page_fences, const char *blocks) const {
+    DataFileFooter footer = *this;
+    footer._checksum = 0;
+    uint32_t crc = util::io::crc32c(filter, _filter_size);
+    crc = util::io::crc32c(model, _model_size, crc);
+    crc = util::io::crc32c(value_logs, valueLogsSize(), crc);
+    crc = util::io::crc32c(key_fences, _key_fences_size, crc);
+    crc = util::io::crc32c(page_fences, pageFencesSize(), crc);
+    crc = util::io::crc32c(blocks, blocksSize(), crc);
+    return util::io::crc32c((const char *)&footer, sizeof(footer), crc);
+  }
+};
+
+// how a data file is prepared for reading when it's opened
+struct DataFileOpenOptions {
+  // keep first/last hash of every index page, read from the tail of the
+  // file, in memory
+  bool _fence_index = true;
+  // map the file, so index pages and records are read through pointers
+  bool _mmap = false;
+  // write the file with O_DIRECT, with records packed so none crosses a
+  // sector boundary unless it's larger than one, and open it with O_DIRECT
+  // for reading
+  bool _direct_io = false;
+  // write a key ordered index of records, so range scans don't have to read
+  // the whole file; only its fences are kept in memory
+  bool _key_index = false;
+  // write records in blocks of about _block_size bytes, each compressed on
+  // its own, so files are smaller and lookups read fewer bytes at the cost
+  // of decompressing the block of every record they read
+  util::io::Compression _compression = util::io::Compression::k_none;
+  size_t _block_size = 16 << 10;
+};
+
 class DataFileMetadata {
 private:
   string _path;
   size_t _entries_count;
   size_t _byte_size;
+  size_t _index_offset;
+  DB::BloomFilter _filter;
+  DB::FenceIndex _fences;
+  // empty unless records are in compressed blocks
+  DB::DataBlocks _blocks;
+  DB::PositionModel _model;
+  // value logs referenced by records, _value_logs[i] is the open log of
+  // _value_log_refs[i] or nullptr if it's missing
+  vector<DB::ValueLogRef> _value_log_refs;
+  vector<shared_ptr<const DB::ValueLog>> _value_logs;
+  DB::KeyIndex _key_index;
+  util::io::MmapFileInput _mapping;
+  bool _direct_io = false;
+  // compaction level, 0 for files flushed by insert; changes without
+  // rewriting the file when compaction moves it to an empty level
+  mutable std::atomic<size_t> _level = 0;
+  // unique id of this file within process, never reused
+  uint64_t _id = s_next_id.fetch_add(1, std::memory_order_relaxed);
   int _fd = -1;
 
+  static inline std::atomic<uint64_t> s_next_id{0};
+
 public:
-  DataFileMetadata(string path, size_t entries_count, size_t byte_size)
-      : _path(path), _entries_count(entries_count), _byte_size(byte_size) {
-    _fd = open(path.c_str(), O_RDONLY);
+  DataFileMetadata(string path, size_t entries_count, size_t byte_size,
+                   size_t index_offset, DB::BloomFilter filter,
+                   DB::PositionModel model,
+                   vector<DB::ValueLogRef> value_log_refs,
+                   DB::KeyIndex key_index,
+                   const vector<DB::FenceIndex::Fence> &page_fences,
+                   DB::DataBlocks blocks, const DataFileOpenOptions &options)
+      : _path(path), _entries_count(entries_count), _byte_size(byte_size),
+        _index_offset(index_offset), _filter(std::move(filter)),
+        _fences(options._fence_index ? DB::FenceIndex(page_fences)
+                                     : DB::FenceIndex()),
+        _blocks(std::move(blocks)),
+        _model(std::move(model)), _value_log_refs(std::move(value_log_refs)),
+        _value_logs(_value_log_refs.size()), _key_index(std::move(key_index)),
+        _direct_io(options._direct_io) {
+    _fd = open(path.c_str(), O_RDONLY | (_direct_io ? O_DIRECT : 0));
     if (_fd == -1) {
       PLOGE << "could not open " << path << " because: " << strerror(errno);
       abort();
     }
+    if (options._mmap) {
+      if (_mapping.map(_fd, byte_size) == -1) {
+        PLOGE << "could not map " << path;
+        abort();
+      }
+      // records are hit at random, the index is small and read by every
+      // lookup
+      _mapping.advise(0, index_offset, MADV_RANDOM);
+      _mapping.advise(index_offset, byte_size - index_offset, MADV_WILLNEED);
+    }
+  }
+
+  // Opens existing data file at path with one read of its tail: filter,
+  // model, key and page fences and references of value logs, which are then
+  // attached with setValueLog(). Returns nullptr if the file is not a
+  // complete data file of the current version, e.g. its write was
+  // interrupted.
+  static shared_ptr<DataFileMetadata> load(const string &path,
+                                           const DataFileOpenOptions &options) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      PLOGE << "could not open " << path << " because: " << strerror(errno);
+      return nullptr;
+    }
+    struct stat st;
+    DataFileFooter footer;
+    const bool has_footer =
+        fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(footer) &&
+        pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) ==
+            ssize_t(sizeof(footer));
+    const size_t byte_size = has_footer ? st.st_size : 0;
+    const size_t tail_size = has_footer ? footer.tailSize() : 0;
+    if (!has_footer || footer._magic != DataFileFooter::k_magic ||
+        footer._version != DataFileFooter::k_version ||
+        footer._compression > size_t(util::io::Compression::k_zstd) ||
+        (footer._compression == 0 && footer._blocks_num > 0) ||
+        footer._block_shift >= 64 ||
+        footer._index_offset % util::io::k_sector_size != 0 ||
+        footer._filter_offset !=
+            footer._index_offset +
+                DB::IndexPage::pagesNum(footer._entries_count) *
+                    sizeof(DB::IndexPage) +
+                footer._key_index_size ||
+        footer._filter_offset + tail_size + sizeof(footer) != byte_size) {
+      PLOGE << path << " has no valid footer of version "
+            << DataFileFooter::k_version;
+      close(fd);
+      return nullptr;
+    }
+    if (footer._key_hash != DB::KeyHash::k_id ||
+        footer._key_hash_seed != DB::k_key_hash_seed) {
+      // lookups would miss every record, and dropping the file loses them
+      PLOGE << path << " is ordered by key hash " << footer._key_hash
+            << " with seed " << footer._key_hash_seed << ", not by "
+            << DB::KeyHash::k_id << " with seed " << DB::k_key_hash_seed;
+      abort();
+    }
+    vector<char> tail(tail_size);
+    const char *filter = tail.data();
+    const char *model = filter + footer._filter_size;
+    const char *value_logs = model + footer._model_size;
+    const char *key_fences = value_logs + footer.valueLogsSize();
+    const char *page_fences = key_fences + footer._key_fences_size;
+    const char *blocks = page_fences + footer.pageFencesSize();
+    const bool read = pread(fd, tail.data(), tail_size,
+                            footer._filter_offset) == ssize_t(tail_size);
+    close(fd);
+    if (!read || footer.checksum(filter, model, value_logs, key_fences,
+                                 page_fences, blocks) != footer._checksum) {
+      PLOGE << "filter, model, value logs, fences or blocks of " << path
+            << " are corrupted";
+      return nullptr;
+    }
+    vector<DB::ValueLogRef> value_log_refs(footer._value_logs_num);
+    if (!value_log_refs.empty())
+      memcpy(value_log_refs.data(), value_logs, footer.valueLogsSize());
+    vector<DB::FenceIndex::Fence> fences;
+    if (options._fence_index) {
+      fences.resize(DB::IndexPage::pagesNum(footer._entries_count));
+      if (!fences.empty())
+        memcpy(fences.data(), page_fences, footer.pageFencesSize());
+    }
+    vector<DB::BlockHandle> block_handles(footer._blocks_num);
+    if (!block_handles.empty())
+      memcpy(block_handles.data(), blocks, footer.blocksSize());
+    return std::make_shared<DataFileMetadata>(
+        path, footer._entries_count, byte_size, footer._index_offset,
+        DB::BloomFilter(filter, footer._filter_size, footer._filter_probes),
+        DB::PositionModel(model, footer._model_size, footer._entries_count,
+                          footer._model_error),
+        std::move(value_log_refs),
+        DB::KeyIndex(footer._filter_offset - footer._key_index_size,
+                     footer._key_index_size, key_fences,
+                     footer._key_fences_size),
+        fences,
+        DB::DataBlocks(util::io::Compression(footer._compression),
+                       footer._block_shift, std::move(block_handles)),
+        options);
   }
 
   DataFileMetadata(const DataFileMetadata &) = delete;
@@ -33,19 +272,74 @@ public:
     _path = std::move(other._path);
     _entries_count = other._entries_count;
     _byte_size = other._byte_size;
+    _index_offset = other._index_offset;
+    _filter = std::move(other._filter);
+    _fences = std::move(other._fences);
+    _blocks = std::move(other._blocks);
+    _model = std::move(other._model);
+    _value_log_refs = std::move(other._value_log_refs);
+    _value_logs = std::move(other._value_logs);
+    _key_index = std::move(other._key_index);
+    _mapping = std::move(other._mapping);
+    _direct_io = other._direct_io;
+    _level = other._level.load();
+    _id = other._id;
     _fd = other._fd;
     other._fd = -1;
     return *this;
   }
-  int fd() { return _fd; }
+  int fd() const { return _fd; }
+  // fd() is opened with O_DIRECT, offsets and buffers of reads must be
+  // sector aligned
+  bool directIo() const { return _direct_io; }
   ~DataFileMetadata() {
     if (_fd != -1)
       close(_fd);
   }
 
+  uint64_t id() const { return _id; }
+  size_t level() const { return _level; }
+  void setLevel(size_t level) const { _level = level; }
   const string &path() const { return _path; }
   size_t entriesCount() const { return _entries_count; }
   size_t byteSize() const { return _byte_size; }
+  size_t indexOffset() const { return _index_offset; }
+  const DB::BloomFilter &filter() const { return _filter; }
+  // empty if fences are disabled
+  const DB::FenceIndex &fences() const { return _fences; }
+  // empty if records aren't in compressed blocks
+  const DB::DataBlocks &blocks() const { return _blocks; }
+  const DB::PositionModel &model() const { return _model; }
+  const vector<DB::ValueLogRef> &valueLogRefs() const {
+    return _value_log_refs;
+  }
+  const vector<shared_ptr<const DB::ValueLog>> &valueLogs() const {
+    return _value_logs;
+  }
+  // attaches open log of _value_log_refs[i], before the file is shared
+  void setValueLog(size_t i, shared_ptr<const DB::ValueLog> log) {
+    _value_logs[i] = std::move(log);
+  }
+  // open value log number referenced by the file, nullptr if there is none
+  const shared_ptr<const DB::ValueLog> &valueLog(uint64_t number) const {
+    static const shared_ptr<const DB::ValueLog> k_missing;
+    for (size_t i = 0; i < _value_log_refs.size(); ++i) {
+      if (_value_log_refs[i]._log == number)
+        return _value_logs[i];
+    }
+    return k_missing;
+  }
+  // empty if the file was written without DataFileOpenOptions::_key_index
+  const DB::KeyIndex &keyIndex() const { return _key_index; }
+  // not mapped unless opened with DataFileOpenOptions::_mmap
+  const util::io::MmapFileInput &mapping() const { return _mapping; }
 };
 
 } // namespace humming
+
+namespace humming::DB {
+
+// immutable set of data files, newest last
+typedef vector<shared_ptr<const DataFileMetadata>> DataFiles;
+
+} // namespace humming::DB
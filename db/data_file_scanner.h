@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "db/KV.h"
+#include "db/data_blocks.h"
+#include "db/key_hash.h"
+#include "db/data_file_metadata.h"
+#include "db/index_page.h"
+#include "util/io/buffered_file_input.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Reads all records of a data file sequentially, in hash order. Records and
+// index entries are streamed side by side through their own descriptors, so
+// shared descriptor of the file is untouched. Pages keep truncated hashes,
+// so hashes are recomputed from keys and checked against them. Records of
+// compressed files are read from their blocks, each decompressed once.
+class DataFileScanner {
+private:
+  const DataFileMetadata &_file_meta;
+  util::io::BufferedFileInput _records;
+  util::io::BufferedFileInput _index;
+  std::unique_ptr<IndexPage> _page = std::make_unique<IndexPage>();
+  size_t _position = 0; // number of records read so far
+  size_t _offset = 0;   // file position of _records
+  size_t _record_size = 0;
+  bool _separated = false;
+  KV _current;
+  // block of a compressed file records are read from, and the position of
+  // the current record in it
+  size_t _block = SIZE_MAX;
+  string _stored;
+  string _raw;
+  const char *_block_records = nullptr;
+  size_t _slot = 0;
+
+  // reads and decompresses block b, which follows blocks read so far
+  void loadBlock(size_t b) {
+    const DataBlocks &blocks = _file_meta.blocks();
+    const BlockHandle &handle = blocks.handle(b);
+    _stored.resize(handle._size);
+    // blocks of direct I/O files may be preceded by padding
+    if (handle._offset < _offset ||
+        (handle._offset > _offset &&
+         _records.skip(handle._offset - _offset) !=
+             ssize_t(handle._offset - _offset)) ||
+        _records.read(_stored.data(), _stored.size()) !=
+            ssize_t(_stored.size())) {
+      PLOGE << "could not read block of " << _file_meta.path();
+      abort();
+    }
+    _offset = handle._offset + handle._size;
+    _raw.resize(handle._raw_size);
+    _block_records = blocks.restore(b, _stored.data(), _raw.data());
+    if (_block_records == nullptr) {
+      PLOGE << "block of " << _file_meta.path() << " is corrupted";
+      abort();
+    }
+    _block = b;
+  }
+  // reads next size bytes of the current record
+  bool read(char *out, size_t size) {
+    if (_block_records == nullptr)
+      return _records.read(out, size) == ssize_t(size);
+    memcpy(out, _block_records + _slot, size);
+    _slot += size;
+    return true;
+  }
+
+public:
+  DataFileScanner(const DataFileMetadata &file_meta, size_t buffer_size)
+      : _file_meta(file_meta), _records(buffer_size), _index(buffer_size) {
+    // with direct I/O scans of compaction don't evict pages of other files
+    if (_records.open(file_meta.path(), file_meta.directIo()) == -1 ||
+        _index.open(file_meta.path(), file_meta.directIo()) == -1 ||
+        _index.seek(file_meta.indexOffset()) == -1) {
+      PLOGE << "could not open " << file_meta.path() << " for scanning";
+      abort();
+    }
+  }
+
+  // Moves to the next record, returns false at the end of file.
+  bool next() {
+    if (_position == _file_meta.entriesCount())
+      return false;
+    const size_t entry = _position % IndexPage::k_entries_num;
+    if (entry == 0 &&
+        _index.read((char *)_page.get(), sizeof(IndexPage)) !=
+            sizeof(IndexPage)) {
+      PLOGE << "could not read index of " << _file_meta.path();
+      abort();
+    }
+    // records of direct I/O files may be preceded by padding
+    const IndexEntry index_entry = _page->entry(entry);
+    const size_t record_offset = index_entry.offset();
+    const DataBlocks &blocks = _file_meta.blocks();
+    if (!blocks.empty()) {
+      if (!blocks.holds(index_entry)) {
+        PLOGE << "index of " << _file_meta.path()
+              << " does not match its blocks";
+        abort();
+      }
+      if (blocks.block(record_offset) != _block)
+        loadBlock(blocks.block(record_offset));
+      _slot = blocks.slot(record_offset);
+    } else if (record_offset > _offset &&
+               _records.skip(record_offset - _offset) !=
+                   ssize_t(record_offset - _offset)) {
+      PLOGE << "could not read record of " << _file_meta.path();
+      abort();
+    }
+    // sizes are taken from the index, the header only confirms them
+    char header[2 * util::io::k_max_varint_size];
+    const size_t header_size = index_entry.headerSize();
+    uint64_t key_size, value_size;
+    size_t key_size_bytes;
+    _current._k.resize(index_entry._key_size);
+    _current._v.resize(index_entry._value_size);
+    if (!read(header, header_size) ||
+        (key_size_bytes = util::io::decodeVarint(header, header + header_size,
+                                                 key_size)) == 0 ||
+        util::io::decodeVarint(header + key_size_bytes, header + header_size,
+                               value_size) == 0 ||
+        key_size != index_entry._key_size ||
+        value_size != index_entry._value_size ||
+        !read(_current._k.data(), key_size) ||
+        !read(_current._v.data(), value_size)) {
+      PLOGE << "could not read record of " << _file_meta.path();
+      abort();
+    }
+    _current._hash = hashKey(_current._k);
+    if (!_page->mayHaveHash(entry, _current._hash)) {
+      PLOGE << "index of " << _file_meta.path()
+            << " does not match its records";
+      abort();
+    }
+    _record_size = index_entry.recordSize();
+    _separated = index_entry.separated();
+    if (blocks.empty())
+      _offset = record_offset + _record_size;
+    ++_position;
+    return true;
+  }
+
+  KV &current() { return _current; }
+  // value of current record is an encoded ValuePointer
+  bool separated() const { return _separated; }
+  // bytes occupied by current record and its index entry
+  size_t currentByteSize() const {
+    return _record_size + IndexPage::k_entry_size;
+  }
+};
+
+} // namespace humming::DB
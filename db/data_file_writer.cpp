@@ -0,0 +1,269 @@
+#include "db/data_file_writer.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+DataFileWriter::DataFileWriter(string path,
+                               const DataFileWriteOptions &write_options,
+                               size_t filter_bits_per_key,
+                               const DataFileOpenOptions &open_options,
+                               size_t threads_num, ValueSeparation separation)
+    : _path(std::move(path)),
+      // with O_DIRECT every flush of the buffer goes to the device
+      _out(open_options._direct_io
+               ? std::max(write_options._buffer_size, k_min_direct_buffer_size)
+               : write_options._buffer_size,
+           write_options._buffers_num, write_options._bytes_per_sync),
+      _filter_bits_per_key(filter_bits_per_key), _open_options(open_options),
+      _write_options(write_options), _separation(std::move(separation)),
+      _threads_num(threads_num) {
+  if (compressed()) {
+    // slots of records address the bytes of a block up to the block size
+    _block_shift =
+        std::bit_width(std::max<size_t>(_open_options._block_size, 1) - 1);
+    _block.reserve(_open_options._block_size);
+  }
+  if (_out.open(_path, _open_options._direct_io) == -1) {
+    PLOGE << "could not open a file " << _path
+          << " because: " << strerror(errno);
+    abort();
+  }
+}
+
+void DataFileWriter::pad(size_t bytes) {
+  static const char k_zeros[util::io::k_sector_size] = {};
+  _out.write(k_zeros, bytes);
+  _offset += bytes;
+}
+
+void DataFileWriter::alignForRead(size_t size) {
+  constexpr size_t k_sector = util::io::k_sector_size;
+  const size_t in_sector = _offset % k_sector;
+  if (_open_options._direct_io && in_sector > 0 &&
+      (in_sector + size - 1) / k_sector > (size - 1) / k_sector)
+    pad(k_sector - in_sector);
+}
+
+void DataFileWriter::add(size_t hash, string_view k, string_view v) {
+  if (!_separation.separates(v.size())) {
+    addRecord(hash, k, v, false);
+    return;
+  }
+  if (!_log)
+    _log = std::make_unique<ValueLogWriter>(
+        _separation._log_path(), _write_options._buffer_size,
+        _write_options._buffers_num, _write_options._bytes_per_sync);
+  add(hash, k, _log->append(v), nullptr);
+}
+
+void DataFileWriter::add(size_t hash, string_view k,
+                         const ValuePointer &pointer,
+                         shared_ptr<const ValueLog> log) {
+  auto &[bytes, value_log] = _value_logs[pointer._log];
+  bytes += pointer._size;
+  if (log)
+    value_log = std::move(log);
+  char encoded[ValuePointer::k_max_encoded_size];
+  addRecord(hash, k, string_view(encoded, pointer.encode(encoded)), true);
+}
+
+void DataFileWriter::addRecord(size_t hash, string_view k, string_view v,
+                               bool separated) {
+  const size_t record_size =
+      IndexEntry::headerSize(k.size(), v.size()) + k.size() + v.size();
+  // a record that would make the block larger than the block size starts
+  // the next one
+  if (compressed() && !_block.empty() &&
+      _block.size() + record_size > _open_options._block_size)
+    flushBlock();
+  if (!compressed())
+    alignForRead(record_size);
+  const size_t offset =
+      compressed()
+          ? DataBlocks::address(_blocks.size(), _block.size(), _block_shift)
+          : _offset;
+  if (!IndexPage::fits(offset, k.size(), v.size()) ||
+      (compressed() && _block.size() + record_size > UINT32_MAX)) {
+    PLOGE << "record of " << k.size() << " byte key and " << v.size()
+          << " byte value at offset " << offset << " does not fit index of "
+          << _path;
+    abort();
+  }
+  char header[2 * util::io::k_max_varint_size];
+  size_t header_size = util::io::encodeVarint(header, k.size());
+  header_size += util::io::encodeVarint(header + header_size, v.size());
+  if (compressed()) {
+    _block.append(header, header_size);
+    _block.append(k);
+    _block.append(v);
+  } else {
+    _out.write(header, header_size);
+    _out.write(k.data(), k.size());
+    _out.write(v.data(), v.size());
+    _offset += record_size;
+  }
+  _entries.push_back(
+      {._offset = offset | (separated ? IndexEntry::k_separated : 0),
+       ._value_size = v.size(),
+       ._key_size = uint32_t(k.size())});
+  _hashes.push_back(hash);
+  if (_open_options._key_index)
+    _key_index.add(k, v.size(), offset, separated);
+}
+
+void DataFileWriter::flushBlock() {
+  if (_block.empty())
+    return;
+  const util::io::Compression compression = _open_options._compression;
+  _compressed.resize(util::io::compressBound(compression, _block.size()));
+  const size_t compressed_size = util::io::compress(
+      compression, _block.data(), _block.size(), _compressed.data());
+  // a block compression doesn't shrink is stored as it is
+  const bool shrunk = compressed_size > 0 && compressed_size < _block.size();
+  const char *stored = shrunk ? _compressed.data() : _block.data();
+  const size_t size = shrunk ? compressed_size : _block.size();
+  alignForRead(size);
+  _blocks.push_back({._offset = _offset,
+                     ._size = uint32_t(size),
+                     ._raw_size = uint32_t(_block.size())});
+  _out.write(stored, size);
+  _offset += size;
+  _block.clear();
+}
+
+void DataFileWriter::fillPage(size_t p, IndexPage &page) const {
+  memset(&page, 0, sizeof(IndexPage));
+  const size_t entries_num = _entries.size();
+  const size_t pages_num = IndexPage::pagesNum(entries_num);
+  const size_t first_entry = p * IndexPage::k_entries_num;
+  const size_t page_size = IndexPage::entriesInPage(p, entries_num);
+  page.setHashes(_hashes[first_entry], _hashes[first_entry + page_size - 1]);
+  for (size_t i = 0; i < page_size; ++i)
+    page.setEntry(i, _hashes[first_entry + i], _entries[first_entry + i]);
+  {
+    // Fill last hash for following pages
+    size_t hashes_ahead = std::min(IndexPage::k_hashes_num, pages_num - p - 1);
+    for (size_t k = 0; k < hashes_ahead; ++k) {
+      size_t page_end =
+          std::min((p + k + 2) * IndexPage::k_entries_num, entries_num);
+      page._post_hashes[k] = _hashes[page_end - 1];
+    }
+  }
+  {
+    // Fill first hash for preceding pages
+    size_t hashes_preceding = std::min(IndexPage::k_hashes_num, p);
+    for (size_t k = 0; k < hashes_preceding; ++k)
+      page._pre_hashes[k] = _hashes[(p - k - 1) * IndexPage::k_entries_num];
+  }
+}
+
+shared_ptr<DataFileMetadata> DataFileWriter::finish(bool sync) {
+  flushBlock();
+  _compressed = {};
+  // add padding so index will be sector size aligned
+  if (_offset % util::io::k_sector_size > 0)
+    pad(util::io::k_sector_size - (_offset % util::io::k_sector_size));
+  const size_t index_offset = _offset;
+
+  // pages only depend on entries, so they are built concurrently and written
+  // with one sequential write
+  const size_t entries_num = _entries.size();
+  const size_t pages_num = IndexPage::pagesNum(entries_num);
+  std::unique_ptr<IndexPage[]> pages(new IndexPage[pages_num]);
+  util::parallel::parallelFor(
+      pages_num, _threads_num,
+      [&](size_t, size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p)
+          fillPage(p, pages[p]);
+      },
+      k_min_pages_per_thread);
+  _out.write((const char *)pages.get(), pages_num * sizeof(IndexPage));
+  pages.reset();
+  const size_t entries_memory = _entries.capacity() * sizeof(IndexEntry) +
+                                _hashes.capacity() * sizeof(size_t) +
+                                _key_index.memorySize() +
+                                _blocks.capacity() * sizeof(BlockHandle);
+  _peak_memory = entries_memory + pages_num * sizeof(IndexPage);
+  const size_t key_index_offset = index_offset + pages_num * sizeof(IndexPage);
+  string key_fences;
+  const size_t key_index_size = _key_index.finish(
+      [&](const char *data, size_t size) { _out.write(data, size); },
+      key_fences);
+
+  // write filter and footer
+  BloomFilter filter;
+  if (_filter_bits_per_key > 0 && entries_num > 0) {
+    filter = BloomFilter(entries_num, _filter_bits_per_key);
+    for (const size_t hash : _hashes)
+      filter.add(hash);
+  }
+  _peak_memory = std::max(_peak_memory, entries_memory + filter.byteSize());
+  PositionModel model = PositionModel::build(
+      entries_num, [&](size_t i) { return _hashes[i]; }, k_model_error);
+  DataFileFooter footer = {
+      ._entries_count = entries_num,
+      ._index_offset = index_offset,
+      ._filter_offset = key_index_offset + key_index_size,
+      ._filter_size = filter.byteSize(),
+      ._filter_probes = filter.probes(),
+      ._model_size = model.byteSize(),
+      ._model_error = model.error(),
+      ._value_logs_num = _value_logs.size(),
+      ._key_index_size = key_index_size,
+      ._key_fences_size = key_fences.size(),
+      ._compression = size_t(_open_options._compression),
+      ._block_shift = _block_shift,
+      ._blocks_num = _blocks.size()};
+  // the log is durable before the file pointing into it
+  if (_log)
+    _value_logs[_log->number()].second = _log->finish(sync);
+  vector<ValueLogRef> value_log_refs;
+  for (const auto &[number, log] : _value_logs)
+    value_log_refs.push_back({._log = number, ._bytes = log.first});
+  vector<FenceIndex::Fence> page_fences(pages_num);
+  for (size_t p = 0; p < pages_num; ++p) {
+    const size_t first_entry = p * IndexPage::k_entries_num;
+    const size_t page_size = IndexPage::entriesInPage(p, entries_num);
+    page_fences[p] = {._last = _hashes[first_entry + page_size - 1],
+                      ._first = _hashes[first_entry]};
+  }
+  footer._checksum = footer.checksum(
+      filter.data(), model.data(), (const char *)value_log_refs.data(),
+      key_fences.data(), (const char *)page_fences.data(),
+      (const char *)_blocks.data());
+  _out.write(filter.data(), filter.byteSize());
+  _out.write(model.data(), model.byteSize());
+  _out.write((const char *)value_log_refs.data(), footer.valueLogsSize());
+  _out.write(key_fences.data(), key_fences.size());
+  _out.write((const char *)page_fences.data(), footer.pageFencesSize());
+  _out.write((const char *)_blocks.data(), footer.blocksSize());
+  _out.writeSimple(footer);
+  if (_out.close(sync) == -1) {
+    PLOGE << "could not close a file " << _path
+          << " because: " << strerror(errno);
+    abort();
+  }
+  const size_t byte_size =
+      footer._filter_offset + footer.tailSize() + sizeof(DataFileFooter);
+  _entries = {};
+  _hashes = {};
+  auto file_meta = std::make_shared<DataFileMetadata>(
+      _path, entries_num, byte_size, index_offset, std::move(filter),
+      std::move(model), std::move(value_log_refs),
+      KeyIndex(key_index_offset, key_index_size, key_fences.data(),
+               key_fences.size()),
+      page_fences,
+      DataBlocks(_open_options._compression, _block_shift,
+                 std::move(_blocks)),
+      _open_options);
+  _blocks = {};
+  _block = {};
+  size_t i = 0;
+  for (auto &[number, log] : _value_logs)
+    file_meta->setValueLog(i++, std::move(log.second));
+  _value_logs.clear();
+  return file_meta;
+}
+
+} // namespace humming::DB
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db/data_blocks.h"
+#include "db/data_file_metadata.h"
+#include "db/index_page.h"
+#include "db/key_index.h"
+#include "db/value_log.h"
+#include "plog/Log.h"
+#include "util/io/buffered_file_output.h"
+#include "util/parallel/parallel_for.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// how records are streamed into a data file
+struct DataFileWriteOptions {
+  size_t _buffer_size = 1 << 20;
+  // buffers beyond the first are written by a background thread while the
+  // next one is filled, 1 writes synchronously
+  size_t _buffers_num = 2;
+  // starts writeback every that many bytes and waits for the previous range,
+  // so the final sync has little left to do; 0 leaves writeback to the kernel
+  size_t _bytes_per_sync = 0;
+};
+
+// Streams records into a new data file and, once all are added, appends the
+// index, filter and footer. Records must be added in non-decreasing hash
+// order, either from a sorted KVs or from a merge of sorted files. With
+// direct I/O records may be separated by padding, readers locate them by
+// offsets from the index. Values separated by ValueSeparation are appended to
+// a value log of the writer and records get pointers to them instead; the
+// file lists every value log its records point into. With
+// DataFileOpenOptions::_key_index keys are also collected and written sorted
+// after the index pages. With DataFileOpenOptions::_compression records are
+// collected into blocks, written compressed once they reach the block size.
+class DataFileWriter {
+private:
+  string _path;
+  util::io::BufferedFileOutput _out;
+  size_t _filter_bits_per_key;
+  DataFileOpenOptions _open_options;
+  DataFileWriteOptions _write_options;
+  ValueSeparation _separation;
+  // created by the first separated value
+  unique_ptr<ValueLogWriter> _log;
+  // referenced value logs by number, with bytes of values and the open log,
+  // which is nullptr for the log of this writer until finish()
+  map<uint64_t, pair<uint64_t, shared_ptr<const ValueLog>>> _value_logs;
+  // threads building index pages in finish()
+  size_t _threads_num;
+  vector<IndexEntry> _entries;
+  // hash of every entry, pages keep them truncated
+  vector<size_t> _hashes;
+  KeyIndexBuilder _key_index;
+  // records of the block being filled, its compressed form and handles of
+  // the written blocks, only used by compressed files
+  string _block;
+  string _compressed;
+  vector<BlockHandle> _blocks;
+  size_t _block_shift = 0;
+  size_t _offset = 0;
+  // largest memory held by index and filter building, set by finish()
+  size_t _peak_memory = 0;
+
+  // below it building pages isn't worth a thread
+  static constexpr size_t k_min_pages_per_thread = 256;
+  static constexpr size_t k_min_direct_buffer_size = 1 << 20;
+  // position model keeps most windows of candidate entries within one page
+  static constexpr size_t k_model_error = IndexPage::k_entries_num / 4;
+
+  bool compressed() const {
+    return _open_options._compression != util::io::Compression::k_none;
+  }
+  // writes bytes of zeros
+  void pad(size_t bytes);
+  // with direct I/O pads so that size bytes written next start at the next
+  // sector if they would touch more sectors than their size needs, so they
+  // are read with as few sectors as possible
+  void alignForRead(size_t size);
+  void addRecord(size_t hash, string_view k, string_view v, bool separated);
+  // compresses and writes records of _block, unless it's empty
+  void flushBlock();
+
+  // fills page p with its entries and hashes of neighbouring pages
+  void fillPage(size_t p, IndexPage &page) const;
+
+public:
+  DataFileWriter(string path, const DataFileWriteOptions &write_options,
+                 size_t filter_bits_per_key,
+                 const DataFileOpenOptions &open_options,
+                 size_t threads_num = 1, ValueSeparation separation = {});
+
+  // avoids regrowing index entries when number of records is known
+  void reserve(size_t entries_num) {
+    _entries.reserve(entries_num);
+    _hashes.reserve(entries_num);
+  }
+  void add(size_t hash, string_view k, string_view v);
+  // adds record pointing to a value already in log, which is kept alive by
+  // the written file
+  void add(size_t hash, string_view k, const ValuePointer &pointer,
+           shared_ptr<const ValueLog> log);
+  size_t entriesCount() const { return _entries.size(); }
+  // bytes of records written so far, with records of the unwritten block
+  size_t byteSize() const { return _offset + _block.size(); }
+  size_t peakMemory() const { return _peak_memory; }
+
+  // writes index, filter and footer, then opens the file for reading; with
+  // sync the file and its value log are durable before it's returned
+  shared_ptr<DataFileMetadata> finish(bool sync = false);
+};
+
+} // namespace humming::DB
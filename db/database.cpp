@@ -0,0 +1,244 @@
+#include "db/database.h"
+
+#include <bit>
+#include <fstream>
+
+using namespace std;
+
+namespace humming::DB {
+
+namespace {
+
+constexpr const char *k_shards_file = "SHARDS";
+
+// runs body(shard) for every shard on its own thread
+template <typename Body> void forEachShard(size_t shards_num, Body &&body) {
+  util::parallel::parallelFor(shards_num, shards_num,
+                              [&](size_t, size_t begin, size_t end) {
+                                for (size_t i = begin; i < end; ++i)
+                                  body(i);
+                              });
+}
+
+} // namespace
+
+Database::Database(DatabaseOptions options)
+    : _options(std::move(options)),
+      _shard_bits(std::countr_zero(_options._shards_num)) {
+  if (!std::has_single_bit(_options._shards_num) ||
+      _options._directories.empty()) {
+    PLOGE << "shards number " << _options._shards_num
+          << " is not a power of two or there are no directories";
+    abort();
+  }
+  if (!_options._numa_nodes.empty() &&
+      _options._numa_nodes.size() != _options._directories.size()) {
+    PLOGE << "NUMA nodes are given for " << _options._numa_nodes.size()
+          << " of " << _options._directories.size() << " directories";
+    abort();
+  }
+  checkShardsNum();
+  BucketOptions bucket_options = _options._bucket;
+  bucket_options._shared_hash_bits = _shard_bits;
+  bucket_options._write_threads = std::max<size_t>(
+      1, bucket_options._write_threads / _options._shards_num);
+  // shards already placed on every node, spreads them over its cores
+  vector<size_t> node_shards;
+  vector<BucketOptions> shard_options(_options._shards_num, bucket_options);
+  for (size_t i = 0; i < shard_options.size(); ++i) {
+    shard_options[i]._directory =
+        (std::filesystem::path(
+             _options._directories[i % _options._directories.size()]) /
+         ("shard-" + std::to_string(i)))
+            .string();
+    shard_options[i]._background_cpu = shardCpu(i, node_shards);
+  }
+  // shards recover their files independently
+  _shards.resize(_options._shards_num);
+  forEachShard(shardsNum(), [&](size_t i) {
+    _shards[i] = std::make_unique<Bucket>(shard_options[i]);
+  });
+}
+
+void Database::checkShardsNum() const {
+  std::error_code error;
+  std::filesystem::create_directories(_options._directories[0], error);
+  const std::string path =
+      (std::filesystem::path(_options._directories[0]) / k_shards_file)
+          .string();
+  size_t shards_num = 0;
+  if (std::ifstream in(path); in >> shards_num) {
+    if (shards_num != _options._shards_num) {
+      PLOGE << "database in " << _options._directories[0] << " has "
+            << shards_num << " shards, not " << _options._shards_num;
+      abort();
+    }
+    return;
+  }
+  std::ofstream out(path);
+  if (!(out << _options._shards_num << '\n')) {
+    PLOGE << "could not write " << path;
+    abort();
+  }
+}
+
+int Database::shardCpu(size_t shard, vector<size_t> &node_shards) const {
+  if (!_options._pin_threads)
+    return -1;
+  vector<size_t> cpus = util::parallel::allowedCpus();
+  size_t placed = shard;
+  if (!_options._numa_nodes.empty()) {
+    const int node =
+        _options._numa_nodes[shard % _options._directories.size()];
+    vector<size_t> node_cpus = util::parallel::numaNodeCpus(node);
+    std::erase_if(node_cpus, [&cpus](size_t cpu) {
+      return !std::binary_search(cpus.begin(), cpus.end(), cpu);
+    });
+    if (node_cpus.empty()) {
+      PLOGW << "no usable cpus of NUMA node " << node << ", shard " << shard
+            << " runs on any node";
+    } else {
+      if (node_shards.size() <= size_t(node))
+        node_shards.resize(node + 1);
+      placed = node_shards[node]++;
+      cpus.swap(node_cpus);
+    }
+  }
+  return cpus.empty() ? -1 : int(cpus[placed % cpus.size()]);
+}
+
+size_t Database::filesNum() const {
+  size_t files_num = 0;
+  for (const auto &shard : _shards)
+    files_num += shard->files()->size();
+  return files_num;
+}
+
+WriteMetrics Database::writeMetrics() const {
+  WriteMetrics metrics;
+  for (const auto &shard : _shards)
+    metrics.merge(shard->writeMetrics());
+  return metrics;
+}
+
+bool Database::insert(KVs &&kvs) {
+  // no shard writes its part unless every entry fits
+  if (!Bucket::fits(kvs))
+    return false;
+  vector<KVs> parts(shardsNum());
+  for (auto &kv : kvs)
+    parts[shardOf(kv._hash)].push_back(std::move(kv));
+  kvs.clear();
+  forEachShard(shardsNum(), [&](size_t i) {
+    if (!parts[i].empty())
+      _shards[i]->insert(std::move(parts[i]));
+  });
+  return true;
+}
+
+bool Database::insert(const KVBatch &batch) {
+  if (!Bucket::fits(batch))
+    return false;
+  // parts are views into the arena of batch, they only live for this call
+  vector<KVBatch> parts;
+  parts.reserve(shardsNum());
+  for (size_t i = 0; i < shardsNum(); ++i)
+    parts.emplace_back(0);
+  for (const auto &kv : batch)
+    parts[shardOf(kv._hash)].addView(kv);
+  forEachShard(shardsNum(), [&](size_t i) {
+    if (!parts[i].empty())
+      _shards[i]->insert(parts[i]);
+  });
+  return true;
+}
+
+bool Database::put(string k, string v) {
+  return _shards[shardOf(hashKey(k))]->put(std::move(k), std::move(v));
+}
+
+void Database::flush() {
+  forEachShard(shardsNum(), [this](size_t i) { _shards[i]->flush(); });
+}
+
+void Database::compact() {
+  forEachShard(shardsNum(), [this](size_t i) { _shards[i]->compact(); });
+}
+
+KVs Database::read(const string &k, ReadContext &context) {
+  return _shards[shardOf(hashKey(k))]->read(k, context);
+}
+
+size_t Database::read(string_view k, ReadContext &context, KVBatch &result) {
+  return _shards[shardOf(hashKey(k))]->read(k, context, result);
+}
+
+bool Database::get(string_view k, ReadContext &context, ValueHandle &handle) {
+  return _shards[shardOf(hashKey(k))]->get(k, context, handle);
+}
+
+bool Database::get(string_view k, ReadContext &context,
+                   const std::function<char *(size_t)> &buffer) {
+  return _shards[shardOf(hashKey(k))]->get(k, context, buffer);
+}
+
+vector<KVs> Database::multiGet(span<const string> keys,
+                               ReadContext &context) {
+  if (shardsNum() == 1)
+    return _shards[0]->multiGet(keys, context);
+  // key ids grouped by shard, group of shard i is [begins[i], begins[i + 1])
+  vector<size_t> shards(keys.size());
+  vector<size_t> begins(shardsNum() + 1);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    shards[i] = shardOf(hashKey(keys[i]));
+    ++begins[shards[i] + 1];
+  }
+  for (size_t i = 1; i < begins.size(); ++i)
+    begins[i] += begins[i - 1];
+  vector<size_t> ids(keys.size());
+  vector<string> grouped(keys.size());
+  vector<size_t> positions(begins.begin(), begins.end() - 1);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const size_t position = positions[shards[i]]++;
+    ids[position] = i;
+    grouped[position] = keys[i];
+  }
+  vector<KVs> results(keys.size());
+  for (size_t s = 0; s < shardsNum(); ++s) {
+    if (begins[s] == begins[s + 1])
+      continue;
+    auto shard_results = _shards[s]->multiGet(
+        span<const string>(grouped).subspan(begins[s],
+                                            begins[s + 1] - begins[s]),
+        context);
+    for (size_t j = 0; j < shard_results.size(); ++j)
+      results[ids[begins[s] + j]] = std::move(shard_results[j]);
+  }
+  return results;
+}
+
+Iterator Database::scan(const KeyRange &range, size_t buffer_size) {
+  // shards hold disjoint keys, so sources of all of them merge like sources
+  // of one shard
+  vector<unique_ptr<Iterator::Source>> sources;
+  for (const auto &shard : _shards)
+    shard->addScanSources(range, buffer_size, sources);
+  return Iterator(std::move(sources));
+}
+
+Database::BulkLoad::BulkLoad(Database &database, size_t run_byte_size)
+    : _database(database) {
+  for (size_t i = 0; i < database.shardsNum(); ++i)
+    _loads.push_back(std::make_unique<Bucket::BulkLoad>(
+        database.shard(i), run_byte_size / database.shardsNum()));
+}
+
+bool Database::BulkLoad::add(string_view k, string_view v) {
+  return _loads[_database.shardOf(hashKey(k))]->add(k, v);
+}
+
+void Database::BulkLoad::finish() {
+  forEachShard(_loads.size(), [this](size_t i) { _loads[i]->finish(); });
+}
+
+} // namespace humming::DB
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "db/bucket.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+struct DatabaseOptions {
+  // keys are routed to shards by top bits of their hash, must be a power of
+  // two and stay the same for the lifetime of the directories
+  size_t _shards_num = 4;
+  // shard i lives in _directories[i % _directories.size()], one directory per
+  // device spreads shards and their I/O over devices
+  vector<std::string> _directories = {"./humming/"};
+  // optional NUMA node of every directory's device, background threads of a
+  // shard then run on a core of that node
+  vector<int> _numa_nodes;
+  // pins background threads of every shard to its own core, cores are reused
+  // once there are more shards than cores
+  bool _pin_threads = true;
+  // options of every shard, _directory, _background_cpu and
+  // _shared_hash_bits are set per shard and _write_threads is divided
+  // between shards
+  BucketOptions _bucket;
+};
+
+// Keyspace partitioned into independent buckets. Every shard has its own
+// files, memtables and flush/compaction threads, point operations go to one
+// shard without any locking above it, so writes and reads of different
+// shards only share cores and devices.
+class Database {
+private:
+  DatabaseOptions _options;
+  size_t _shard_bits;
+  vector<unique_ptr<Bucket>> _shards;
+
+  // aborts if directories were created with a different number of shards
+  void checkShardsNum() const;
+  // cpu background threads of shard run on, -1 if they are not pinned
+  int shardCpu(size_t shard, vector<size_t> &node_shards) const;
+
+public:
+  explicit Database(DatabaseOptions options = {});
+
+  size_t shardsNum() const { return _shards.size(); }
+  size_t shardOf(size_t hash) const {
+    return _shard_bits == 0 ? 0 : hash >> (64 - _shard_bits);
+  }
+  Bucket &shard(size_t i) { return *_shards[i]; }
+  // total number of data files of all shards
+  size_t filesNum() const;
+  // write metrics of all shards merged, reads are recorded into their
+  // ReadContext
+  WriteMetrics writeMetrics() const;
+
+  // splits kvs by shard and writes every part into a new data file of its
+  // shard, shards are written in parallel; returns false and writes nothing
+  // unless every entry fits(), see Bucket::insert
+  bool insert(KVs &&kvs);
+  bool insert(const KVBatch &batch);
+  bool put(string k, string v);
+  // flushes and compacts all shards in parallel
+  void flush();
+  void compact();
+
+  KVs read(const string &k, ReadContext &context);
+  size_t read(string_view k, ReadContext &context, KVBatch &result);
+  bool get(string_view k, ReadContext &context, ValueHandle &handle);
+  bool get(string_view k, ReadContext &context,
+           const std::function<char *(size_t)> &buffer);
+  // keys are grouped by shard, every group is one Bucket::multiGet
+  vector<KVs> multiGet(span<const string> keys, ReadContext &context);
+  // scan of all shards merged by key, see Bucket::scan
+  Iterator scan(const KeyRange &range, size_t buffer_size = 256 << 10);
+
+  // Bulk load split into per shard loads, each holding runs of about
+  // run_byte_size / shardsNum() bytes.
+  class BulkLoad {
+  private:
+    Database &_database;
+    vector<unique_ptr<Bucket::BulkLoad>> _loads;
+
+  public:
+    explicit BulkLoad(Database &database,
+                      size_t run_byte_size = size_t(256) << 20);
+    bool add(string_view k, string_view v);
+    // finishes loads of all shards in parallel
+    void finish();
+  };
+};
+
+} // namespace humming::DB
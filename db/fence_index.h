@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "db/index_page.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// First and last hash of every IndexPage of a data file, kept in memory so a
+// lookup knows the only page that may hold a hash before doing any I/O. The
+// writer stores them in the tail of the file, so opening it doesn't read the
+// index pages.
+// Fences are stored in Eytzinger (BFS) order, so the top levels of the search
+// share cache lines and deeper levels can be prefetched.
+class FenceIndex {
+public:
+  struct Fence {
+    size_t _last;
+    size_t _first;
+  };
+
+private:
+  static constexpr size_t k_cache_line = 64;
+  struct FreeDeleter {
+    void operator()(void *p) const { free(p); }
+  };
+
+  size_t _pages_num = 0;
+  // 1-based, _fences[0] is unused
+  std::unique_ptr<Fence[], FreeDeleter> _fences;
+  // page id of every fence
+  std::unique_ptr<uint32_t[], FreeDeleter> _page_ids;
+
+  template <typename T> static T *allocate(size_t count) {
+    size_t bytes = (count * sizeof(T) + k_cache_line - 1) / k_cache_line *
+                   k_cache_line;
+    void *ptr = aligned_alloc(k_cache_line, bytes);
+    if (!ptr)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  size_t layout(const vector<Fence> &sorted, size_t i, size_t k) {
+    if (k <= _pages_num) {
+      i = layout(sorted, i, 2 * k);
+      _fences[k] = sorted[i];
+      _page_ids[k] = i;
+      i = layout(sorted, i + 1, 2 * k + 1);
+    }
+    return i;
+  }
+
+public:
+  FenceIndex() = default;
+  explicit FenceIndex(const vector<Fence> &sorted)
+      : _pages_num(sorted.size()), _fences(allocate<Fence>(_pages_num + 1)),
+        _page_ids(allocate<uint32_t>(_pages_num + 1)) {
+    layout(sorted, 0, 1);
+  }
+
+  bool empty() const { return _pages_num == 0; }
+  size_t pagesNum() const { return _pages_num; }
+
+  // Finds the first page whose last hash is >= hash. Returns false if no page
+  // can hold the hash, either because it's above all pages or falls between
+  // two of them.
+  bool find(size_t hash, size_t &page_id) const {
+    size_t k = 1;
+    while (k <= _pages_num) {
+      // 4 fences per cache line, fetch the line used two levels below
+      __builtin_prefetch(&_fences[k * 4]);
+      k = 2 * k + (_fences[k]._last < hash);
+    }
+    k >>= __builtin_ffsll(~k);
+    if (k == 0 || _fences[k]._first > hash)
+      return false;
+    page_id = _page_ids[k];
+    return true;
+  }
+};
+
+} // namespace humming::DB
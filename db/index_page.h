@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "util/io/common.h"
+#include "util/io/varint.h"
+
+namespace humming::DB {
+
+// Index entry as decoded from an IndexPage. Sizes of the key and value let a
+// reader skip records of other keys sharing the hash and read a matching
+// record with one exact size read. A record is varint key size, varint value
+// size, key and value, so the sizes also locate the key and value. Since
+// version 6 a record may hold a ValuePointer instead of its value, marked by
+// k_separated bit of _offset.
+struct IndexEntry {
+  static constexpr size_t k_separated = size_t(1) << 63;
+
+  size_t _offset; // use offset(), the top bit is k_separated
+  size_t _value_size;
+  uint32_t _key_size;
+
+  // bytes of sizes preceding key of a record
+  static size_t headerSize(size_t key_size, size_t value_size) {
+    return util::io::varintSize(key_size) + util::io::varintSize(value_size);
+  }
+  size_t headerSize() const { return headerSize(_key_size, _value_size); }
+  size_t offset() const { return _offset & ~k_separated; }
+  // value of the record is a pointer into a value log
+  bool separated() const { return (_offset & k_separated) != 0; }
+  // key of the record starts here, value follows it
+  size_t keyOffset() const { return offset() + headerSize(); }
+  size_t valueOffset() const { return keyOffset() + _key_size; }
+  // bytes from keyOffset() to the end of the record
+  size_t bodySize() const { return _key_size + _value_size; }
+  size_t recordSize() const { return headerSize() + bodySize(); }
+  bool mayHold(std::string_view k) const { return _key_size == k.size(); }
+};
+
+// Index page of format version 12. Entries are stored column by column, each
+// column starting a cache line, so a search touches only the hash column.
+// Hashes are kept as 32 bit differences from _first_hash shifted
+// right by _hash_shift, which is the smallest shift fitting the range of the
+// page. Entries of one truncated hash may thus have different hashes, a
+// reader tells them apart by the key of the record like entries of colliding
+// hashes. Record offsets have 39 bits, data files are below 512 GiB, and key
+// sizes 16 bits, so a page holds 256 entries of 15 bytes.
+struct IndexPage {
+  // number of hashes for preceding and following IndexPages.
+  static constexpr size_t k_hashes_num = 8;
+  static constexpr size_t k_cache_line = 64;
+  static constexpr size_t k_header_size = 3 * k_cache_line;
+  // bytes of one entry over all columns
+  static constexpr size_t k_entry_size =
+      3 * sizeof(uint32_t) + sizeof(uint16_t) + 1;
+  // number of entries in each index page, a multiple of 32 keeps every
+  // uint32_t and uint16_t column cache line aligned
+  static constexpr size_t k_entries_num =
+      (util::io::k_sector_size - k_header_size) / k_entry_size / 32 * 32;
+  static constexpr size_t k_max_offset = size_t(1) << 39;
+  static constexpr size_t k_max_key_size = UINT16_MAX;
+  // largest value whose record, even with the largest key, fits the uint32_t
+  // sizes of a value column and of a compressed block
+  static constexpr size_t k_max_value_size =
+      UINT32_MAX - k_max_key_size - 2 * util::io::k_max_varint_size;
+  static constexpr uint8_t k_separated_high = 0x80;
+
+  // first hash of each of previous k_hashes_num index pages
+  size_t _pre_hashes[k_hashes_num];
+  // last hash of each of following k_hashes_num index pages
+  size_t _post_hashes[k_hashes_num];
+  // hashes of the first and the last entry of this page
+  size_t _first_hash;
+  size_t _last_hash;
+  uint32_t _hash_shift;
+  // (hash - _first_hash) >> _hash_shift of every entry
+  alignas(k_cache_line) uint32_t _hashes[k_entries_num];
+  uint16_t _key_sizes[k_entries_num];
+  uint32_t _value_sizes[k_entries_num];
+  // low 32 bits of record offsets
+  uint32_t _offsets[k_entries_num];
+  // bits 32-38 of record offsets, k_separated_high for separated values
+  uint8_t _offsets_high[k_entries_num];
+  uint8_t _padding[util::io::k_sector_size - k_header_size -
+                   k_entries_num * k_entry_size];
+
+  static size_t pagesNum(size_t entries_num) {
+    return (entries_num + k_entries_num - 1) / k_entries_num;
+  }
+  // number of entries stored in page page_id of an index with entries_num
+  static size_t entriesInPage(size_t page_id, size_t entries_num) {
+    return std::min(k_entries_num, entries_num - page_id * k_entries_num);
+  }
+  // record of key_size and value_size bytes can be indexed
+  static bool fits(size_t key_size, size_t value_size) {
+    return key_size <= k_max_key_size && value_size <= k_max_value_size;
+  }
+  // entry can be stored in a page, sizes and offset fit their columns
+  static bool fits(size_t offset, size_t key_size, size_t value_size) {
+    return offset < k_max_offset && fits(key_size, value_size);
+  }
+
+  // sets range of hashes of the page before its entries are set
+  void setHashes(size_t first_hash, size_t last_hash) {
+    _first_hash = first_hash;
+    _last_hash = last_hash;
+    _hash_shift =
+        std::max<int>(std::bit_width(last_hash - first_hash), 32) - 32;
+  }
+  // hash within [_first_hash, _last_hash] as stored in _hashes
+  uint32_t truncate(size_t hash) const {
+    return uint32_t((hash - _first_hash) >> _hash_shift);
+  }
+  // entry i may have hash, it has if _hash_shift is 0
+  bool mayHaveHash(size_t i, size_t hash) const {
+    return hash >= _first_hash && hash <= _last_hash &&
+           _hashes[i] == truncate(hash);
+  }
+  void setEntry(size_t i, size_t hash, const IndexEntry &entry) {
+    _hashes[i] = truncate(hash);
+    _key_sizes[i] = uint16_t(entry._key_size);
+    _value_sizes[i] = uint32_t(entry._value_size);
+    _offsets[i] = uint32_t(entry.offset());
+    _offsets_high[i] = uint8_t(entry.offset() >> 32) |
+                       (entry.separated() ? k_separated_high : 0);
+  }
+  IndexEntry entry(size_t i) const {
+    const size_t high = _offsets_high[i] & ~k_separated_high;
+    const bool separated = (_offsets_high[i] & k_separated_high) != 0;
+    return {._offset = ((high << 32) | _offsets[i]) |
+                       (separated ? IndexEntry::k_separated : 0),
+            ._value_size = _value_sizes[i],
+            ._key_size = _key_sizes[i]};
+  }
+};
+
+static_assert(sizeof(IndexPage) == util::io::k_sector_size);
+static_assert(offsetof(IndexPage, _hashes) == IndexPage::k_header_size);
+static_assert(IndexPage::k_entries_num == 256);
+
+} // namespace humming::DB
@@ -0,0 +1,285 @@
+#include "db/iterator.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "db/data_file_scanner.h"
+#include "db/value_log.h"
+#include "plog/Log.h"
+
+namespace humming::DB {
+
+namespace {
+
+// records closer than this are read with one pread, the gap is cheaper to
+// read than to seek over
+constexpr size_t k_max_gap = 16 << 10;
+constexpr size_t k_max_span = 1 << 20;
+
+// reads value pointed to by encoded into out, aborts if it's broken
+void readSeparated(const DataFileMetadata &file_meta, string_view encoded,
+                   string &out) {
+  ValuePointer pointer;
+  const ValueLog *log = pointer.decode(encoded)
+                            ? file_meta.valueLog(pointer._log).get()
+                            : nullptr;
+  if (log)
+    out.resize(pointer._size);
+  if (!log || !log->read(pointer, out.data())) {
+    PLOGE << "broken value pointer in " << file_meta.path();
+    abort();
+  }
+}
+
+} // namespace
+
+Iterator::Iterator(vector<unique_ptr<Source>> sources)
+    : _sources(std::move(sources)) {
+  for (size_t i = 0; i < _sources.size(); ++i) {
+    if (_sources[i]->next())
+      _heap.push_back(i);
+  }
+  std::make_heap(_heap.begin(), _heap.end(),
+                 [this](size_t a, size_t b) { return after(a, b); });
+  settle();
+}
+
+bool Iterator::after(size_t a, size_t b) const {
+  const int order = _sources[a]->key().compare(_sources[b]->key());
+  return order > 0 || (order == 0 && a < b);
+}
+
+void Iterator::settle() {
+  if (!_heap.empty())
+    _key = _sources[_heap.front()]->key();
+}
+
+void Iterator::next() {
+  auto after = [this](size_t a, size_t b) { return this->after(a, b); };
+  // the current entry and every older version of its key
+  while (!_heap.empty() && _sources[_heap.front()]->key() == _key) {
+    std::pop_heap(_heap.begin(), _heap.end(), after);
+    const size_t source = _heap.back();
+    _heap.pop_back();
+    if (_sources[source]->next()) {
+      _heap.push_back(source);
+      std::push_heap(_heap.begin(), _heap.end(), after);
+    }
+  }
+  settle();
+}
+
+KeyIndexSource::KeyIndexSource(shared_ptr<const DataFileMetadata> file_meta,
+                               const KeyRange &range, size_t buffer_size)
+    : _file_meta(std::move(file_meta)), _range(range), _index(buffer_size),
+      _records(buffer_size),
+      _chunk(std::max(buffer_size, KeyIndex::k_block_size)) {
+  const KeyIndex &key_index = _file_meta->keyIndex();
+  const size_t start = key_index.seek(_range._begin);
+  _left = key_index.byteSize() - start;
+  // own descriptors, like scans of compaction
+  if (_index.open(_file_meta->path(), _file_meta->directIo()) == -1 ||
+      _records.open(_file_meta->path(), _file_meta->directIo()) == -1 ||
+      _index.seek(key_index.offset() + start) == -1) {
+    PLOGE << "could not open " << _file_meta->path() << " for scanning";
+    abort();
+  }
+}
+
+void KeyIndexSource::readChunk() {
+  const size_t kept = _chunk_size - _chunk_used;
+  memmove(_chunk.data(), _chunk.data() + _chunk_used, kept);
+  // an entry larger than the chunk
+  if (kept == _chunk.size())
+    _chunk.resize(2 * _chunk.size());
+  const size_t bytes = std::min(_left, _chunk.size() - kept);
+  if (_index.read(_chunk.data() + kept, bytes) != ssize_t(bytes)) {
+    PLOGE << "could not read key index of " << _file_meta->path();
+    abort();
+  }
+  _left -= bytes;
+  _chunk_size = kept + bytes;
+  _chunk_used = 0;
+  _entries.clear();
+  _position = 0;
+  _values_loaded = false;
+  const char *end = _chunk.data() + _chunk_size;
+  KeyIndexEntry entry;
+  while (size_t size = entry.decode(_chunk.data() + _chunk_used, end)) {
+    _chunk_used += size;
+    if (entry._k < _range._begin)
+      continue;
+    if (!_range.beforeEnd(entry._k)) {
+      _done = true;
+      break;
+    }
+    _entries.push_back(entry);
+  }
+  if (_left == 0 && !_done && _chunk_used < _chunk_size) {
+    PLOGE << "key index of " << _file_meta->path() << " is corrupted";
+    abort();
+  }
+}
+
+bool KeyIndexSource::next() {
+  if (_position < _entries.size()) {
+    ++_position;
+    return true;
+  }
+  while (!_done && (_left > 0 || _chunk_used < _chunk_size)) {
+    readChunk();
+    if (!_entries.empty()) {
+      _position = 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void KeyIndexSource::loadValues() {
+  vector<uint32_t> order(_entries.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return _entries[a]._offset < _entries[b]._offset;
+  });
+  _value_starts.resize(_entries.size());
+  size_t values_size = 0;
+  for (uint32_t i : order) {
+    _value_starts[i] = values_size;
+    values_size += _entries[i]._value_size;
+  }
+  _values.resize(values_size);
+  // offsets of records of a compressed file address their blocks, which are
+  // read whole and decompressed once for all values they hold
+  const DataBlocks &blocks = _file_meta->blocks();
+  auto record = [](const KeyIndexEntry &entry) -> IndexEntry {
+    return {._offset = entry._offset,
+            ._value_size = entry._value_size,
+            ._key_size = uint32_t(entry._k.size())};
+  };
+  auto stored = [&](const KeyIndexEntry &entry) -> pair<size_t, size_t> {
+    if (blocks.empty())
+      return {entry.valueOffset(), entry._value_size};
+    if (!blocks.holds(record(entry))) {
+      PLOGE << "key index of " << _file_meta->path()
+            << " does not match its blocks";
+      abort();
+    }
+    const BlockHandle &handle = blocks.handle(blocks.block(entry._offset));
+    return {handle._offset, handle._size};
+  };
+  for (size_t begin = 0; begin < order.size();) {
+    // values of neighbouring records are read with one pread
+    const auto [span_offset, first_size] = stored(_entries[order[begin]]);
+    size_t span_end = span_offset + first_size;
+    size_t end = begin + 1;
+    for (; end < order.size(); ++end) {
+      const auto [offset, size] = stored(_entries[order[end]]);
+      if (offset > span_end + k_max_gap ||
+          offset + size - span_offset > k_max_span)
+        break;
+      span_end = std::max(span_end, offset + size);
+    }
+    _span.resize(span_end - span_offset);
+    if (_records.pread(_span.data(), _span.size(), span_offset) !=
+        ssize_t(_span.size())) {
+      PLOGE << "could not read records of " << _file_meta->path();
+      abort();
+    }
+    size_t block = SIZE_MAX;
+    const char *records = nullptr;
+    for (size_t j = begin; j < end; ++j) {
+      const KeyIndexEntry &entry = _entries[order[j]];
+      const char *v;
+      if (blocks.empty()) {
+        v = _span.data() + entry.valueOffset() - span_offset;
+      } else {
+        const size_t b = blocks.block(entry._offset);
+        if (b != block) {
+          const BlockHandle &handle = blocks.handle(b);
+          _block.resize(handle._raw_size);
+          records = blocks.restore(
+              b, _span.data() + handle._offset - span_offset, _block.data());
+          block = b;
+        }
+        if (records == nullptr) {
+          PLOGE << "block of " << _file_meta->path() << " is corrupted";
+          abort();
+        }
+        v = records + blocks.keySlot(record(entry)) + entry._k.size();
+      }
+      memcpy(_values.data() + _value_starts[order[j]], v, entry._value_size);
+    }
+    begin = end;
+  }
+  _values_loaded = true;
+}
+
+string_view KeyIndexSource::value() {
+  if (!_values_loaded)
+    loadValues();
+  const KeyIndexEntry &entry = _entries[_position - 1];
+  const string_view v(_values.data() + _value_starts[_position - 1],
+                      entry._value_size);
+  if (!entry._separated)
+    return v;
+  readSeparated(*_file_meta, v, _separated_value);
+  return _separated_value;
+}
+
+MemTableSource::MemTableSource(shared_ptr<const MemTable> memtable,
+                               shared_ptr<const MemTable::Run> run,
+                               const KeyRange &range)
+    : _memtable(std::move(memtable)), _run(std::move(run)),
+      _end(range._end) {
+  _position = std::partition_point(_run->begin(), _run->end(),
+                                   [&range](const MemTable::OrderedEntry &e) {
+                                     return e._entry->first < range._begin;
+                                   }) -
+              _run->begin();
+}
+
+bool MemTableSource::next() {
+  if (_started)
+    ++_position;
+  _started = true;
+  return _position < _run->size() && (_end.empty() || key() < _end);
+}
+
+string_view MemTableSource::value() {
+  _memtable->visit((*_run)[_position],
+                   [this](const string &v) { _value.assign(v); });
+  return _value;
+}
+
+SortedSource::SortedSource(KVBatch &&entries)
+    : _entries(std::move(entries)), _order(_entries.size()) {
+  std::iota(_order.begin(), _order.end(), 0);
+  // of entries sharing a key the one added last comes first and wins
+  std::sort(_order.begin(), _order.end(), [&](uint32_t a, uint32_t b) {
+    const int order = _entries[a]._k.compare(_entries[b]._k);
+    return order < 0 || (order == 0 && a > b);
+  });
+}
+
+unique_ptr<SortedSource> SortedSource::scan(const DataFileMetadata &file_meta,
+                                            const KeyRange &range,
+                                            size_t buffer_size) {
+  KVBatch entries;
+  DataFileScanner scanner(file_meta, buffer_size);
+  string value;
+  while (scanner.next()) {
+    const KV &kv = scanner.current();
+    if (kv._k < range._begin || !range.beforeEnd(kv._k))
+      continue;
+    if (scanner.separated()) {
+      readSeparated(file_meta, kv._v, value);
+      entries.add(kv._k, value, kv._hash);
+    } else {
+      entries.add(kv._k, kv._v, kv._hash);
+    }
+  }
+  return std::make_unique<SortedSource>(std::move(entries));
+}
+
+} // namespace humming::DB
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db/data_file_metadata.h"
+#include "db/key_index.h"
+#include "db/kv_batch.h"
+#include "db/memtable.h"
+#include "util/io/buffered_file_input.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// keys k with _begin <= k < _end, empty _end has no upper bound
+struct KeyRange {
+  string _begin;
+  string _end;
+
+  // keys starting with prefix
+  static KeyRange prefix(string_view prefix) {
+    KeyRange range{._begin = string(prefix), ._end = string(prefix)};
+    // the first key past the prefix, there is none for a prefix of 0xff only
+    while (!range._end.empty() && uint8_t(range._end.back()) == 0xff)
+      range._end.pop_back();
+    if (!range._end.empty())
+      ++range._end.back();
+    return range;
+  }
+  bool beforeEnd(string_view k) const { return _end.empty() || k < _end; }
+};
+
+// Merges sources sorted by key into the newest value of every key, like
+// get() returns it. Sources are ordered oldest first, of equal keys the one
+// of the newest source wins. key() and value() are valid until next().
+class Iterator {
+public:
+  class Source {
+  public:
+    virtual ~Source() = default;
+    // moves to the next entry in range, the first call to the first one;
+    // returns false past the last one
+    virtual bool next() = 0;
+    virtual string_view key() const = 0;
+    virtual string_view value() = 0;
+  };
+
+private:
+  vector<unique_ptr<Source>> _sources;
+  // indices of sources that have an entry, the next key on top
+  vector<size_t> _heap;
+  string _key;
+
+  bool after(size_t a, size_t b) const;
+  // makes the top of the heap current
+  void settle();
+
+public:
+  explicit Iterator(vector<unique_ptr<Source>> sources);
+  Iterator(Iterator &&) = default;
+  Iterator &operator=(Iterator &&) = default;
+
+  bool valid() const { return !_heap.empty(); }
+  string_view key() const { return _key; }
+  string_view value() { return _sources[_heap.front()]->value(); }
+  // skips older versions of the current key
+  void next();
+};
+
+// Entries of a data file in range read through its key index. The index is
+// read sequentially from the block that may hold the first key on, with
+// readahead of the input buffer. Records lie in hash order, so values are
+// read only when asked for, for all entries of a chunk of the index at once,
+// sorted by offset and with records close to each other read together.
+class KeyIndexSource : public Iterator::Source {
+private:
+  shared_ptr<const DataFileMetadata> _file_meta;
+  KeyRange _range;
+  util::io::BufferedFileInput _index;
+  util::io::BufferedFileInput _records;
+  // bytes of the index not read yet
+  size_t _left;
+  bool _done = false;
+  // decoded entries point into _chunk, bytes past _chunk_used are the start
+  // of an entry cut by the end of the chunk
+  vector<char> _chunk;
+  size_t _chunk_size = 0;
+  size_t _chunk_used = 0;
+  vector<KeyIndexEntry> _entries;
+  size_t _position = 0;
+  // values of _entries once loaded, value i starts at _value_starts[i]
+  bool _values_loaded = false;
+  string _values;
+  vector<size_t> _value_starts;
+  vector<char> _span;
+  // decompressed block of a compressed file
+  vector<char> _block;
+  string _separated_value;
+
+  // decodes entries in range of the next chunk of the index
+  void readChunk();
+  void loadValues();
+
+public:
+  KeyIndexSource(shared_ptr<const DataFileMetadata> file_meta,
+                 const KeyRange &range, size_t buffer_size);
+  bool next() override;
+  string_view key() const override { return _entries[_position - 1]._k; }
+  string_view value() override;
+};
+
+// Entries of a memtable in range from one run of MemTable::keyOrder(),
+// starting at the first key of the range, so a short scan doesn't pay for
+// the whole memtable. Keys are those put before the run was taken, values are
+// copied once asked for, under the lock of their shard.
+class MemTableSource : public Iterator::Source {
+private:
+  shared_ptr<const MemTable> _memtable;
+  shared_ptr<const MemTable::Run> _run;
+  string _end;
+  size_t _position;
+  bool _started = false;
+  string _value;
+
+public:
+  MemTableSource(shared_ptr<const MemTable> memtable,
+                 shared_ptr<const MemTable::Run> run, const KeyRange &range);
+  bool next() override;
+  string_view key() const override {
+    return (*_run)[_position]._entry->first;
+  }
+  string_view value() override;
+};
+
+// Entries in range copied into memory and sorted, for data files without a
+// key index. Values are resolved when they are collected.
+class SortedSource : public Iterator::Source {
+private:
+  KVBatch _entries;
+  vector<uint32_t> _order;
+  size_t _position = 0;
+
+public:
+  // batch is filled by the caller and sorted here
+  explicit SortedSource(KVBatch &&entries);
+  // scans file whole in hash order and keeps entries in range
+  static unique_ptr<SortedSource> scan(const DataFileMetadata &file_meta,
+                                       const KeyRange &range,
+                                       size_t buffer_size);
+  bool next() override { return ++_position <= _order.size(); }
+  string_view key() const override {
+    return _entries[_order[_position - 1]]._k;
+  }
+  string_view value() override { return _entries[_order[_position - 1]]._v; }
+};
+
+} // namespace humming::DB
@@ -0,0 +1,266 @@
+#include "db/key_cache.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace humming::DB {
+
+namespace {
+
+constexpr size_t k_npos = ~size_t(0);
+constexpr uint64_t k_row_seeds[] = {
+    0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+    0xD6E8FEB86659FD93ull};
+// accounted per entry on top of key and value bytes, like in MemTable
+constexpr size_t k_entry_overhead = sizeof(string) + 64;
+
+} // namespace
+
+void KeyCache::FrequencySketch::init(size_t entries_num) {
+  _width_bits = std::bit_width(std::max<size_t>(entries_num, 64) - 1);
+  _counters.reset(new std::atomic<uint8_t>[k_rows << _width_bits]());
+  _sample_size = 10 * (size_t(1) << _width_bits);
+}
+
+size_t KeyCache::FrequencySketch::index(size_t hash, size_t row) const {
+  return (row << _width_bits) +
+         ((hash * k_row_seeds[row]) >> (64 - _width_bits));
+}
+
+void KeyCache::FrequencySketch::increment(size_t hash) {
+  bool added = false;
+  for (size_t row = 0; row < k_rows; ++row) {
+    auto &counter = _counters[index(hash, row)];
+    const uint8_t count = counter.load(std::memory_order_relaxed);
+    if (count < k_max_count) {
+      // increments racing with each other may be lost, counts are estimates
+      counter.store(count + 1, std::memory_order_relaxed);
+      added = true;
+    }
+  }
+  if (!added ||
+      _additions.fetch_add(1, std::memory_order_relaxed) + 1 < _sample_size)
+    return;
+  _additions.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < (k_rows << _width_bits); ++i)
+    _counters[i].store(_counters[i].load(std::memory_order_relaxed) / 2,
+                       std::memory_order_relaxed);
+}
+
+uint8_t KeyCache::FrequencySketch::estimate(size_t hash) const {
+  uint8_t count = k_max_count;
+  for (size_t row = 0; row < k_rows; ++row)
+    count = std::min(
+        count, _counters[index(hash, row)].load(std::memory_order_relaxed));
+  return count;
+}
+
+KeyCache::KeyCache(size_t budget_bytes, size_t shards_num,
+                   size_t expected_entry_size)
+    : _shards_num(shards_num), _shard_budget(budget_bytes / shards_num),
+      // window takes 1% like in W-TinyLFU, at least a few entries
+      _window_budget(std::min(
+          _shard_budget,
+          std::max(_shard_budget / 100, 4 * expected_entry_size))),
+      _shards(new Shard[shards_num]) {
+  const size_t entries_num =
+      std::max<size_t>(16, _shard_budget / expected_entry_size);
+  // at most half of slots are used
+  const size_t slots_num = std::bit_ceil(2 * entries_num);
+  _max_entries = slots_num / 2;
+  for (size_t i = 0; i < shards_num; ++i) {
+    Shard &s = _shards[i];
+    s._slots.reset(new std::atomic<shared_ptr<const Entry>>[slots_num]);
+    s._slots_mask = slots_num - 1;
+    s._sketch.init(_max_entries);
+  }
+}
+
+size_t KeyCache::findSlot(const Shard &shard, size_t hash,
+                          string_view k) const {
+  for (size_t i = home(shard, hash);; i = (i + 1) & shard._slots_mask) {
+    const auto entry = shard._slots[i].load(std::memory_order_relaxed);
+    if (!entry)
+      return k_npos;
+    if (entry->_hash == hash && entry->_k == k)
+      return i;
+  }
+}
+
+void KeyCache::insertEntry(Shard &shard, shared_ptr<const Entry> entry) {
+  size_t i = home(shard, entry->_hash);
+  while (shard._slots[i].load(std::memory_order_relaxed))
+    i = (i + 1) & shard._slots_mask;
+  shard._slots[i].store(std::move(entry), std::memory_order_release);
+  ++shard._entries_num;
+}
+
+void KeyCache::eraseSlot(Shard &shard, size_t slot) {
+  // entries after the hole that can't be found past it move into it; a
+  // lookup racing with the shift may miss an entry, never find a wrong one
+  for (size_t next = (slot + 1) & shard._slots_mask;;
+       next = (next + 1) & shard._slots_mask) {
+    auto entry = shard._slots[next].load(std::memory_order_relaxed);
+    if (!entry)
+      break;
+    const size_t entry_home = home(shard, entry->_hash);
+    const bool stays = slot <= next
+                           ? slot < entry_home && entry_home <= next
+                           : slot < entry_home || entry_home <= next;
+    if (stays)
+      continue;
+    shard._slots[slot].store(std::move(entry), std::memory_order_release);
+    slot = next;
+  }
+  shard._slots[slot].store(nullptr, std::memory_order_release);
+  --shard._entries_num;
+}
+
+void KeyCache::erase(Shard &shard, const Entry &entry) {
+  const size_t slot = findSlot(shard, entry._hash, entry._k);
+  if (slot != k_npos)
+    eraseSlot(shard, slot);
+  entry._removed = true;
+  (entry._in_window ? shard._window_bytes : shard._main_bytes) -=
+      entry._byte_size;
+}
+
+shared_ptr<const KeyCache::Entry> KeyCache::clockVictim(Shard &shard) {
+  const size_t slots_num = shard._slots_mask + 1;
+  for (size_t i = 0; i < 2 * slots_num; ++i) {
+    const size_t slot = shard._clock_hand;
+    shard._clock_hand = (slot + 1) & shard._slots_mask;
+    auto entry = shard._slots[slot].load(std::memory_order_relaxed);
+    if (!entry || entry->_in_window)
+      continue;
+    if (entry->_referenced.exchange(false, std::memory_order_relaxed))
+      continue;
+    return entry;
+  }
+  return nullptr;
+}
+
+void KeyCache::admitFromWindow(Shard &shard) {
+  while (!shard._window.empty() && shard._window.front()->_removed)
+    shard._window.pop_front();
+  if (shard._window.empty())
+    return;
+  const auto candidate = std::move(shard._window.front());
+  shard._window.pop_front();
+  shard._window_bytes -= candidate->_byte_size;
+  candidate->_in_window = false;
+  shard._main_bytes += candidate->_byte_size;
+  const size_t main_budget = _shard_budget - _window_budget;
+  if (shard._main_bytes <= main_budget)
+    return;
+  // candidate has to be more popular than what it would push out
+  const auto victim = clockVictim(shard);
+  if (victim && shard._sketch.estimate(candidate->_hash) <=
+                    shard._sketch.estimate(victim->_hash)) {
+    erase(shard, *candidate);
+    return;
+  }
+  candidate->_referenced.store(true, std::memory_order_relaxed);
+  while (shard._main_bytes > main_budget) {
+    const auto next = clockVictim(shard);
+    if (!next)
+      break;
+    erase(shard, *next);
+  }
+}
+
+void KeyCache::fill(size_t hash, string_view k, vector<string> &&values,
+                    bool all_versions, uint64_t ticket) {
+  size_t byte_size = k_entry_overhead + k.size();
+  for (const auto &v : values)
+    byte_size += sizeof(string) + v.size();
+  // an entry must not push out a large part of its shard at once
+  if (values.empty() || byte_size > _window_budget)
+    return;
+  auto entry = std::make_shared<Entry>();
+  entry->_hash = hash;
+  entry->_k = k;
+  entry->_values = std::move(values);
+  entry->_all_versions = all_versions;
+  entry->_byte_size = byte_size;
+  Shard &s = shard(hash);
+  std::lock_guard lock(s._mutex);
+  if (version(s, hash).load(std::memory_order_relaxed) != ticket)
+    return;
+  if (const size_t slot = findSlot(s, hash, k); slot != k_npos)
+    erase(s, *s._slots[slot].load(std::memory_order_relaxed));
+  s._window_bytes += byte_size;
+  s._window.push_back(entry);
+  insertEntry(s, std::move(entry));
+  while (s._window_bytes > _window_budget)
+    admitFromWindow(s);
+  while (s._entries_num > _max_entries) {
+    if (const auto victim = clockVictim(s))
+      erase(s, *victim);
+    else
+      admitFromWindow(s);
+  }
+}
+
+void KeyCache::invalidate(size_t hash, string_view k) {
+  Shard &s = shard(hash);
+  std::lock_guard lock(s._mutex);
+  version(s, hash).fetch_add(1, std::memory_order_release);
+  if (const size_t slot = findSlot(s, hash, k); slot != k_npos)
+    erase(s, *s._slots[slot].load(std::memory_order_relaxed));
+}
+
+void KeyCache::clear() {
+  for (size_t i = 0; i < _shards_num; ++i) {
+    Shard &s = _shards[i];
+    std::lock_guard lock(s._mutex);
+    for (auto &version : s._versions)
+      version.fetch_add(1, std::memory_order_release);
+    for (size_t slot = 0; slot <= s._slots_mask; ++slot)
+      s._slots[slot].store(nullptr, std::memory_order_release);
+    s._window.clear();
+    s._window_bytes = s._main_bytes = s._entries_num = 0;
+  }
+}
+
+size_t KeyCache::hits() const {
+  size_t hits = 0;
+  for (size_t i = 0; i < _shards_num; ++i)
+    hits += _shards[i]._hits.load(std::memory_order_relaxed);
+  return hits;
+}
+
+size_t KeyCache::misses() const {
+  size_t misses = 0;
+  for (size_t i = 0; i < _shards_num; ++i)
+    misses += _shards[i]._misses.load(std::memory_order_relaxed);
+  return misses;
+}
+
+double KeyCache::hitRatio() const {
+  const size_t lookups = hits() + misses();
+  return lookups == 0 ? 0 : double(hits()) / lookups;
+}
+
+size_t KeyCache::entriesNum() const {
+  size_t entries_num = 0;
+  for (size_t i = 0; i < _shards_num; ++i) {
+    std::lock_guard lock(_shards[i]._mutex);
+    entries_num += _shards[i]._entries_num;
+  }
+  return entries_num;
+}
+
+size_t KeyCache::byteSize() const {
+  size_t byte_size = 0;
+  for (size_t i = 0; i < _shards_num; ++i) {
+    Shard &s = _shards[i];
+    std::lock_guard lock(s._mutex);
+    byte_size += s._window_bytes + s._main_bytes +
+                 (s._slots_mask + 1) * sizeof(s._slots[0]) +
+                 s._sketch.byteSize();
+  }
+  return byte_size;
+}
+
+} // namespace humming::DB
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace humming::DB {
+
+// Memory bounded cache of key -> values in front of buckets, for skewed
+// reads where a few keys take most of the lookups. Entries hold either every
+// version of a key, as read() returns them, or only the newest one found by
+// get(). The cache is split into shards, each an open addressing table of
+// atomic pointers to immutable entries, so lookups take no lock; fills,
+// invalidations and evictions lock their shard.
+//
+// Admission follows W-TinyLFU: new entries go to a small FIFO window, an
+// entry leaving the window enters the main region only if a count-min sketch
+// of recent accesses estimates it more popular than the CLOCK victim of the
+// main region. A shared cache must only be used by buckets of disjoint
+// keyspaces, like shards of a Database.
+class KeyCache {
+private:
+  struct Entry {
+    size_t _hash;
+    string _k;
+    vector<string> _values; // oldest first
+    bool _all_versions;
+    size_t _byte_size;
+    // set by lookups, cleared by the CLOCK hand
+    mutable std::atomic<bool> _referenced{false};
+    // changed only under the shard lock
+    mutable bool _in_window = true;
+    mutable bool _removed = false;
+  };
+
+  // counters saturating at 15 in 4 rows, halved every _sample_size
+  // increments so old popularity fades
+  class FrequencySketch {
+  private:
+    static constexpr size_t k_rows = 4;
+    static constexpr uint8_t k_max_count = 15;
+    std::unique_ptr<std::atomic<uint8_t>[]> _counters;
+    size_t _width_bits = 0;
+    size_t _sample_size = 0;
+    std::atomic<size_t> _additions{0};
+
+    size_t index(size_t hash, size_t row) const;
+
+  public:
+    void init(size_t entries_num);
+    // hot keys saturate their counters and stop writing to them
+    void increment(size_t hash);
+    uint8_t estimate(size_t hash) const;
+    size_t byteSize() const { return k_rows << _width_bits; }
+  };
+
+  // fills started before an invalidation of the same slot are dropped
+  static constexpr size_t k_versions_num = 256;
+
+  struct alignas(64) Shard {
+    std::mutex _mutex;
+    std::unique_ptr<std::atomic<shared_ptr<const Entry>>[]> _slots;
+    size_t _slots_mask = 0;
+    size_t _clock_hand = 0;
+    std::deque<shared_ptr<const Entry>> _window;
+    size_t _window_bytes = 0;
+    size_t _main_bytes = 0;
+    size_t _entries_num = 0;
+    std::array<std::atomic<uint64_t>, k_versions_num> _versions{};
+    FrequencySketch _sketch;
+    std::atomic<size_t> _hits{0};
+    std::atomic<size_t> _misses{0};
+  };
+
+  size_t _shards_num;
+  size_t _shard_budget;
+  size_t _window_budget;
+  size_t _max_entries; // per shard, keeps probe sequences short
+  std::unique_ptr<Shard[]> _shards;
+
+  Shard &shard(size_t hash) const { return _shards[hash % _shards_num]; }
+  size_t home(const Shard &shard, size_t hash) const {
+    return (hash >> 16) & shard._slots_mask;
+  }
+  static std::atomic<uint64_t> &version(Shard &shard, size_t hash) {
+    return shard._versions[(hash >> 8) % k_versions_num];
+  }
+
+  // slot of live entry of k, requires shard lock; npos if there is none
+  size_t findSlot(const Shard &shard, size_t hash, string_view k) const;
+  void insertEntry(Shard &shard, shared_ptr<const Entry> entry);
+  // removes entry at slot, shifting back entries of its probe sequence
+  void eraseSlot(Shard &shard, size_t slot);
+  void erase(Shard &shard, const Entry &entry);
+  // unreferenced entry of the main region, nullptr if there is none
+  shared_ptr<const Entry> clockVictim(Shard &shard);
+  // moves oldest window entry into the main region or drops it
+  void admitFromWindow(Shard &shard);
+
+public:
+  // budget_bytes bounds keys, values and bookkeeping of entries; tables are
+  // sized for entries of about expected_entry_size bytes
+  explicit KeyCache(size_t budget_bytes, size_t shards_num = 16,
+                    size_t expected_entry_size = 256);
+  KeyCache(const KeyCache &) = delete;
+  KeyCache &operator=(const KeyCache &) = delete;
+
+  // Calls visit(span<const string> values) with cached values of k, oldest
+  // first, and returns true on a hit. Entries with only the newest value
+  // don't match lookups asking for all_versions.
+  template <typename Visit>
+  bool find(size_t hash, string_view k, bool all_versions, Visit &&visit) {
+    Shard &s = shard(hash);
+    s._sketch.increment(hash);
+    for (size_t i = home(s, hash), probes = 0; probes <= s._slots_mask;
+         i = (i + 1) & s._slots_mask, ++probes) {
+      const auto entry = s._slots[i].load(std::memory_order_acquire);
+      if (!entry)
+        break;
+      if (entry->_hash != hash || entry->_k != k)
+        continue;
+      if (all_versions && !entry->_all_versions)
+        break;
+      if (!entry->_referenced.load(std::memory_order_relaxed))
+        entry->_referenced.store(true, std::memory_order_relaxed);
+      s._hits.fetch_add(1, std::memory_order_relaxed);
+      visit(span<const string>(entry->_values));
+      return true;
+    }
+    s._misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  // taken before reading k from the bucket and passed to fill()
+  uint64_t ticket(size_t hash) const {
+    return version(shard(hash), hash).load(std::memory_order_acquire);
+  }
+  // Caches values of k read since ticket was taken, unless k was
+  // invalidated meanwhile or the entry is too large.
+  void fill(size_t hash, string_view k, vector<string> &&values,
+            bool all_versions, uint64_t ticket);
+  // drops k, called once a write of k is visible to readers
+  void invalidate(size_t hash, string_view k);
+  void clear();
+
+  // most entries the cache holds, writes of more keys are cheaper to handle
+  // by clear()
+  size_t capacity() const { return _max_entries * _shards_num; }
+  size_t hits() const;
+  size_t misses() const;
+  double hitRatio() const;
+  size_t entriesNum() const;
+  // memory of entries, tables and sketches
+  size_t byteSize() const;
+};
+
+} // namespace humming::DB
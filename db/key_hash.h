@@ -0,0 +1,133 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+using namespace std;
+
+// The key hash orders records of data files and picks shards of a Database,
+// so it's part of the file format: HUMMING_STD_KEY_HASH and
+// HUMMING_KEY_HASH_SEED choose it at compile time, and data files record
+// which one wrote them.
+#ifndef HUMMING_KEY_HASH_SEED
+#define HUMMING_KEY_HASH_SEED 0
+#endif
+
+namespace humming::DB {
+
+// std::hash of the standard library, only stable for one toolchain and not
+// seeded; for directories written before the hash was recorded
+struct StdKeyHash {
+  static constexpr uint64_t k_id = 1;
+
+  static uint64_t hash(string_view k, uint64_t) {
+    return std::hash<string_view>()(k);
+  }
+};
+
+// Hash of the wyhash family: 64x64->128 bit multiplications fold 48 bytes
+// per round in three independent lanes, short keys take a single round.
+// Words are read as little endian, so output is identical on every platform
+// with 128 bit multiplication.
+struct WyKeyHash {
+  static constexpr uint64_t k_id = 2;
+
+private:
+  static constexpr uint64_t k_secret[4] = {
+      0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+      0x4d5a2da51de1aa47ull};
+
+  static void multiply(uint64_t &a, uint64_t &b) {
+    const __uint128_t r = __uint128_t(a) * b;
+    a = uint64_t(r);
+    b = uint64_t(r >> 64);
+  }
+  static uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(a, b);
+    return a ^ b;
+  }
+  static uint64_t read8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big)
+      v = __builtin_bswap64(v);
+    return v;
+  }
+  static uint64_t read4(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big)
+      v = __builtin_bswap32(v);
+    return v;
+  }
+  // 1 to 3 bytes
+  static uint64_t read3(const char *p, size_t size) {
+    return uint64_t(uint8_t(p[0])) << 16 |
+           uint64_t(uint8_t(p[size >> 1])) << 8 | uint8_t(p[size - 1]);
+  }
+
+public:
+  static uint64_t hash(string_view k, uint64_t seed) {
+    const char *p = k.data();
+    const size_t size = k.size();
+    seed ^= mix(seed ^ k_secret[0], k_secret[1]);
+    uint64_t a, b;
+    if (size <= 16) {
+      if (size >= 4) {
+        // two overlapping reads cover 4 to 16 bytes
+        const size_t shift = (size >> 3) << 2;
+        a = read4(p) << 32 | read4(p + shift);
+        b = read4(p + size - 4) << 32 | read4(p + size - 4 - shift);
+      } else if (size > 0) {
+        a = read3(p, size);
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      size_t left = size;
+      if (left >= 48) {
+        uint64_t lane1 = seed, lane2 = seed;
+        do {
+          seed = mix(read8(p) ^ k_secret[1], read8(p + 8) ^ seed);
+          lane1 = mix(read8(p + 16) ^ k_secret[2], read8(p + 24) ^ lane1);
+          lane2 = mix(read8(p + 32) ^ k_secret[3], read8(p + 40) ^ lane2);
+          p += 48;
+          left -= 48;
+        } while (left >= 48);
+        seed ^= lane1 ^ lane2;
+      }
+      for (; left > 16; left -= 16, p += 16)
+        seed = mix(read8(p) ^ k_secret[1], read8(p + 8) ^ seed);
+      // the last 16 bytes, overlapping the previous round
+      a = read8(p + left - 16);
+      b = read8(p + left - 8);
+    }
+    a ^= k_secret[1];
+    b ^= seed;
+    multiply(a, b);
+    return mix(a ^ k_secret[0] ^ size, b ^ k_secret[1]);
+  }
+};
+
+#ifdef HUMMING_STD_KEY_HASH
+using KeyHash = StdKeyHash;
+#else
+using KeyHash = WyKeyHash;
+#endif
+inline constexpr uint64_t k_key_hash_seed = HUMMING_KEY_HASH_SEED;
+
+// hash records of k are ordered by
+inline size_t hashKey(string_view k) {
+  return KeyHash::hash(k, k_key_hash_seed);
+}
+
+// hashKey() as a function object, e.g. for hash tables keyed by strings
+struct KeyHasher {
+  size_t operator()(string_view k) const { return hashKey(k); }
+};
+
+} // namespace humming::DB
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/io/varint.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Entry of the key ordered index of a data file. Records stay in hash order
+// for point lookups, the key index lists them once more sorted by key, so a
+// scan of a key range reads the index sequentially and only the values it
+// needs. Encoded as varint key size, varint value size, varint of record
+// offset shifted left by one with the separated flag in the lowest bit, and
+// the key.
+struct KeyIndexEntry {
+  static constexpr size_t k_max_header_size = 3 * util::io::k_max_varint_size;
+
+  string_view _k;
+  size_t _value_size;
+  size_t _offset; // of the record
+  bool _separated;
+
+  size_t valueOffset() const {
+    return _offset + util::io::varintSize(_k.size()) +
+           util::io::varintSize(_value_size) + _k.size();
+  }
+  size_t encode(char *out) const {
+    size_t size = util::io::encodeVarint(out, _k.size());
+    size += util::io::encodeVarint(out + size, _value_size);
+    size += util::io::encodeVarint(out + size, _offset << 1 | _separated);
+    memcpy(out + size, _k.data(), _k.size());
+    return size + _k.size();
+  }
+  // returns size of entry at data, 0 if it doesn't fit before end; _k points
+  // into data
+  size_t decode(const char *data, const char *end) {
+    uint64_t key_size, offset;
+    size_t size = util::io::decodeVarint(data, end, key_size);
+    size_t bytes;
+    if (size == 0 ||
+        (bytes = util::io::decodeVarint(data + size, end, _value_size)) == 0)
+      return 0;
+    size += bytes;
+    if ((bytes = util::io::decodeVarint(data + size, end, offset)) == 0 ||
+        size_t(end - data) < size + bytes + key_size)
+      return 0;
+    size += bytes;
+    _offset = offset >> 1;
+    _separated = offset & 1;
+    _k = string_view(data + size, key_size);
+    return size + key_size;
+  }
+};
+
+// First key of every block of about k_block_size bytes of the key index,
+// kept in memory so a scan starts reading at the only block that may hold
+// its first key. Stored as varint block offset, varint key size and key for
+// every block.
+class KeyIndex {
+private:
+  size_t _offset = 0; // of the index in the data file
+  size_t _byte_size = 0;
+  vector<string> _first_keys;
+  vector<size_t> _block_offsets; // from _offset
+
+public:
+  static constexpr size_t k_block_size = 4096;
+
+  // no key index, the file has to be scanned whole
+  KeyIndex() = default;
+  // restores fences written by KeyIndexBuilder, empty if they are corrupted
+  KeyIndex(size_t offset, size_t byte_size, const char *fences,
+           size_t fences_size)
+      : _offset(offset), _byte_size(byte_size) {
+    const char *end = fences + fences_size;
+    while (fences < end) {
+      uint64_t block_offset, key_size;
+      size_t size = util::io::decodeVarint(fences, end, block_offset);
+      size_t bytes;
+      if (size == 0 ||
+          (bytes = util::io::decodeVarint(fences + size, end, key_size)) ==
+              0 ||
+          size_t(end - fences) < size + bytes + key_size) {
+        *this = {};
+        return;
+      }
+      size += bytes;
+      _block_offsets.push_back(block_offset);
+      _first_keys.emplace_back(fences + size, key_size);
+      fences += size + key_size;
+    }
+  }
+
+  bool empty() const { return _byte_size == 0; }
+  size_t offset() const { return _offset; }
+  size_t byteSize() const { return _byte_size; }
+  size_t blocksNum() const { return _first_keys.size(); }
+  // memory of fences
+  size_t memorySize() const {
+    size_t size = _block_offsets.size() * sizeof(size_t);
+    for (const auto &k : _first_keys)
+      size += sizeof(string) + k.size();
+    return size;
+  }
+
+  // offset from offset() of the block to start a scan of keys >= k at
+  size_t seek(string_view k) const {
+    const auto it =
+        std::upper_bound(_first_keys.begin(), _first_keys.end(), k);
+    return it == _first_keys.begin()
+               ? 0
+               : _block_offsets[it - _first_keys.begin() - 1];
+  }
+};
+
+// Collects keys of records added to a data file writer and writes them
+// sorted as the key index. Keys are copied into one buffer, which is the
+// memory cost of the index while the file is written.
+class KeyIndexBuilder {
+private:
+  struct Entry {
+    size_t _key_offset; // in _keys
+    size_t _key_size;
+    size_t _value_size;
+    size_t _offset;
+    bool _separated;
+  };
+  string _keys;
+  vector<Entry> _entries;
+
+  string_view key(const Entry &entry) const {
+    return string_view(_keys).substr(entry._key_offset, entry._key_size);
+  }
+
+public:
+  void add(string_view k, size_t value_size, size_t offset, bool separated) {
+    _entries.push_back({._key_offset = _keys.size(),
+                        ._key_size = k.size(),
+                        ._value_size = value_size,
+                        ._offset = offset,
+                        ._separated = separated});
+    _keys.append(k);
+  }
+  size_t memorySize() const {
+    return _keys.capacity() + _entries.capacity() * sizeof(Entry);
+  }
+
+  // Sorts entries by key and passes the index to write(const char *, size_t)
+  // in chunks, returns its size and sets fences of its blocks. Of records
+  // sharing a key only the last one added is indexed.
+  template <typename Write>
+  size_t finish(Write &&write, string &fences) {
+    vector<uint32_t> order(_entries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return key(_entries[a]) < key(_entries[b]);
+    });
+    string block;
+    size_t byte_size = 0;
+    char header[2 * util::io::k_max_varint_size];
+    for (size_t i = 0; i < order.size(); ++i) {
+      const Entry &entry = _entries[order[i]];
+      if (i + 1 < order.size() &&
+          key(_entries[order[i + 1]]) == key(entry))
+        continue;
+      if (block.empty()) {
+        size_t size = util::io::encodeVarint(header, byte_size);
+        size += util::io::encodeVarint(header + size, entry._key_size);
+        fences.append(header, size);
+        fences.append(key(entry));
+      }
+      const size_t size = block.size();
+      block.resize(size + KeyIndexEntry::k_max_header_size + entry._key_size);
+      block.resize(size + KeyIndexEntry{._k = key(entry),
+                                        ._value_size = entry._value_size,
+                                        ._offset = entry._offset,
+                                        ._separated = entry._separated}
+                              .encode(block.data() + size));
+      if (block.size() >= KeyIndex::k_block_size) {
+        write(block.data(), block.size());
+        byte_size += block.size();
+        block.clear();
+      }
+    }
+    write(block.data(), block.size());
+    byte_size += block.size();
+    _keys = {};
+    _entries = {};
+    return byte_size;
+  }
+};
+
+} // namespace humming::DB
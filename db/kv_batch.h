@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "db/key_hash.h"
+#include "util/memory/arena.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+struct KVView {
+  string_view _k;
+  string_view _v;
+  size_t _hash;
+};
+
+// Entries whose keys and values are stored back to back in an arena, so
+// building a batch costs a heap allocation per arena chunk instead of two per
+// entry. clear() keeps the memory, a batch reused by a reader doesn't allocate
+// once it has grown.
+class KVBatch {
+private:
+  util::memory::Arena _arena;
+  vector<KVView> _entries;
+
+public:
+  explicit KVBatch(size_t chunk_size = 1 << 20) : _arena(chunk_size) {}
+
+  void add(string_view k, string_view v) { add(k, v, hashKey(k)); }
+  void add(string_view k, string_view v, size_t hash) {
+    _entries.push_back(
+        {._k = _arena.copy(k), ._v = _arena.copy(v), ._hash = hash});
+  }
+  // adds entry whose key and value already live in arena()
+  void addView(const KVView &view) { _entries.push_back(view); }
+
+  util::memory::Arena &arena() { return _arena; }
+  void reserve(size_t entries_num) { _entries.reserve(entries_num); }
+  void clear() {
+    _entries.clear();
+    _arena.clear();
+  }
+
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+  // bytes of keys, values and entries held by the batch
+  size_t byteSize() const {
+    return _arena.allocatedBytes() + _entries.size() * sizeof(KVView);
+  }
+  const KVView &operator[](size_t i) const { return _entries[i]; }
+  const KVView &back() const { return _entries.back(); }
+  vector<KVView>::const_iterator begin() const { return _entries.begin(); }
+  vector<KVView>::const_iterator end() const { return _entries.end(); }
+};
+
+} // namespace humming::DB
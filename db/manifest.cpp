@@ -0,0 +1,106 @@
+#include "db/manifest.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <unordered_set>
+
+#include "plog/Log.h"
+
+namespace humming::DB {
+
+namespace {
+
+// record keys, values are lines of text:
+// snapshot: "<name> <level>" per file, oldest first
+// edit: "- <name>" per removed file, then "+ <position> <name> <level>" per
+// added one by ascending position, then "= <name> <level>" per moved one
+constexpr string_view k_snapshot = "snapshot";
+constexpr string_view k_edit = "edit";
+
+string fileName(const DataFileMetadata &file_meta) {
+  return std::filesystem::path(file_meta.path()).filename().string();
+}
+
+} // namespace
+
+Manifest::Manifest(string path, const DataFiles &files)
+    : _log(std::make_unique<WriteAheadLog>(std::move(path), 1 << 16)) {
+  std::ostringstream snapshot;
+  for (const auto &file_meta : files) {
+    snapshot << fileName(*file_meta) << ' ' << file_meta->level() << '\n';
+    _levels[file_meta->id()] = file_meta->level();
+  }
+  _log->sync(_log->append(k_snapshot, snapshot.str()));
+}
+
+void Manifest::record(const DataFiles &before, const DataFiles &after) {
+  std::unordered_set<uint64_t> kept;
+  for (const auto &file_meta : after)
+    kept.insert(file_meta->id());
+  std::ostringstream edit;
+  for (const auto &file_meta : before) {
+    if (kept.count(file_meta->id()) == 0) {
+      edit << "- " << fileName(*file_meta) << '\n';
+      _levels.erase(file_meta->id());
+    }
+  }
+  std::ostringstream moved;
+  for (size_t i = 0; i < after.size(); ++i) {
+    const auto &file_meta = *after[i];
+    auto it = _levels.find(file_meta.id());
+    if (it == _levels.end()) {
+      edit << "+ " << i << ' ' << fileName(file_meta) << ' '
+           << file_meta.level() << '\n';
+      _levels.emplace(file_meta.id(), file_meta.level());
+    } else if (it->second != file_meta.level()) {
+      moved << "= " << fileName(file_meta) << ' ' << file_meta.level()
+            << '\n';
+      it->second = file_meta.level();
+    }
+  }
+  edit << moved.str();
+  _log->sync(_log->append(k_edit, edit.str()));
+  ++_edits_num;
+}
+
+bool Manifest::replay(const string &path, vector<FileEntry> &files) {
+  files.clear();
+  bool has_snapshot = false;
+  auto find = [&files](const string &name) {
+    return std::find_if(files.begin(), files.end(), [&name](const auto &f) {
+      return f._name == name;
+    });
+  };
+  WriteAheadLog::replay(path, [&](string &&k, string &&v) {
+    std::istringstream lines(v);
+    if (k == k_snapshot && !has_snapshot) {
+      has_snapshot = true;
+      FileEntry file;
+      while (lines >> file._name >> file._level)
+        files.push_back(file);
+      return;
+    }
+    if (k != k_edit || !has_snapshot)
+      return;
+    char op;
+    while (lines >> op) {
+      FileEntry file;
+      size_t position = 0;
+      if (op == '-' && lines >> file._name) {
+        if (auto it = find(file._name); it != files.end())
+          files.erase(it);
+      } else if (op == '+' && lines >> position >> file._name >> file._level) {
+        files.insert(files.begin() + std::min(position, files.size()), file);
+      } else if (op == '=' && lines >> file._name >> file._level) {
+        if (auto it = find(file._name); it != files.end())
+          it->_level = file._level;
+      }
+    }
+  });
+  if (!has_snapshot)
+    files.clear();
+  return has_snapshot;
+}
+
+} // namespace humming::DB
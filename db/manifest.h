@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "db/data_file_metadata.h"
+#include "db/wal.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Append-only log of changes to the file set of a bucket, replayed on open
+// instead of looking into data files. A manifest starts with a snapshot of
+// the whole set, every publish appends one edit: removed files, added ones
+// with their position and files that moved to another level. Snapshot and
+// edits are single log records, so an edit torn by a crash is dropped as a
+// whole. Edits are durable once record() returns.
+class Manifest {
+public:
+  struct FileEntry {
+    string _name; // file name within the bucket directory
+    size_t _level;
+  };
+
+private:
+  unique_ptr<WriteAheadLog> _log;
+  // level of every file of the set as recorded, keyed by metadata id
+  unordered_map<uint64_t, size_t> _levels;
+  size_t _edits_num = 0;
+
+public:
+  // starts a new manifest at path with a snapshot of files
+  Manifest(string path, const DataFiles &files);
+
+  const string &path() const { return _log->path(); }
+  // edits appended since the snapshot
+  size_t editsNum() const { return _edits_num; }
+
+  // records the change of file set from before to after
+  void record(const DataFiles &before, const DataFiles &after);
+
+  // Replays snapshot and edits of the manifest at path into files, oldest
+  // first. Returns false if the manifest doesn't start with a complete
+  // snapshot, e.g. a crash interrupted writing of it.
+  static bool replay(const string &path, vector<FileEntry> &files);
+};
+
+} // namespace humming::DB
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "db/kv_batch.h"
+#include "db/wal.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// In-memory buffer of the newest puts, a hash table split into independently
+// locked shards. Once full it's frozen and flushed into a data file, frozen
+// memtables are only read. Scans ask for keys in key order, which is kept
+// from the first scan on in sorted runs of pointers to entries, see
+// keyOrder().
+class MemTable {
+public:
+  using Entry = pair<const string, string>;
+  // entry of a shard, nodes of a shard never move, also on rehash
+  struct OrderedEntry {
+    const Entry *_entry;
+    size_t _shard;
+  };
+  using Run = vector<OrderedEntry>;
+
+private:
+  static constexpr size_t k_shards_num = 64;
+  // accounted per entry on top of key and value bytes
+  static constexpr size_t k_entry_overhead = 64;
+
+  // allows lookups by string_view without building a string
+  struct Hasher : KeyHasher {
+    using is_transparent = void;
+  };
+  struct alignas(64) Shard {
+    mutable std::shared_mutex _mutex;
+    unordered_map<string, string, Hasher, std::equal_to<>> _map;
+    // entries are in runs of keyOrder(), keys put since are in _new_keys
+    mutable bool _ordered = false;
+    mutable vector<const Entry *> _new_keys;
+  };
+
+  std::array<Shard, k_shards_num> _shards;
+  std::atomic<size_t> _byte_size{0};
+  // id of the data file a flush published the entries in
+  std::atomic<uint64_t> _flushed_file{k_not_flushed};
+  // log holding puts of this memtable, nullptr for recovered memtable that
+  // isn't written anymore
+  shared_ptr<WriteAheadLog> _wal;
+  // logs to remove once this memtable is flushed
+  vector<string> _wal_paths;
+  // runs of keyOrder() by decreasing size
+  mutable std::mutex _order_mutex;
+  mutable vector<shared_ptr<const Run>> _runs;
+
+  Shard &shard(size_t hash) { return _shards[(hash >> 32) % k_shards_num]; }
+  const Shard &shard(size_t hash) const {
+    return _shards[(hash >> 32) % k_shards_num];
+  }
+
+public:
+  static constexpr uint64_t k_not_flushed = UINT64_MAX;
+
+  explicit MemTable(shared_ptr<WriteAheadLog> wal) : _wal(std::move(wal)) {
+    if (_wal)
+      _wal_paths.push_back(_wal->path());
+  }
+
+  // inserts or overwrites k, returns byte size of the memtable after it
+  size_t put(size_t hash, string &&k, string &&v) {
+    Shard &s = shard(hash);
+    ssize_t delta = k.size() + v.size() + k_entry_overhead;
+    {
+      std::lock_guard lock(s._mutex);
+      auto [it, inserted] = s._map.try_emplace(std::move(k));
+      if (!inserted)
+        delta = ssize_t(v.size()) - ssize_t(it->second.size());
+      else if (s._ordered)
+        s._new_keys.push_back(&*it);
+      it->second = std::move(v);
+    }
+    return _byte_size.fetch_add(delta, std::memory_order_relaxed) + delta;
+  }
+
+  // calls found(const string &v) under the shard lock if k is present
+  template <typename Found>
+  bool visit(size_t hash, string_view k, Found &&found) const {
+    const Shard &s = shard(hash);
+    std::shared_lock lock(s._mutex);
+    auto it = s._map.find(k);
+    if (it == s._map.end())
+      return false;
+    found(it->second);
+    return true;
+  }
+
+  size_t byteSize() const { return _byte_size.load(std::memory_order_relaxed); }
+  bool empty() const { return byteSize() == 0; }
+  const shared_ptr<WriteAheadLog> &wal() const { return _wal; }
+  const vector<string> &walPaths() const { return _wal_paths; }
+  void addWalPath(string path) { _wal_paths.push_back(std::move(path)); }
+  // set before the file is published, readers whose files include it skip
+  // the memtable until it's dropped
+  void setFlushedFile(uint64_t id) {
+    _flushed_file.store(id, std::memory_order_relaxed);
+  }
+  uint64_t flushedFile() const {
+    return _flushed_file.load(std::memory_order_relaxed);
+  }
+
+  // copies all entries, used to flush frozen memtable
+  void copyTo(KVBatch &batch) const {
+    for (const auto &s : _shards) {
+      std::shared_lock lock(s._mutex);
+      for (const auto &[k, v] : s._map)
+        batch.add(k, v);
+    }
+  }
+  // Returns sorted runs of all keys put so far, no key is in two of them.
+  // The first call sorts all keys, later ones only keys put since and merge
+  // the new run with smaller older ones, like a binary counter, so every key
+  // is merged O(log n) times overall and there are O(log n) runs.
+  vector<shared_ptr<const Run>> keyOrder() const {
+    std::lock_guard order_lock(_order_mutex);
+    Run added;
+    for (size_t i = 0; i < k_shards_num; ++i) {
+      const Shard &s = _shards[i];
+      std::lock_guard lock(s._mutex);
+      if (!s._ordered) {
+        for (const auto &entry : s._map)
+          added.push_back({._entry = &entry, ._shard = i});
+        s._ordered = true;
+      } else {
+        for (const Entry *entry : s._new_keys)
+          added.push_back({._entry = entry, ._shard = i});
+        s._new_keys.clear();
+      }
+    }
+    if (added.empty())
+      return _runs;
+    auto less = [](const OrderedEntry &a, const OrderedEntry &b) {
+      return a._entry->first < b._entry->first;
+    };
+    std::sort(added.begin(), added.end(), less);
+    while (!_runs.empty() && _runs.back()->size() <= added.size()) {
+      Run merged;
+      merged.reserve(_runs.back()->size() + added.size());
+      std::merge(_runs.back()->begin(), _runs.back()->end(), added.begin(),
+                 added.end(), std::back_inserter(merged), less);
+      added = std::move(merged);
+      _runs.pop_back();
+    }
+    _runs.push_back(std::make_shared<const Run>(std::move(added)));
+    return _runs;
+  }
+  // calls found(const string &v) with value of entry under its shard lock
+  template <typename Found>
+  void visit(const OrderedEntry &entry, Found &&found) const {
+    std::shared_lock lock(_shards[entry._shard]._mutex);
+    found(entry._entry->second);
+  }
+};
+
+// oldest first, the last one is the active memtable
+typedef vector<shared_ptr<MemTable>> MemTables;
+
+} // namespace humming::DB
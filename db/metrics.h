@@ -0,0 +1,162 @@
+#pragma once
+
+#include <iterator>
+#include <string_view>
+
+#include "util/perf/metrics.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Events of reads, recorded into the ReadContext they are done with. A
+// lookup is one key of read(), get() or multiGet().
+enum class ReadCounter : size_t {
+  k_lookups,
+  k_key_cache_hits,
+  k_key_cache_misses,
+  k_memtable_hits,
+  // files skipped by their filter or fences without any I/O
+  k_filter_negatives,
+  // files whose index was searched, and those of them not holding the key
+  k_files_searched,
+  k_false_positives,
+  // index pages looked at, from mappings, the page cache or files
+  k_index_pages,
+  k_page_cache_hits,
+  k_page_cache_misses,
+  // candidate records fetched, more than lookups on truncated hash collisions
+  k_records_read,
+  k_value_log_reads,
+  // blocks of compressed data files decompressed by lookups
+  k_blocks_decompressed,
+  // read calls to the kernel and bytes they returned, multiGet's batched
+  // reads are counted apart as they may all cost one io_uring_enter
+  k_syscalls,
+  k_bytes_read,
+  k_async_reads,
+  k_num
+};
+
+// Latencies of stages of reads in nanoseconds, and per lookup sizes.
+enum class ReadHistogram : size_t {
+  k_read,
+  k_get,
+  k_multi_get,
+  k_key_cache,
+  k_memtables,
+  // lookup in one data file, its index search and every candidate record
+  k_file,
+  k_index_search,
+  k_record,
+  k_value_log,
+  k_lookup_bytes,
+  k_lookup_syscalls,
+  k_num
+};
+
+// Events of put(), insert(), flushes and compactions of a Bucket.
+enum class WriteCounter : size_t {
+  k_puts,
+  k_put_bytes,
+  k_inserted_entries,
+  k_memtable_switches,
+  k_flushes,
+  k_files_written,
+  k_bytes_written,
+  k_compactions,
+  k_compacted_bytes,
+  k_num
+};
+
+// Latencies of stages of writes in nanoseconds.
+enum class WriteHistogram : size_t {
+  k_put,
+  k_wal_append,
+  k_memtable_insert,
+  k_wal_sync,
+  k_memtable_switch,
+  k_insert,
+  // sorting and writing a durable data file, part of inserts, flushes and
+  // bulk loads
+  k_file_write,
+  k_publish,
+  k_flush,
+  k_compaction,
+  k_num
+};
+
+using ReadMetrics = util::perf::MetricSet<ReadCounter, ReadHistogram>;
+using WriteMetrics = util::perf::MetricSet<WriteCounter, WriteHistogram>;
+
+inline string_view metricName(ReadCounter id) {
+  static constexpr string_view k_names[] = {
+      "lookups",
+      "key cache hits",
+      "key cache misses",
+      "memtable hits",
+      "filter negatives",
+      "files searched",
+      "false positives",
+      "index pages",
+      "page cache hits",
+      "page cache misses",
+      "records read",
+      "value log reads",
+      "blocks decompressed",
+      "syscalls",
+      "bytes read",
+      "async reads"};
+  static_assert(std::size(k_names) == size_t(ReadCounter::k_num));
+  return k_names[size_t(id)];
+}
+
+inline string_view metricName(ReadHistogram id) {
+  static constexpr string_view k_names[] = {
+      "read ns",
+      "get ns",
+      "multi get ns",
+      "key cache ns",
+      "memtables ns",
+      "file ns",
+      "index search ns",
+      "record ns",
+      "value log ns",
+      "bytes per lookup",
+      "syscalls per lookup"};
+  static_assert(std::size(k_names) == size_t(ReadHistogram::k_num));
+  return k_names[size_t(id)];
+}
+
+inline string_view metricName(WriteCounter id) {
+  static constexpr string_view k_names[] = {
+      "puts",
+      "put bytes",
+      "inserted entries",
+      "memtable switches",
+      "flushes",
+      "files written",
+      "bytes written",
+      "compactions",
+      "compacted bytes"};
+  static_assert(std::size(k_names) == size_t(WriteCounter::k_num));
+  return k_names[size_t(id)];
+}
+
+inline string_view metricName(WriteHistogram id) {
+  static constexpr string_view k_names[] = {
+      "put ns",
+      "wal append ns",
+      "memtable insert ns",
+      "wal sync ns",
+      "memtable switch ns",
+      "insert ns",
+      "file write ns",
+      "publish ns",
+      "flush ns",
+      "compaction ns"};
+  static_assert(std::size(k_names) == size_t(WriteHistogram::k_num));
+  return k_names[size_t(id)];
+}
+
+} // namespace humming::DB
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace humming::DB {
+
+// Piecewise linear model mapping a hash to position of its first entry in the
+// sorted index of a data file. Segments are built greedily in one pass with a
+// shrinking cone, so every hash of the file is predicted within error()
+// entries. The error is measured once the model is built, a lookup of a hash
+// present in the file never has to look outside of that range.
+class PositionModel {
+public:
+  struct Segment {
+    size_t _first_hash;
+    double _first_position;
+    double _slope = 0;
+  };
+
+private:
+  vector<Segment> _segments;
+  size_t _entries_num = 0;
+  size_t _error = 0;
+
+  size_t predictIn(const Segment &segment, size_t hash) const {
+    const double position =
+        segment._first_position +
+        segment._slope * double(hash - segment._first_hash);
+    return size_t(std::clamp(std::round(position), 0.0,
+                             double(_entries_num - 1)));
+  }
+
+public:
+  // empty model, it predicts nothing
+  PositionModel() = default;
+  // restores model written by data()
+  PositionModel(const char *data, size_t size, size_t entries_num,
+                size_t error)
+      : _segments(size / sizeof(Segment)), _entries_num(entries_num),
+        _error(error) {
+    memcpy(_segments.data(), data, _segments.size() * sizeof(Segment));
+  }
+
+  // Builds model of entries_num sorted hashes, hash_at(i) returns i-th one.
+  // Segments are cut when they can't keep predictions within max_error.
+  template <typename HashAt>
+  static PositionModel build(size_t entries_num, HashAt &&hash_at,
+                             size_t max_error) {
+    PositionModel model;
+    model._entries_num = entries_num;
+    if (entries_num == 0)
+      return model;
+    const double error = max_error;
+    Segment segment{._first_hash = hash_at(0), ._first_position = 0};
+    // slopes keeping every point of the segment within error
+    double lo = 0, hi = INFINITY;
+    auto close = [&] {
+      segment._slope = std::isinf(hi) ? lo : (lo + hi) / 2;
+      model._segments.push_back(segment);
+    };
+    for (size_t i = 1; i < entries_num; ++i) {
+      const size_t hash = hash_at(i);
+      if (hash == hash_at(i - 1))
+        continue; // runs of a hash are found from their first entry
+      const double dx = double(hash - segment._first_hash);
+      const double dy = double(i) - segment._first_position;
+      if ((dy + error) / dx >= lo && (dy - error) / dx <= hi) {
+        lo = std::max(lo, (dy - error) / dx);
+        hi = std::min(hi, (dy + error) / dx);
+        continue;
+      }
+      close();
+      segment = Segment{._first_hash = hash, ._first_position = double(i)};
+      lo = 0;
+      hi = INFINITY;
+    }
+    close();
+
+    // rounding may shift predictions, so the bound is measured
+    for (size_t i = 0; i < entries_num; ++i) {
+      if (i > 0 && hash_at(i) == hash_at(i - 1))
+        continue;
+      const size_t predicted = model.predict(hash_at(i));
+      model._error =
+          std::max(model._error, predicted > i ? predicted - i : i - predicted);
+    }
+    return model;
+  }
+
+  // estimated position of the first entry of hash, off by at most error()
+  // if the hash is in the file
+  size_t predict(size_t hash) const {
+    auto next = std::upper_bound(
+        _segments.begin(), _segments.end(), hash,
+        [](size_t hash, const Segment &s) { return hash < s._first_hash; });
+    if (next == _segments.begin())
+      return 0;
+    return predictIn(*(next - 1), hash);
+  }
+
+  bool empty() const { return _segments.empty(); }
+  size_t error() const { return _error; }
+  size_t segmentsNum() const { return _segments.size(); }
+  const char *data() const { return (const char *)_segments.data(); }
+  size_t byteSize() const { return _segments.size() * sizeof(Segment); }
+};
+
+} // namespace humming::DB
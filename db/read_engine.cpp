@@ -0,0 +1,165 @@
+#include "db/read_engine.h"
+
+#include <condition_variable>
+#include <latch>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace humming::DB {
+
+struct ReadEngine::Worker {
+  std::thread _thread;
+  util::io::IoRing _ring;
+  ReadMetrics _metrics;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Request> _queue;
+  bool _stop = false;
+  // used only by the thread: lookups started and not done yet, and contexts
+  // they don't use
+  size_t _active = 0;
+  vector<unique_ptr<AsyncReadContext>> _free_contexts;
+};
+
+ReadEngine::ReadEngine(Database &database, ReadEngineOptions options)
+    : _database(database), _options(std::move(options)) {
+  _options._threads_num = std::max<size_t>(1, _options._threads_num);
+  _options._max_in_flight = std::max<size_t>(1, _options._max_in_flight);
+  const vector<size_t> cpus = util::parallel::allowedCpus();
+  for (size_t i = 0; i < _options._threads_num; ++i) {
+    auto &worker = *_workers.emplace_back(std::make_unique<Worker>());
+    // every lookup has at most one read queued, so the queue never fills up
+    if (worker._ring.init(_options._max_in_flight) == -1 && i == 0)
+      PLOGW << "io_uring is not available, lookups read synchronously";
+    const int cpu = _options._pin_threads && !cpus.empty()
+                        ? int(cpus[i % cpus.size()])
+                        : -1;
+    worker._thread = std::thread([this, &worker, cpu] { run(worker, cpu); });
+  }
+}
+
+ReadEngine::~ReadEngine() {
+  for (auto &worker : _workers) {
+    {
+      std::lock_guard lock(worker->_mutex);
+      worker->_stop = true;
+    }
+    worker->_cv.notify_one();
+  }
+  for (auto &worker : _workers)
+    worker->_thread.join();
+}
+
+size_t ReadEngine::workerOf(size_t hash) const {
+  // top bits like shards, so with as many threads as shards a thread reads
+  // only its shard
+  return (unsigned __int128)hash * _workers.size() >> 64;
+}
+
+void ReadEngine::get(string k, Done done) {
+  const size_t hash = hashKey(k);
+  Worker &worker = *_workers[workerOf(hash)];
+  {
+    std::lock_guard lock(worker._mutex);
+    worker._queue.push_back(
+        {._k = std::move(k), ._hash = hash, ._done = std::move(done)});
+  }
+  worker._cv.notify_one();
+}
+
+vector<optional<string>> ReadEngine::multiGet(span<const string> keys) {
+  vector<optional<string>> result(keys.size());
+  std::latch pending(keys.size());
+  // lookups of a thread are queued under one lock with one wakeup, not one
+  // per key
+  vector<vector<Request>> requests(_workers.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const size_t hash = hashKey(keys[i]);
+    requests[workerOf(hash)].push_back(
+        {._k = keys[i],
+         ._hash = hash,
+         ._done = [&result, &pending, i](bool found, string &&value) {
+           if (found)
+             result[i] = std::move(value);
+           pending.count_down();
+         }});
+  }
+  for (size_t w = 0; w < _workers.size(); ++w) {
+    if (requests[w].empty())
+      continue;
+    Worker &worker = *_workers[w];
+    {
+      std::lock_guard lock(worker._mutex);
+      std::move(requests[w].begin(), requests[w].end(),
+                std::back_inserter(worker._queue));
+    }
+    worker._cv.notify_one();
+  }
+  pending.wait();
+  return result;
+}
+
+ReadMetrics ReadEngine::metrics() const {
+  ReadMetrics metrics;
+  for (const auto &worker : _workers)
+    metrics.merge(worker->_metrics);
+  return metrics;
+}
+
+void ReadEngine::run(Worker &worker, int cpu) {
+  if (cpu >= 0)
+    util::parallel::pinCurrentThread(cpu);
+  vector<Request> taken;
+  while (true) {
+    {
+      std::unique_lock lock(worker._mutex);
+      if (worker._active == 0)
+        worker._cv.wait(lock,
+                        [&] { return worker._stop || !worker._queue.empty(); });
+      if (worker._stop && worker._queue.empty() && worker._active == 0)
+        return;
+      while (!worker._queue.empty() &&
+             worker._active + taken.size() < _options._max_in_flight) {
+        taken.push_back(std::move(worker._queue.front()));
+        worker._queue.pop_front();
+      }
+    }
+    // new lookups run until their first read, then reads of all of them are
+    // submitted together
+    for (auto &request : taken) {
+      ++worker._active;
+      util::parallel::spawn(lookup(worker, std::move(request)));
+    }
+    // waits for a completion only when there is nothing new to start, new
+    // requests then wait for the first one
+    const bool wait = taken.empty();
+    taken.clear();
+    if (worker._ring.resume(wait) == -1) {
+      PLOGE << "io_uring of read engine failed";
+      abort();
+    }
+  }
+}
+
+util::parallel::Task<void> ReadEngine::lookup(Worker &worker,
+                                              Request request) {
+  unique_ptr<AsyncReadContext> context;
+  if (worker._free_contexts.empty()) {
+    context = std::make_unique<AsyncReadContext>();
+    context->_ring = &worker._ring;
+    context->_metrics = &worker._metrics;
+  } else {
+    context = std::move(worker._free_contexts.back());
+    worker._free_contexts.pop_back();
+  }
+  string value;
+  Bucket &shard = _database.shard(_database.shardOf(request._hash));
+  const bool found = co_await shard.getAsync(request._k, *context, value);
+  worker._free_contexts.push_back(std::move(context));
+  --worker._active;
+  request._done(found, std::move(value));
+}
+
+} // namespace humming::DB
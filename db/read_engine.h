@@ -0,0 +1,75 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "db/database.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+struct ReadEngineOptions {
+  // one thread and io_uring per core, every key is served by the thread its
+  // hash routes to, so with as many threads as shards each thread serves one
+  // shard
+  size_t _threads_num = util::parallel::defaultThreadsNum();
+  // pins thread i to the i-th allowed core
+  bool _pin_threads = true;
+  // lookups a thread runs concurrently, each has at most one read in flight;
+  // more wait in its queue
+  size_t _max_in_flight = 128;
+};
+
+// Serves point lookups of a Database from a few threads, each running many
+// lookups as coroutines that suspend on every index page and record read
+// instead of blocking the thread. Reads of a thread are submitted through its
+// own io_uring in one io_uring_enter per round, so a thread keeps up to
+// _max_in_flight reads queued at the device. Without io_uring reads are done
+// synchronously in the same threads.
+class ReadEngine {
+public:
+  // called on the engine thread once the lookup is done, value is empty if
+  // the key was not found
+  using Done = std::function<void(bool found, string &&value)>;
+
+private:
+  struct Request {
+    string _k;
+    size_t _hash = 0;
+    Done _done;
+  };
+  struct Worker;
+
+  Database &_database;
+  ReadEngineOptions _options;
+  vector<unique_ptr<Worker>> _workers;
+
+  // index of the thread looking up keys of hash
+  size_t workerOf(size_t hash) const;
+  void run(Worker &worker, int cpu);
+  util::parallel::Task<void> lookup(Worker &worker, Request request);
+
+public:
+  explicit ReadEngine(Database &database, ReadEngineOptions options = {});
+  // finishes lookups already queued
+  ~ReadEngine();
+  ReadEngine(const ReadEngine &) = delete;
+  ReadEngine &operator=(const ReadEngine &) = delete;
+
+  // Queues a lookup of the newest value of k to the thread of its hash,
+  // done must not block as it runs on that thread.
+  void get(string k, Done done);
+  // looks keys up concurrently and waits for all of them, result[i] is the
+  // value of keys[i] if it was found
+  vector<optional<string>> multiGet(span<const string> keys);
+  // metrics of lookups of all threads so far
+  ReadMetrics metrics() const;
+};
+
+} // namespace humming::DB
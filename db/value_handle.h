@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "db/data_file_metadata.h"
+#include "util/io/common.h"
+#include "util/io/page_cache.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Value found by Bucket::get, exposed without copying it out of where it was
+// read to. The value is a list of parts pointing into a mapping of its data
+// file, into pinned page cache frames (one part per page) or into memory of
+// the handle for values read with pread or found in a memtable. Everything
+// the parts point to stays valid until release() or destruction, pinned
+// frames can't be evicted meanwhile. A handle reused across gets keeps its
+// buffer.
+class ValueHandle {
+private:
+  // keeps mapping alive when the file is removed by compaction
+  shared_ptr<const DataFileMetadata> _file;
+  vector<util::io::PageCache::Handle> _pages;
+  vector<span<const char>> _parts;
+  size_t _size = 0;
+  std::unique_ptr<char, util::io::AlignedBufferDeleter> _buffer;
+  size_t _buffer_size = 0;
+
+public:
+  ValueHandle() = default;
+  ValueHandle(ValueHandle &&) = default;
+  ValueHandle &operator=(ValueHandle &&) = default;
+  ValueHandle(const ValueHandle &) = delete;
+  ValueHandle &operator=(const ValueHandle &) = delete;
+
+  size_t size() const { return _size; }
+  span<const span<const char>> parts() const { return _parts; }
+  // whole value as one view, only when it's not spread over pages
+  bool contiguous() const { return _parts.size() <= 1; }
+  string_view view() const {
+    return _parts.empty() ? string_view()
+                          : string_view(_parts[0].data(), _parts[0].size());
+  }
+  void copyTo(char *out) const {
+    for (const auto &part : _parts) {
+      memcpy(out, part.data(), part.size());
+      out += part.size();
+    }
+  }
+  // unpins pages and the file, keeps the buffer for the next get
+  void release() {
+    _file.reset();
+    _pages.clear();
+    _parts.clear();
+    _size = 0;
+  }
+
+  // used by Bucket::get to fill the handle
+
+  // sector aligned memory of the handle of at least size bytes, overwritten
+  // by the next call
+  char *buffer(size_t size) {
+    if (size > _buffer_size) {
+      _buffer_size = util::io::calculate_aligned_size(size);
+      _buffer.reset(util::io::allocate_aligned_buffer(_buffer_size));
+    }
+    return _buffer.get();
+  }
+  void pinFile(shared_ptr<const DataFileMetadata> file) {
+    _file = std::move(file);
+  }
+  void pinPage(util::io::PageCache::Handle page) {
+    _pages.push_back(std::move(page));
+  }
+  void addPart(const char *data, size_t size) {
+    _parts.emplace_back(data, size);
+    _size += size;
+  }
+};
+
+} // namespace humming::DB
@@ -0,0 +1,103 @@
+#include "db/value_log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "plog/Log.h"
+
+namespace humming::DB {
+
+size_t ValuePointer::encode(char *out) const {
+  size_t size = util::io::encodeVarint(out, _log);
+  size += util::io::encodeVarint(out + size, _offset);
+  return size + util::io::encodeVarint(out + size, _size);
+}
+
+bool ValuePointer::decode(string_view encoded) {
+  const char *data = encoded.data();
+  const char *end = data + encoded.size();
+  for (uint64_t *field : {&_log, &_offset, &_size}) {
+    const size_t size = util::io::decodeVarint(data, end, *field);
+    if (size == 0)
+      return false;
+    data += size;
+  }
+  return data == end;
+}
+
+ValueLog::ValueLog(uint64_t number, string path)
+    : _number(number), _path(std::move(path)) {
+  _fd = ::open(_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (_fd != -1 && fstat(_fd, &st) == 0)
+    _byte_size = st.st_size;
+}
+
+ValueLog::~ValueLog() {
+  if (_fd != -1)
+    close(_fd);
+}
+
+shared_ptr<ValueLog> ValueLog::open(uint64_t number, string path) {
+  auto log = std::make_shared<ValueLog>(number, std::move(path));
+  if (log->_fd == -1) {
+    PLOGE << "could not open " << log->_path
+          << " because: " << strerror(errno);
+    return nullptr;
+  }
+  return log;
+}
+
+bool ValueLog::read(const ValuePointer &pointer, char *out) const {
+  if (!holds(pointer))
+    return false;
+  size_t done = 0;
+  while (done < pointer._size) {
+    const ssize_t bytes_read = ::pread(_fd, out + done, pointer._size - done,
+                                       pointer._offset + done);
+    if (bytes_read <= 0)
+      return false;
+    done += bytes_read;
+  }
+  return true;
+}
+
+ValueLogWriter::ValueLogWriter(string path, size_t buffer_size,
+                               size_t buffers_num, size_t bytes_per_sync)
+    : _number(std::stoull(std::filesystem::path(path).stem().string())),
+      _path(std::move(path)), _out(buffer_size, buffers_num, bytes_per_sync) {
+  if (_out.open(_path) == -1) {
+    PLOGE << "could not open a file " << _path
+          << " because: " << strerror(errno);
+    abort();
+  }
+}
+
+ValuePointer ValueLogWriter::append(string_view v) {
+  if (_out.write(v.data(), v.size()) == -1) {
+    PLOGE << "could not write to a file " << _path;
+    abort();
+  }
+  const ValuePointer pointer{
+      ._log = _number, ._offset = _offset, ._size = v.size()};
+  _offset += v.size();
+  return pointer;
+}
+
+shared_ptr<ValueLog> ValueLogWriter::finish(bool sync) {
+  if (_out.close(sync) == -1) {
+    PLOGE << "could not close a file " << _path
+          << " because: " << strerror(errno);
+    abort();
+  }
+  auto log = ValueLog::open(_number, _path);
+  if (!log)
+    abort();
+  return log;
+}
+
+} // namespace humming::DB
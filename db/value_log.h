@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "util/io/buffered_file_output.h"
+#include "util/io/varint.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Location of a value moved out of its data file record into a value log,
+// the record holds the encoded pointer instead of the value.
+struct ValuePointer {
+  static constexpr size_t k_max_encoded_size = 3 * util::io::k_max_varint_size;
+
+  uint64_t _log; // number of the value log file
+  uint64_t _offset;
+  uint64_t _size;
+
+  // writes varints of log, offset and size, returns number of bytes written
+  size_t encode(char *out) const;
+  // returns false unless encoded is exactly one pointer
+  bool decode(string_view encoded);
+};
+
+// bytes of values in value log _log referenced by records of a data file
+struct ValueLogRef {
+  uint64_t _log;
+  uint64_t _bytes;
+};
+
+// how a data file writer moves large values into a value log of its own
+struct ValueSeparation {
+  // values of at least this many bytes go to the value log, 0 keeps all of
+  // them in records
+  size_t _min_value_size = 0;
+  // returns path of a new value log, named by its number like data files;
+  // called once by the first value that is separated
+  std::function<std::string()> _log_path;
+
+  bool separates(size_t value_size) const {
+    return _min_value_size > 0 && value_size >= _min_value_size;
+  }
+};
+
+// Append-only file of values moved out of data files, opened for reading.
+// Values are stored back to back without any framing, pointers in records
+// locate them. A value log is never modified once written, it's removed when
+// no data file of the current set references it. Reads go through the kernel
+// cache with positional reads, so the descriptor is shared between threads.
+class ValueLog {
+private:
+  uint64_t _number;
+  string _path;
+  size_t _byte_size = 0;
+  int _fd = -1;
+
+public:
+  ValueLog(uint64_t number, string path);
+  ~ValueLog();
+  ValueLog(const ValueLog &) = delete;
+  ValueLog &operator=(const ValueLog &) = delete;
+
+  // returns nullptr if the file can't be opened
+  static shared_ptr<ValueLog> open(uint64_t number, string path);
+
+  uint64_t number() const { return _number; }
+  const string &path() const { return _path; }
+  size_t byteSize() const { return _byte_size; }
+  // for reads awaited elsewhere, e.g. on an io_uring
+  int fd() const { return _fd; }
+
+  // value at pointer is entirely within the file
+  bool holds(const ValuePointer &pointer) const {
+    return pointer._offset + pointer._size <= _byte_size;
+  }
+  // reads value at pointer into out of pointer._size bytes, returns false
+  // unless the file holds it
+  bool read(const ValuePointer &pointer, char *out) const;
+};
+
+// Writes values of one data file into a new value log.
+class ValueLogWriter {
+private:
+  uint64_t _number;
+  string _path;
+  util::io::BufferedFileOutput _out;
+  size_t _offset = 0;
+
+public:
+  ValueLogWriter(string path, size_t buffer_size, size_t buffers_num,
+                 size_t bytes_per_sync);
+
+  uint64_t number() const { return _number; }
+  ValuePointer append(string_view v);
+  // closes the log and opens it for reading; with sync it's durable before
+  // it's returned
+  shared_ptr<ValueLog> finish(bool sync);
+};
+
+} // namespace humming::DB
@@ -0,0 +1,134 @@
+#include "db/wal.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+
+#include "plog/Log.h"
+#include "util/io/buffered_file_input.h"
+#include "util/io/common.h"
+#include "util/io/crc32.h"
+
+namespace humming::DB {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t _crc = 0;
+  size_t _key_size;
+  size_t _value_size;
+};
+
+uint32_t recordCrc(const RecordHeader &header, string_view k, string_view v) {
+  uint32_t crc = util::io::crc32c((const char *)&header._key_size,
+                                  sizeof(size_t) * 2);
+  crc = util::io::crc32c(k.data(), k.size(), crc);
+  return util::io::crc32c(v.data(), v.size(), crc);
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(string path, size_t buffer_size)
+    : _path(std::move(path)),
+      _directory(std::filesystem::path(_path).parent_path().string()),
+      _out(buffer_size) {
+  if (_directory.empty())
+    _directory = ".";
+  if (_out.open(_path.c_str(), false) == -1) {
+    PLOGE << "could not open a file " << _path
+          << " because: " << strerror(errno);
+    abort();
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (_out.close() == -1)
+    PLOGE << "could not close a file " << _path;
+}
+
+uint64_t WriteAheadLog::append(string_view k, string_view v) {
+  RecordHeader header{._key_size = k.size(), ._value_size = v.size()};
+  header._crc = recordCrc(header, k, v);
+  std::lock_guard lock(_mutex);
+  if (_out.write((const char *)&header._crc, sizeof(header._crc)) == -1 ||
+      _out.write((const char *)&header._key_size, sizeof(size_t) * 2) == -1 ||
+      _out.write(k.data(), k.size()) == -1 ||
+      _out.write(v.data(), v.size()) == -1) {
+    PLOGE << "could not write to a file " << _path;
+    abort();
+  }
+  return ++_appended;
+}
+
+void WriteAheadLog::sync(uint64_t seq) {
+  std::unique_lock lock(_mutex);
+  while (_synced < seq) {
+    if (_syncing) {
+      _synced_cv.wait(lock);
+      continue;
+    }
+    // become the leader, appends continue into the buffer while syncing
+    _syncing = true;
+    const uint64_t target = _appended;
+    const bool sync_directory = !_directory_synced;
+    if (_out.flushBuffer() == -1) {
+      PLOGE << "could not write to a file " << _path;
+      abort();
+    }
+    lock.unlock();
+    bool synced = fdatasync(_out.fd()) == 0;
+    // records of a new log are durable only with its entry in the directory
+    if (synced && sync_directory)
+      synced = util::io::sync_directory(_directory.c_str()) == 0;
+    lock.lock();
+    if (!synced) {
+      PLOGE << "could not sync a file " << _path
+            << " because: " << strerror(errno);
+      abort();
+    }
+    _directory_synced = true;
+    _synced = target;
+    _syncing = false;
+    _synced_cv.notify_all();
+  }
+}
+
+size_t WriteAheadLog::replay(
+    const string &path,
+    const std::function<void(string &&, string &&)> &apply) {
+  util::io::BufferedFileInput in(1 << 20);
+  if (in.open(path.c_str(), false) == -1) {
+    PLOGE << "could not open a file " << path
+          << " because: " << strerror(errno);
+    return 0;
+  }
+  size_t applied = 0;
+  RecordHeader header;
+  string k, v;
+  while (in.read((char *)&header._crc, sizeof(header._crc)) ==
+             sizeof(header._crc) &&
+         in.read((char *)&header._key_size, sizeof(size_t) * 2) ==
+             sizeof(size_t) * 2) {
+    // sizes of a torn record are garbage, don't allocate them blindly
+    if (header._key_size > (size_t(1) << 32) ||
+        header._value_size > (size_t(1) << 32))
+      break;
+    k.resize(header._key_size);
+    v.resize(header._value_size);
+    if (in.read(k.data(), k.size()) != ssize_t(k.size()) ||
+        in.read(v.data(), v.size()) != ssize_t(v.size()) ||
+        recordCrc(header, k, v) != header._crc) {
+      PLOGW << "log " << path << " ends with a torn record after " << applied
+            << " records";
+      break;
+    }
+    apply(std::move(k), std::move(v));
+    ++applied;
+  }
+  in.close();
+  return applied;
+}
+
+} // namespace humming::DB
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "util/io/buffered_file_output.h"
+
+using namespace std;
+
+namespace humming::DB {
+
+// Append-only log of puts not yet flushed into a data file. Every record is
+// checksummed: crc32c, size_t key_len, size_t val_len, key, val, written
+// after the crc. Puts waiting for durability share fdatasync calls: the first
+// waiter syncs everything appended so far, the others wait for its result.
+// The first sync also syncs the directory, so the log itself survives a
+// crash.
+class WriteAheadLog {
+private:
+  string _path;
+  string _directory;
+  util::io::BufferedFileOutput _out;
+  std::mutex _mutex;
+  std::condition_variable _synced_cv;
+  // sequence number of the last appended and the last durable record
+  uint64_t _appended = 0;
+  uint64_t _synced = 0;
+  bool _syncing = false;
+  bool _directory_synced = false;
+
+public:
+  WriteAheadLog(string path, size_t buffer_size);
+  ~WriteAheadLog();
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  const string &path() const { return _path; }
+
+  // buffers record, returns its sequence number
+  uint64_t append(string_view k, string_view v);
+  // returns once record seq and all before it are durable
+  void sync(uint64_t seq);
+
+  // Calls apply for every record of the log at path in append order. Stops at
+  // the first torn or corrupted record, which is where a crash interrupted
+  // writing. Returns number of records applied.
+  static size_t replay(const string &path,
+                       const std::function<void(string &&, string &&)> &apply);
+};
+
+} // namespace humming::DB
@@ -1,5 +1,11 @@
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <optional>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "plog/Appenders/ColorConsoleAppender.h"
 #include "plog/Appenders/ConsoleAppender.h"
@@ -11,51 +17,399 @@
 #include "util/perf/timer.h"
 #include <unistd.h>
 
-#include "db/bucket.h"
+#include "db/database.h"
+#include "db/read_engine.h"
 
 using namespace std;
 using namespace humming;
 
-int main() {
+// keys put and then inserted with other values
+constexpr int k_mixed_num = 1000;
+
+// Checks every operation against the expected values, exits with 1 at the
+// first wrong one. The database lives in the directory given as the only
+// argument, which must be empty or missing, or in a new temporary directory
+// that is removed after a successful run.
+int main(int argc, char **argv) {
   static plog::ColorConsoleAppender<plog::TxtFormatter> debug_console_appender;
   plog::init(plog::debug, &debug_console_appender);
-  humming::DB::Bucket bucket;
+  std::string directory;
+  if (argc > 1) {
+    directory = argv[1];
+    std::error_code error;
+    if (std::filesystem::exists(directory) &&
+        !std::filesystem::is_empty(directory, error)) {
+      PLOGE << directory << " is not empty, expected values would be wrong";
+      return 1;
+    }
+  } else {
+    char temp[] = "/tmp/humming-XXXXXX";
+    if (mkdtemp(temp) == nullptr) {
+      PLOGE << "could not create a directory because: " << strerror(errno);
+      return 1;
+    }
+    directory = temp;
+  }
+  PLOGI << "database in " << directory;
+  // data files get key indexes, so the scans at the end read only their range
+  humming::DB::DatabaseOptions database_options;
+  database_options._directories = {directory};
+  database_options._bucket._key_index = true;
+  auto database = std::make_unique<humming::DB::Database>(database_options);
     {
-      humming::DB::KVs kvs;
-      kvs.emplace_back("a", "ą");
-      kvs.emplace_back("c", "ć");
-      kvs.emplace_back("l", "ł");
-      kvs.emplace_back("e", "ę");
+      humming::DB::KVBatch kvs;
+      kvs.add("a", "ą");
+      kvs.add("c", "ć");
+      kvs.add("l", "ł");
+      kvs.add("e", "ę");
 
+      kvs.reserve(1000004);
       for (int i = 0; i < 1000000; ++i)
-        kvs.emplace_back(std::to_string(i), std::to_string(-i));
+        kvs.add(std::to_string(i), std::to_string(-i));
       //  for (size_t i = 0; i < 5; ++i)
       util::perf::Timer _("store data: ");
-      bucket.insert(std::move(kvs));
+      database->insert(kvs);
     }
-//  if (bucket._file_paths.empty())
-//    bucket._file_paths.push_back("/home/adam/KV/0.data");
   util::io::BufferedFileInput in{util::io::k_sector_size};
   humming::DB::ReadContext context;
-  PLOGD << bucket.read("a", context);
-  PLOGD << bucket.read("100", context);
-  PLOGD << bucket.read("1000", context);
-  PLOGD << bucket.read("631545", context);
-  PLOGD << bucket.read("1231545", context);
-  PLOGD << bucket.read("57", context);
-  PLOGD << bucket.read("27876", context);
-  PLOGD << bucket.read("41", context);
-
-  util::perf::Timer _("read data: ");
-  for (int i = 0; i < 2000000; ++i) {
-    auto response = bucket.read(std::to_string(i), context);
-    size_t response_size = response.size();
-    if((i < 1000000) != response_size) {
-      PLOGE << "wrong result for " << i << " got: " << response;
-      exit(0);
-    }
-  }
-  _.addCount(2000000-1);
+  PLOGD << database->read("a", context);
+  PLOGD << database->read("100", context);
+  PLOGD << database->read("1000", context);
+  PLOGD << database->read("631545", context);
+  PLOGD << database->read("1231545", context);
+  PLOGD << database->read("57", context);
+  PLOGD << database->read("27876", context);
+  PLOGD << database->read("41", context);
+
+  {
+    // values are views into response, which is reused by every read
+    humming::DB::KVBatch response(1 << 12);
+    char key[16];
+    util::perf::Timer _("read data: ");
+    for (int i = 0; i < 2000000; ++i) {
+      response.clear();
+      const int key_size = snprintf(key, sizeof(key), "%d", i);
+      size_t response_size =
+          database->read(std::string_view(key, key_size), context, response);
+      if ((i < 1000000) != response_size ||
+          (response_size > 0 && response[0]._v != std::to_string(-i))) {
+        PLOGE << "wrong result for " << i;
+        exit(1);
+      }
+    }
+    _.addCount(2000000 - 1);
+  }
+
+  {
+    constexpr int k_batch_size = 256;
+    vector<string> keys(k_batch_size);
+    util::perf::Timer _("multi get data: ");
+    for (int i = 0; i < 2000000; i += k_batch_size) {
+      for (int j = 0; j < k_batch_size; ++j)
+        keys[j] = std::to_string(i + j);
+      auto responses = database->multiGet(keys, context);
+      for (int j = 0; j < k_batch_size; ++j) {
+        if ((i + j < 1000000) != responses[j].size() ||
+            (!responses[j].empty() &&
+             responses[j][0]._v != std::to_string(-(i + j)))) {
+          PLOGE << "wrong result for " << i + j << " got: " << responses[j];
+          exit(1);
+        }
+      }
+    }
+    _.addCount(2000000 - 1);
+  }
+
+  {
+    // lookups run as coroutines on engine threads, many reads in flight each
+    humming::DB::ReadEngine engine(*database);
+    constexpr int k_batch_size = 4096;
+    vector<string> keys(k_batch_size);
+    util::perf::Timer _("engine multi get data: ");
+    for (int i = 0; i < 2000000; i += k_batch_size) {
+      for (int j = 0; j < k_batch_size; ++j)
+        keys[j] = std::to_string(i + j);
+      auto values = engine.multiGet(keys);
+      for (int j = 0; j < k_batch_size; ++j) {
+        if ((i + j < 1000000) != values[j].has_value() ||
+            (values[j] && *values[j] != std::to_string(-(i + j)))) {
+          PLOGE << "wrong result for " << i + j;
+          exit(1);
+        }
+      }
+    }
+    _.addCount(2000000 - 1);
+  }
+
+  {
+    // readers run concurrently with a flush of keys they never ask for
+    const int threads_num =
+        std::max(2u, std::thread::hardware_concurrency());
+    std::thread writer([&] {
+      humming::DB::KVs kvs;
+      for (int i = 2000000; i < 2500000; ++i)
+        kvs.emplace_back(std::to_string(i), std::to_string(-i));
+      database->insert(std::move(kvs));
+    });
+    // metrics of every reader are merged once they are done
+    vector<humming::DB::ReadContext> contexts(threads_num);
+    {
+      util::perf::Timer _("concurrent read data: ");
+      vector<std::thread> readers;
+      for (int t = 0; t < threads_num; ++t) {
+        readers.emplace_back([&database, &contexts, t, threads_num] {
+          humming::DB::ReadContext &context = contexts[t];
+          for (int i = t; i < 2000000; i += threads_num) {
+            auto response = database->read(std::to_string(i), context);
+            if ((i < 1000000) != response.size()) {
+              PLOGE << "wrong result for " << i << " got: " << response;
+              exit(1);
+            }
+          }
+        });
+      }
+      for (auto &reader : readers)
+        reader.join();
+      _.addCount(2000000 - 1);
+    }
+    writer.join();
+    humming::DB::ReadMetrics metrics;
+    for (const auto &context : contexts)
+      metrics.merge(context._metrics);
+    std::ostringstream report;
+    metrics.print(report);
+    PLOGI << "metrics of concurrent reads:\n" << report.str();
+  }
+
+  {
+    // overwrite some keys a few times, compaction keeps only newest values
+    for (int round = 0; round < 4; ++round) {
+      humming::DB::KVs kvs;
+      for (int i = 0; i < 100000; ++i)
+        kvs.emplace_back(std::to_string(i), "round " + std::to_string(round));
+      database->insert(std::move(kvs));
+    }
+    {
+      util::perf::Timer _("compact data: ");
+      database->compact();
+    }
+    for (int i = 0; i < 200000; ++i) {
+      auto response = database->read(std::to_string(i), context);
+      if (response.empty() ||
+          response.back()._v !=
+              (i < 100000 ? "round 3"s : std::to_string(-i))) {
+        PLOGE << "wrong result for " << i << " got: " << response;
+        exit(1);
+      }
+    }
+    PLOGI << "files after compaction: " << database->filesNum();
+  }
+
+  {
+    // concurrent puts share log syncs, entries are read from the memtable
+    // until flush moves them into a data file
+    constexpr int k_puts_num = 100000;
+    const int threads_num = 8;
+    {
+      util::perf::Timer _("put data: ");
+      vector<std::thread> writers;
+      for (int t = 0; t < threads_num; ++t) {
+        writers.emplace_back([&database, t, threads_num] {
+          for (int i = t; i < k_puts_num; i += threads_num)
+            database->put(std::to_string(i), "put " + std::to_string(i));
+        });
+      }
+      for (auto &writer : writers)
+        writer.join();
+      _.addCount(k_puts_num - 1);
+    }
+    std::ostringstream report;
+    database->writeMetrics().print(report);
+    PLOGI << "metrics of writes:\n" << report.str();
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < k_puts_num; ++i) {
+        auto response = database->read(std::to_string(i), context);
+        if (response.empty() ||
+            response.back()._v != "put " + std::to_string(i)) {
+          PLOGE << "wrong result for " << i << " got: " << response;
+          exit(1);
+        }
+      }
+      database->flush();
+    }
+    PLOGI << "files after flush: " << database->filesNum();
+  }
+
+  {
+    // inserted values are newer than puts of the same keys before them
+    for (int i = 0; i < k_mixed_num; ++i)
+      database->put("mixed " + std::to_string(i), "put");
+    humming::DB::KVs kvs;
+    for (int i = 0; i < k_mixed_num; ++i)
+      kvs.emplace_back("mixed " + std::to_string(i), "insert");
+    database->insert(std::move(kvs));
+    humming::DB::ValueHandle handle;
+    for (int i = 0; i < k_mixed_num; ++i) {
+      const string key = "mixed " + std::to_string(i);
+      auto response = database->read(key, context);
+      if (!database->get(key, context, handle) || handle.view() != "insert" ||
+          response.empty() || response.back()._v != "insert") {
+        PLOGE << "wrong result for " << key << " got: " << response;
+        exit(1);
+      }
+    }
+  }
+
+  {
+    // runs much smaller than the data are spilled and merged into one file
+    constexpr int k_bulk_num = 1000000;
+    {
+      util::perf::Timer _("bulk load data: ");
+      humming::DB::Database::BulkLoad load(*database, 8 << 20);
+      for (int i = 0; i < k_bulk_num; ++i)
+        load.add("bulk " + std::to_string(i), std::to_string(i));
+      load.finish();
+      _.addCount(k_bulk_num - 1);
+    }
+    for (int i = 0; i < k_bulk_num; i += 7) {
+      auto response = database->read("bulk " + std::to_string(i), context);
+      if (response.size() != 1 || response[0]._v != std::to_string(i)) {
+        PLOGE << "wrong result for bulk " << i << " got: " << response;
+        exit(1);
+      }
+    }
+    PLOGI << "files after bulk load: " << database->filesNum();
+  }
+
+  {
+    // large values are read into the handle once, read() also copies them
+    // into strings it allocates
+    constexpr int k_blobs_num = 64;
+    constexpr size_t k_blob_size = 256 << 10;
+    humming::DB::KVs blobs;
+    for (int i = 0; i < k_blobs_num; ++i)
+      blobs.emplace_back("blob " + std::to_string(i),
+                         std::string(k_blob_size, 'a' + i % 26));
+    database->insert(std::move(blobs));
+    humming::DB::ValueHandle handle;
+    {
+      util::perf::Timer _("get blob: ");
+      for (int i = 0; i < 20 * k_blobs_num; ++i) {
+        const int blob = i % k_blobs_num;
+        if (!database->get("blob " + std::to_string(blob), context, handle) ||
+            handle.size() != k_blob_size ||
+            handle.view()[k_blob_size / 2] != 'a' + blob % 26) {
+          PLOGE << "wrong result for blob " << blob;
+          exit(1);
+        }
+      }
+      _.addCount(20 * k_blobs_num - 1);
+    }
+    handle.release();
+    {
+      util::perf::Timer _("read blob: ");
+      for (int i = 0; i < 20 * k_blobs_num; ++i) {
+        auto response =
+            database->read("blob " + std::to_string(i % k_blobs_num), context);
+        if (response.size() != 1 || response[0]._v.size() != k_blob_size) {
+          PLOGE << "wrong result for blob " << i % k_blobs_num;
+          exit(1);
+        }
+      }
+      _.addCount(20 * k_blobs_num - 1);
+    }
+  }
+
+  shared_ptr<humming::DB::KeyCache> key_cache;
+  {
+    // reopened database finds its files through manifests, only their
+    // footers, filters and models are read
+    const size_t files_num = database->filesNum();
+    // a key cache in front of shards serves the skewed reads below
+    key_cache = std::make_shared<humming::DB::KeyCache>(64 << 20);
+    database.reset();
+    {
+      util::perf::Timer _("reopen database: ");
+      humming::DB::DatabaseOptions options = database_options;
+      options._bucket._key_cache = key_cache;
+      database = std::make_unique<humming::DB::Database>(std::move(options));
+    }
+    if (database->filesNum() != files_num) {
+      PLOGE << "reopened " << database->filesNum() << " of " << files_num
+            << " files";
+      exit(1);
+    }
+    for (int i = 0; i < 1000000; i += 7) {
+      auto response = database->read(std::to_string(i), context);
+      const string expected =
+          i < 100000 ? "put " + std::to_string(i) : std::to_string(-i);
+      if (response.empty() || response.back()._v != expected) {
+        PLOGE << "wrong result for " << i << " got: " << response;
+        exit(1);
+      }
+    }
+    for (int i = 0; i < k_mixed_num; ++i) {
+      const string key = "mixed " + std::to_string(i);
+      auto response = database->read(key, context);
+      if (response.empty() || response.back()._v != "insert") {
+        PLOGE << "wrong result for " << key << " got: " << response;
+        exit(1);
+      }
+    }
+  }
+
+  {
+    // zipf-like ranks, a few keys take most of the reads
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> uniform;
+    humming::DB::KVBatch response(1 << 12);
+    {
+      util::perf::Timer _("skewed reads: ");
+      for (int i = 0; i < 1000000; ++i) {
+        const size_t rank = size_t(std::pow(1000000.0, uniform(random))) - 1;
+        const string key = std::to_string(rank);
+        response.clear();
+        if (database->read(key, context, response) == 0) {
+          PLOGE << "no result for " << key;
+          exit(1);
+        }
+      }
+      _.addCount(1000000 - 1);
+    }
+    PLOGD << "key cache hit ratio: " << key_cache->hitRatio() << ", "
+          << key_cache->entriesNum() << " entries in "
+          << util::perf::printBytes(key_cache->byteSize());
+  }
+
+  {
+    // 12345 and 123450..123459
+    size_t keys_num = 0;
+    for (auto it = database->scan(humming::DB::KeyRange::prefix("12345"));
+         it.valid(); it.next(), ++keys_num) {
+      const int i = std::stoi(string(it.key()));
+      const string expected =
+          i < 100000 ? "put " + std::to_string(i) : std::to_string(-i);
+      if (it.value() != expected) {
+        PLOGE << "wrong scanned value of " << it.key();
+        exit(1);
+      }
+    }
+    if (keys_num != 11) {
+      PLOGE << "prefix scan found " << keys_num << " keys";
+      exit(1);
+    }
+    util::perf::Timer _("range scan: ");
+    size_t value_bytes = 0;
+    for (auto it = database->scan({._begin = "5", ._end = "6"}); it.valid();
+         it.next()) {
+      value_bytes += it.value().size();
+      _.addCount();
+    }
+    PLOGD << "scanned " << util::perf::printBytes(value_bytes) << " of values";
+  }
 
+  database.reset();
+  if (argc <= 1)
+    std::filesystem::remove_all(directory);
   return 0;
 }
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <unistd.h> // For pread
+
+#include "util/io/common.h"
+#include "util/io/io_ring.h"
+
+namespace humming::util::io {
+
+/**
+ * @brief A single positional read that is a part of a batch.
+ */
+struct ReadRequest {
+  int _fd;
+  char *_buffer;
+  size_t _size;
+  off_t _offset;
+  // Number of bytes read, 0 on EOF, -errno on error. Set by submit(), less
+  // than _size only if the file ends first.
+  ssize_t _result = 0;
+};
+
+/**
+ * @brief Reads the rest of a request whose read returned fewer bytes than
+ * asked for, until it's complete, fails or hits the end of file.
+ */
+inline void completeShortRead(ReadRequest &r) {
+  while (r._result > 0 && size_t(r._result) < r._size) {
+    const ssize_t bytes_read = ::pread(r._fd, r._buffer + r._result,
+                                       r._size - r._result,
+                                       r._offset + r._result);
+    if (bytes_read < 0 && errno == EINTR)
+      continue;
+    if (bytes_read < 0)
+      r._result = -errno;
+    if (bytes_read <= 0)
+      return;
+    r._result += bytes_read;
+  }
+}
+
+/**
+ * @class AsyncFileInput
+ * @brief Backend that executes batches of independent positional reads.
+ *
+ * Implementations are free to execute requests in any order and in parallel,
+ * submit() returns only when every request of the batch has completed.
+ */
+class AsyncFileInput {
+public:
+  virtual ~AsyncFileInput() = default;
+
+  /**
+   * @brief Executes all requests and stores their outcome in `_result`.
+   * @return 0 on success, -1 if the backend itself failed.
+   */
+  virtual int submit(ReadRequest *requests, size_t count) = 0;
+};
+
+/**
+ * @class SyncFileInput
+ * @brief Fallback backend issuing one pread per request.
+ */
+class SyncFileInput : public AsyncFileInput {
+public:
+  int submit(ReadRequest *requests, size_t count) override {
+    for (size_t i = 0; i < count; ++i) {
+      ReadRequest &r = requests[i];
+      r._result = ::pread(r._fd, r._buffer, r._size, r._offset);
+      if (r._result < 0)
+        r._result = -errno;
+      completeShortRead(r);
+    }
+    return 0;
+  }
+};
+
+/**
+ * @class IoUringFileInput
+ * @brief Backend submitting whole batches through a single IoRing.
+ *
+ * A batch larger than the submission queue is split into queue-sized chunks,
+ * each costing one io_uring_enter call.
+ */
+class IoUringFileInput : public AsyncFileInput {
+private:
+  IoRing ring_;
+
+  int submitChunk(ReadRequest *requests, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+      ring_.push(requests[i]._fd, requests[i]._buffer, requests[i]._size,
+                 requests[i]._offset, i);
+
+    size_t completed = 0;
+    while (completed < count) {
+      if (ring_.enter(count - completed) == -1)
+        return -1;
+      completed += ring_.reap([&](uint64_t user_data, int32_t result) {
+        ReadRequest &r = requests[user_data];
+        r._result = result;
+        // Kernels without IORING_OP_READ reject it, serve those synchronously.
+        if (result == -EINVAL &&
+            (r._result = ::pread(r._fd, r._buffer, r._size, r._offset)) < 0)
+          r._result = -errno;
+        completeShortRead(r);
+      });
+    }
+    return 0;
+  }
+
+public:
+  /**
+   * @brief Sets up the ring.
+   * @param queue_depth Requested number of submission queue entries.
+   * @return 0 on success, -1 if io_uring is not available.
+   */
+  int init(unsigned queue_depth) { return ring_.init(queue_depth); }
+
+  int submit(ReadRequest *requests, size_t count) override {
+    for (size_t done = 0; done < count; done += ring_.entries()) {
+      if (submitChunk(requests + done, std::min<size_t>(ring_.entries(),
+                                                        count - done)) == -1)
+        return -1;
+    }
+    return 0;
+  }
+};
+
+/**
+ * @brief Creates the fastest backend available on this machine, io_uring if
+ * the kernel permits it, synchronous preads otherwise.
+ */
+inline std::unique_ptr<AsyncFileInput>
+makeAsyncFileInput(unsigned queue_depth = 256) {
+  auto ring = std::make_unique<IoUringFileInput>();
+  if (ring->init(queue_depth) == 0)
+    return ring;
+  return std::make_unique<SyncFileInput>();
+}
+
+} // namespace humming::util::io
@@ -6,6 +6,8 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <sys/uio.h> // For preadv
 #include <unistd.h> // For open, read, pread, close, lseek
 #include <vector>
 
@@ -27,13 +29,28 @@ private:
   char *current_data_ptr_;       // Points to the current position in the buffer
   size_t valid_bytes_in_buffer_; // How many bytes in the buffer are valid data
   bool direct_io_enabled_ = false;
+  // file range held in the buffer after preadView(), -1 when buffer holds
+  // sequential read() data instead
+  off_t view_offset_ = -1;
+  size_t view_bytes_ = 0;
+  // read system calls issued and bytes they returned, for metrics of callers
+  size_t syscalls_num_ = 0;
+  size_t bytes_read_ = 0;
+
+  void countRead(ssize_t bytes_read) {
+    ++syscalls_num_;
+    if (bytes_read > 0)
+      bytes_read_ += bytes_read;
+  }
 
   /**
    * @brief Refills the internal buffer from the file's current position.
    * @return Number of bytes read from file, 0 on EOF, -1 on error.
    */
   ssize_t fill_buffer() {
+    view_offset_ = -1;
     ssize_t bytes_read = ::read(fd_, buffer_.get(), buffer_size_);
+    countRead(bytes_read);
     if (bytes_read < 0) {
       perror("Error reading into buffer");
       valid_bytes_in_buffer_ = 0;
@@ -61,6 +78,8 @@ public:
   BufferedFileInput &operator=(const BufferedFileInput &) = delete;
 
   void passFd(int fd, bool use_direct_io = false) {
+    // descriptor number may be reused by another file
+    view_offset_ = -1;
     fd_ = fd;
     _fd_owner = false;
     direct_io_enabled_ = use_direct_io;
@@ -86,6 +105,7 @@ public:
       direct_io_enabled_ = false;
     }
 
+    view_offset_ = -1;
     fd_ = ::open(file_path.c_str(), flags);
     if (fd_ == -1) {
       perror("Error opening file");
@@ -156,6 +176,114 @@ public:
     return sizeof(size) + size;
   }
 
+  /**
+   * @brief Advances the file position of `read()` by bytes without copying
+   * them out, e.g. to step over padding.
+   * @return Number of bytes skipped, less than bytes on EOF, -1 on error.
+   */
+  ssize_t skip(size_t bytes) {
+    if (fd_ == -1)
+      return -1;
+    size_t total_bytes_skipped = 0;
+    while (total_bytes_skipped < bytes) {
+      size_t bytes_left_in_buffer =
+          valid_bytes_in_buffer_ - (current_data_ptr_ - buffer_.get());
+      if (bytes_left_in_buffer == 0) {
+        ssize_t fill_result = fill_buffer();
+        if (fill_result <= 0)
+          return (total_bytes_skipped > 0) ? total_bytes_skipped : fill_result;
+        bytes_left_in_buffer = valid_bytes_in_buffer_;
+      }
+      size_t bytes_to_skip =
+          std::min(bytes - total_bytes_skipped, bytes_left_in_buffer);
+      current_data_ptr_ += bytes_to_skip;
+      total_bytes_skipped += bytes_to_skip;
+    }
+    return total_bytes_skipped;
+  }
+
+  size_t bufferSize() const { return buffer_size_; }
+  bool directIo() const { return direct_io_enabled_; }
+  /**
+   * @brief Read system calls issued since construction, over all files.
+   */
+  size_t syscallsNum() const { return syscalls_num_; }
+  /**
+   * @brief Bytes returned by those calls, including sector padding and
+   * readahead.
+   */
+  size_t bytesRead() const { return bytes_read_; }
+
+  /**
+   * @brief Returns size bytes at offset as a pointer into the internal buffer,
+   * valid until the next read. The range is read with one pread, with O_DIRECT
+   * it's widened to the covering sectors; if the range lies in bytes loaded by
+   * the previous call no I/O is done. Doesn't use or change the file
+   * position, but invalidates the sequential `read()` buffer.
+   * @return nullptr on error, EOF before size bytes, or if the range doesn't
+   * fit in the buffer.
+   */
+  const char *preadView(off_t offset, size_t size) {
+    if (fd_ == -1)
+      return nullptr;
+    if (view_offset_ != -1 && offset >= view_offset_ &&
+        offset + size <= view_offset_ + view_bytes_)
+      return buffer_.get() + (offset - view_offset_);
+
+    // without O_DIRECT exact range is cheaper, kernel copies less
+    const off_t aligned_offset =
+        direct_io_enabled_ ? (offset / k_sector_size) * k_sector_size : offset;
+    const size_t aligned_size =
+        direct_io_enabled_
+            ? calculate_aligned_size(offset - aligned_offset + size)
+            : size;
+    if (aligned_size > buffer_size_)
+      return nullptr;
+    valid_bytes_in_buffer_ = 0;
+    current_data_ptr_ = buffer_.get();
+    ssize_t bytes_read =
+        ::pread(fd_, buffer_.get(), aligned_size, aligned_offset);
+    countRead(bytes_read);
+    if (bytes_read < 0) {
+      perror("pread failed");
+      view_offset_ = -1;
+      return nullptr;
+    }
+    view_offset_ = aligned_offset;
+    view_bytes_ = bytes_read;
+    if (offset + size > aligned_offset + size_t(bytes_read))
+      return nullptr;
+    return buffer_.get() + (offset - aligned_offset);
+  }
+
+  /**
+   * @brief Reads consecutive bytes starting at offset into several buffers
+   * with a single system call. With O_DIRECT every part is read on its own
+   * through pread(), as parts are rarely aligned.
+   * @return Number of bytes actually read, 0 on EOF, -1 on error.
+   */
+  ssize_t preadv(const iovec *parts, int parts_num, off_t offset) {
+    if (fd_ == -1)
+      return -1;
+    if (!direct_io_enabled_) {
+      const ssize_t bytes_read = ::preadv(fd_, parts, parts_num, offset);
+      countRead(bytes_read);
+      return bytes_read;
+    }
+    ssize_t total = 0;
+    for (int i = 0; i < parts_num; ++i) {
+      ssize_t bytes_read =
+          pread(static_cast<char *>(parts[i].iov_base), parts[i].iov_len,
+                offset + total);
+      if (bytes_read < 0)
+        return -1;
+      total += bytes_read;
+      if (size_t(bytes_read) < parts[i].iov_len)
+        break;
+    }
+    return total;
+  }
+
   /**
    * @brief Reads data from a specific offset in the file (random access).
    * This method uses the internal buffer to perform aligned reads, which will
@@ -172,7 +300,10 @@ public:
 
     if (!direct_io_enabled_) {
       // For non-direct I/O, we can just use the system call directly.
-      return ::pread(fd_, user_buffer, bytes_to_read, offset);
+      const ssize_t bytes_read =
+          ::pread(fd_, user_buffer, bytes_to_read, offset);
+      countRead(bytes_read);
+      return bytes_read;
     }
 
     bool user_buffer_is_aligned =
@@ -182,10 +313,14 @@ public:
 //    PLOGD << "user_buffer_is_aligned: " << user_buffer_is_aligned << " read_is_aligned: " << read_is_aligned;
     if (user_buffer_is_aligned && read_is_aligned && bytes_to_read > 0) {
 //      PLOGD << "direct pread";
-      return ::pread(fd_, user_buffer, bytes_to_read, offset);
+      const ssize_t bytes_read =
+          ::pread(fd_, user_buffer, bytes_to_read, offset);
+      countRead(bytes_read);
+      return bytes_read;
     }
 
     // O_DIRECT case: use the internal pre-allocated buffer in a loop.
+    view_offset_ = -1;
     size_t total_bytes_copied_to_user = 0;
     off_t current_file_offset = offset;
 
@@ -194,6 +329,7 @@ public:
           (current_file_offset / k_sector_size) * k_sector_size;
       ssize_t bytes_read_from_syscall =
           ::pread(fd_, buffer_.get(), buffer_size_, aligned_offset);
+      countRead(bytes_read_from_syscall);
 
       if (bytes_read_from_syscall < 0) {
         perror("pread failed");
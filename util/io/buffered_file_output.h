@@ -1,12 +1,16 @@
 #pragma once
 
 #include <algorithm> // For std::min
-#include <cstring>   // For memcpy
-#include <fcntl.h>   // For file control options (O_WRONLY, O_CREAT, etc.)
+#include <condition_variable>
+#include <cstring> // For memcpy
+#include <deque>
+#include <fcntl.h> // For file control options (O_WRONLY, O_CREAT, etc.)
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <new> // For std::bad_alloc
 #include <string>
+#include <thread>
 #include <unistd.h> // For open, write, close, ftruncate
 #include <vector>
 
@@ -21,32 +25,50 @@ namespace humming::util::io {
  *
  * This class maintains an in-memory buffer aligned to a sector size and writes
  * data to a file only when the buffer is full or when explicitly closed.
+ *
+ * With more than one buffer, full buffers are written by a background thread
+ * while the caller fills the next one, so serialization overlaps device I/O.
+ * Writeback may be paced with sync_file_range, which bounds dirty pages of a
+ * long sequential write instead of leaving all of them to the final sync.
  */
 class BufferedFileOutput {
 public:
 private:
+  typedef std::unique_ptr<char, AlignedBufferDeleter> Buffer;
+
   int fd_ = -1; // File descriptor, -1 indicates not open
   size_t buffer_size_;
-  std::unique_ptr<char, AlignedBufferDeleter> buffer_;
+  Buffer buffer_;
   size_t current_buffer_pos_ = 0;
   off_t total_bytes_written_ = 0;  // Tracks the true file size for O_DIRECT
   bool direct_io_enabled_ = false; // Flag to check if O_DIRECT is used
 
+  // pacing of writeback, state is only touched by the thread writing to fd_
+  size_t bytes_per_sync_;
+  off_t file_offset_ = 0;   // bytes passed to ::write so far
+  off_t synced_offset_ = 0; // end of range whose writeback was started
+
+  // background writing, used only with more than one buffer
+  size_t buffers_num_;
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<Buffer, size_t>> full_buffers_;
+  std::vector<Buffer> free_buffers_;
+  size_t writing_ = 0; // buffers taken by writer thread but not written yet
+  bool stop_writer_ = false;
+  bool failed_ = false;
+
   /**
-   * @brief Flushes the internal buffer to the file.
-   * Assumes the buffer is full when called, which is required for O_DIRECT.
+   * @brief Writes size bytes of data at the current file position.
    * @return 0 on success, -1 on failure.
    */
-  int flush() {
-    if (fd_ == -1 || current_buffer_pos_ == 0) {
-      return 0; // Nothing to flush or file not open
-    }
-
+  int writeAll(const char *data, size_t size) {
     size_t total_bytes_written_in_call = 0;
-    while (total_bytes_written_in_call < current_buffer_pos_) {
+    while (total_bytes_written_in_call < size) {
       ssize_t bytes_written_this_call =
-          ::write(fd_, buffer_.get() + total_bytes_written_in_call,
-                  current_buffer_pos_ - total_bytes_written_in_call);
+          ::write(fd_, data + total_bytes_written_in_call,
+                  size - total_bytes_written_in_call);
 
       if (bytes_written_this_call < 0) {
         perror("Error writing to file during flush");
@@ -54,20 +76,110 @@ private:
       }
       total_bytes_written_in_call += bytes_written_this_call;
     }
+    file_offset_ += size;
+    paceWriteback();
+    return 0;
+  }
+
+  /**
+   * @brief Every bytes_per_sync_ bytes starts writeback of the new range and
+   * waits for the one started before, so at most two ranges are in flight.
+   * Pointless with O_DIRECT, which leaves no dirty pages.
+   */
+  void paceWriteback() {
+    if (bytes_per_sync_ == 0 || direct_io_enabled_ ||
+        size_t(file_offset_ - synced_offset_) < bytes_per_sync_)
+      return;
+    if (sync_file_range(fd_, synced_offset_, file_offset_ - synced_offset_,
+                        SYNC_FILE_RANGE_WRITE) != 0)
+      perror("sync_file_range failed");
+    if (synced_offset_ > 0 &&
+        sync_file_range(fd_, 0, synced_offset_,
+                        SYNC_FILE_RANGE_WAIT_BEFORE) != 0)
+      perror("sync_file_range failed");
+    synced_offset_ = file_offset_;
+  }
+
+  void writerLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this] { return stop_writer_ || !full_buffers_.empty(); });
+      if (full_buffers_.empty())
+        return;
+      auto [buffer, size] = std::move(full_buffers_.front());
+      full_buffers_.pop_front();
+      ++writing_;
+      const bool failed = failed_;
+      lock.unlock();
+      const bool ok = failed || writeAll(buffer.get(), size) == 0;
+      lock.lock();
+      failed_ = failed_ || !ok;
+      --writing_;
+      free_buffers_.push_back(std::move(buffer));
+      cv_.notify_all();
+    }
+  }
+
+  /**
+   * @brief Flushes the internal buffer to the file, or with background
+   * writing hands it to the writer thread and takes a free buffer.
+   * Assumes the buffer is full when called, which is required for O_DIRECT.
+   * @return 0 on success, -1 on failure, including failures of earlier
+   * background writes.
+   */
+  int flush() {
+    if (fd_ == -1 || current_buffer_pos_ == 0) {
+      return 0; // Nothing to flush or file not open
+    }
 
+    if (buffers_num_ > 1) {
+      std::unique_lock lock(mutex_);
+      full_buffers_.emplace_back(std::move(buffer_), current_buffer_pos_);
+      cv_.notify_all();
+      cv_.wait(lock, [this] { return !free_buffers_.empty(); });
+      buffer_ = std::move(free_buffers_.back());
+      free_buffers_.pop_back();
+      current_buffer_pos_ = 0;
+      return failed_ ? -1 : 0;
+    }
+
+    if (writeAll(buffer_.get(), current_buffer_pos_) == -1)
+      return -1;
     current_buffer_pos_ = 0; // Reset buffer position
     return 0;
   }
 
+  /**
+   * @brief Waits until background writes handed over so far are done.
+   * @return 0 on success, -1 if any of them failed.
+   */
+  int drain() {
+    if (buffers_num_ <= 1)
+      return 0;
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this] { return full_buffers_.empty() && writing_ == 0; });
+    return failed_ ? -1 : 0;
+  }
+
 public:
   /**
    * @brief Constructs a BufferedFileOutput object with an aligned buffer.
    * @param buffer_size The desired minimum size of the internal buffer.
    * The actual size will be rounded up to a multiple of k_sector_size.
+   * @param buffers_num Number of buffers, with more than one full buffers are
+   * written by a background thread.
+   * @param bytes_per_sync Starts writeback every that many bytes, 0 leaves it
+   * to the kernel.
    */
-  explicit BufferedFileOutput(size_t buffer_size)
+  explicit BufferedFileOutput(size_t buffer_size, size_t buffers_num = 1,
+                              size_t bytes_per_sync = 0)
       : buffer_size_(calculate_aligned_size(buffer_size)),
-        buffer_(allocate_aligned_buffer(buffer_size_)) {}
+        buffer_(allocate_aligned_buffer(buffer_size_)),
+        bytes_per_sync_(bytes_per_sync),
+        buffers_num_(std::max<size_t>(1, buffers_num)) {
+    for (size_t b = 1; b < buffers_num_; ++b)
+      free_buffers_.emplace_back(allocate_aligned_buffer(buffer_size_));
+  }
 
   /**
    * @brief Destructor. Ensures the buffer is flushed and the file is closed
@@ -102,6 +214,10 @@ public:
       perror("Error opening file");
       return -1;
     }
+    total_bytes_written_ = file_offset_ = synced_offset_ = 0;
+    failed_ = stop_writer_ = false;
+    if (buffers_num_ > 1)
+      writer_ = std::thread([this] { writerLoop(); });
     return 0;
   }
 
@@ -141,6 +257,22 @@ public:
     return bytes;
   }
 
+  /**
+   * @brief Writes buffered data to the file, so it's visible to other
+   * descriptors and can be synced. Only available without O_DIRECT, where
+   * partial buffer can't be written.
+   * @return 0 on success, -1 on failure.
+   */
+  int flushBuffer() {
+    if (direct_io_enabled_)
+      return -1;
+    if (flush() == -1)
+      return -1;
+    return drain();
+  }
+
+  int fd() const { return fd_; }
+
   template <typename T> int writeSimple(T &val) {
     return write((const char *)&val, sizeof(val));
   }
@@ -157,34 +289,42 @@ public:
   /**
    * @brief Flushes any remaining data and closes the file. Handles O_DIRECT
    * requirements.
+   * @param sync If true, waits until data is durable before closing.
    * @return 0 on success, -1 on failure.
    */
-  int close() {
+  int close(bool sync = false) {
     if (fd_ == -1) {
       return 0;
     }
 
     int result = 0;
 
-    if (direct_io_enabled_) {
-      if (current_buffer_pos_ > 0) {
-        size_t aligned_write_size = calculate_aligned_size(current_buffer_pos_);
-        memset(buffer_.get() + current_buffer_pos_, 0,
-               aligned_write_size - current_buffer_pos_);
-
-        if (::write(fd_, buffer_.get(), aligned_write_size) < 0) {
-          perror("Error on final padded write for O_DIRECT");
-          result = -1;
-        }
-      }
-      if (result == 0 && ftruncate(fd_, total_bytes_written_) != 0) {
-        perror("Error truncating file for O_DIRECT");
-        result = -1;
-      }
-    } else {
-      if (flush() == -1) {
-        result = -1;
+    if (direct_io_enabled_ && current_buffer_pos_ > 0) {
+      // final write is padded to whole sectors and truncated below
+      size_t aligned_write_size = calculate_aligned_size(current_buffer_pos_);
+      memset(buffer_.get() + current_buffer_pos_, 0,
+             aligned_write_size - current_buffer_pos_);
+      current_buffer_pos_ = aligned_write_size;
+    }
+    if (flush() == -1 || drain() == -1)
+      result = -1;
+    if (writer_.joinable()) {
+      {
+        std::lock_guard lock(mutex_);
+        stop_writer_ = true;
       }
+      cv_.notify_all();
+      writer_.join();
+    }
+    if (direct_io_enabled_ && result == 0 &&
+        ftruncate(fd_, total_bytes_written_) != 0) {
+      perror("Error truncating file for O_DIRECT");
+      result = -1;
+    }
+
+    if (sync && result == 0 && fdatasync(fd_) != 0) {
+      perror("Error syncing file");
+      result = -1;
     }
 
     if (::close(fd_) != 0 && result == 0) {
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cerrno>
 #include <cstdlib> // For aligned_alloc, free
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace humming::util::io {
 
@@ -37,4 +40,20 @@ static char *allocate_aligned_buffer(size_t size) {
   return static_cast<char *>(ptr);
 }
 
+/**
+ * @brief Makes entries of the directory at path durable: files created,
+ * renamed or removed in it are found after a crash only once it's synced.
+ * @return 0 on success, -1 on error with errno set.
+ */
+inline int sync_directory(const char *path) {
+  const int fd = ::open(path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return -1;
+  const int result = ::fsync(fd);
+  const int error = errno;
+  ::close(fd);
+  errno = error;
+  return result;
+}
+
 } // namespace humming::util::io
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <lz4.h>
+#include <zstd.h>
+
+namespace humming::util::io {
+
+// Codec of a block of bytes, stored in files, so values never change.
+enum class Compression : uint8_t { k_none = 0, k_lz4 = 1, k_zstd = 2 };
+
+/**
+ * @brief Returns the largest size compress() may produce for size bytes, 0
+ * if size is beyond what the codec takes.
+ */
+inline size_t compressBound(Compression compression, size_t size) {
+  switch (compression) {
+  case Compression::k_lz4:
+    return size > LZ4_MAX_INPUT_SIZE ? 0 : LZ4_compressBound(int(size));
+  case Compression::k_zstd:
+    return ZSTD_compressBound(size);
+  default:
+    return size;
+  }
+}
+
+/**
+ * @brief Compresses size bytes of data into out, which must have room for
+ * compressBound() bytes. Contexts of Zstd are kept per thread.
+ * @param level Zstd compression level, ignored by LZ4.
+ * @return Compressed size, 0 on error or for Compression::k_none.
+ */
+inline size_t compress(Compression compression, const char *data, size_t size,
+                       char *out, int level = 1) {
+  switch (compression) {
+  case Compression::k_lz4: {
+    if (size > LZ4_MAX_INPUT_SIZE)
+      return 0;
+    const int compressed = LZ4_compress_default(
+        data, out, int(size), int(compressBound(compression, size)));
+    return compressed > 0 ? size_t(compressed) : 0;
+  }
+  case Compression::k_zstd: {
+    static thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)>
+        context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    const size_t compressed =
+        ZSTD_compressCCtx(context.get(), out, compressBound(compression, size),
+                          data, size, level);
+    return ZSTD_isError(compressed) ? 0 : compressed;
+  }
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Decompresses size bytes of data into exactly raw_size bytes at out.
+ * @return false if data is corrupted or doesn't decompress to raw_size bytes.
+ */
+inline bool decompress(Compression compression, const char *data, size_t size,
+                       char *out, size_t raw_size) {
+  switch (compression) {
+  case Compression::k_lz4:
+    return LZ4_decompress_safe(data, out, int(size), int(raw_size)) ==
+           int(raw_size);
+  case Compression::k_zstd: {
+    static thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)>
+        context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    const size_t decompressed =
+        ZSTD_decompressDCtx(context.get(), out, raw_size, data, size);
+    return decompressed == raw_size;
+  }
+  default:
+    return false;
+  }
+}
+
+} // namespace humming::util::io
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace humming::util::io {
+
+namespace detail {
+
+constexpr std::array<uint32_t, 256> makeCrc32cTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr std::array<uint32_t, 256> k_crc32c_table = makeCrc32cTable();
+
+} // namespace detail
+
+/**
+ * @brief CRC-32C (Castagnoli) of data, crc allows to continue a checksum of
+ * preceding bytes.
+ */
+inline uint32_t crc32c(const char *data, size_t size, uint32_t crc = 0) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = detail::k_crc32c_table[(crc ^ uint8_t(data[i])) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+} // namespace humming::util::io
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <cstring> // For memset
+#include <cstdio>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h> // For pread, close, syscall
+
+namespace humming::util::io {
+
+/**
+ * @class IoRing
+ * @brief An io_uring of positional reads driven by a single thread.
+ *
+ * Reads are queued with push(), handed to the kernel by enter() and their
+ * completions are taken with reap(). Uses raw syscalls so there is no
+ * dependency on liburing. Coroutines await reads through read(), which
+ * suspends until resume() reaps its completion, or reads synchronously when
+ * the ring could not be set up.
+ */
+class IoRing {
+private:
+  int ring_fd_ = -1;
+  unsigned sq_entries_ = 0;
+  void *sq_ring_ = MAP_FAILED;
+  void *cq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  io_uring_cqe *cqes_;
+
+  // pushed reads not handed to the kernel yet, and reads not reaped yet
+  unsigned unsubmitted_ = 0;
+  size_t in_flight_ = 0;
+
+  static unsigned loadAcquire(unsigned *p) {
+    return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+  }
+  static void storeRelease(unsigned *p, unsigned v) {
+    std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+  }
+
+  void release() {
+    if (sqes_ != MAP_FAILED)
+      munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+      munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ != -1)
+      ::close(ring_fd_);
+    sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+    sq_ring_ = cq_ring_ = MAP_FAILED;
+    ring_fd_ = -1;
+  }
+
+public:
+  IoRing() = default;
+  ~IoRing() { release(); }
+
+  IoRing(const IoRing &) = delete;
+  IoRing &operator=(const IoRing &) = delete;
+
+  /**
+   * @brief Sets up the ring.
+   * @param queue_depth Requested number of submission queue entries.
+   * @return 0 on success, -1 if io_uring is not available.
+   */
+  int init(unsigned queue_depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (ring_fd_ < 0) {
+      ring_fd_ = -1;
+      return -1;
+    }
+    sq_entries_ = params.sq_entries;
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      release();
+      return -1;
+    }
+    cq_ring_ = single_mmap
+                   ? sq_ring_
+                   : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_,
+                          IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(
+        mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+      release();
+      return -1;
+    }
+
+    char *sq = static_cast<char *>(sq_ring_);
+    char *cq = static_cast<char *>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return 0;
+  }
+
+  bool initialized() const { return ring_fd_ != -1; }
+  unsigned entries() const { return sq_entries_; }
+  // reads pushed and not reaped yet
+  size_t inFlight() const { return in_flight_; }
+
+  /**
+   * @brief Queues a read, user_data comes back with its completion.
+   * @return false if the submission queue is full, enter() then frees it.
+   */
+  bool push(int fd, char *buffer, size_t size, off_t offset,
+            uint64_t user_data) {
+    const unsigned tail = *sq_tail_;
+    if (tail - loadAcquire(sq_head_) >= sq_entries_)
+      return false;
+    const unsigned index = tail & *sq_mask_;
+    io_uring_sqe &sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uintptr_t>(buffer);
+    sqe.len = size;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    sq_array_[index] = index;
+    storeRelease(sq_tail_, tail + 1);
+    ++unsubmitted_;
+    ++in_flight_;
+    return true;
+  }
+
+  /**
+   * @brief Hands queued reads to the kernel with one io_uring_enter and waits
+   * until at least min_complete reads are complete.
+   * @return 0 on success, -1 on failure.
+   */
+  int enter(unsigned min_complete) {
+    while (true) {
+      const int ret =
+          syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_, min_complete,
+                  min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (ret >= 0) {
+        unsubmitted_ -= std::min<unsigned>(unsubmitted_, ret);
+        return 0;
+      }
+      if (errno != EINTR) {
+        perror("io_uring_enter failed");
+        return -1;
+      }
+    }
+  }
+
+  /**
+   * @brief Calls complete(user_data, result) for every completed read, result
+   * is the number of bytes read or -errno.
+   * @return Number of completions reaped.
+   */
+  template <typename Complete> size_t reap(Complete &&complete) {
+    size_t reaped = 0;
+    unsigned head = *cq_head_;
+    while (head != loadAcquire(cq_tail_)) {
+      const io_uring_cqe cqe = cqes_[head & *cq_mask_];
+      // the entry is given back first, complete may queue and reap more
+      storeRelease(cq_head_, ++head);
+      --in_flight_;
+      ++reaped;
+      complete(cqe.user_data, cqe.res);
+      head = *cq_head_;
+    }
+    return reaped;
+  }
+
+  /**
+   * @class Read
+   * @brief Awaitable positional read, resumes its coroutine with the number
+   * of bytes read or -errno.
+   */
+  class Read {
+  private:
+    IoRing &ring_;
+    int fd_;
+    char *buffer_;
+    size_t size_;
+    off_t offset_;
+    std::coroutine_handle<> handle_;
+    ssize_t result_ = 0;
+
+    void readSync() {
+      result_ = ::pread(fd_, buffer_, size_, offset_);
+      if (result_ < 0)
+        result_ = -errno;
+    }
+
+  public:
+    Read(IoRing &ring, int fd, char *buffer, size_t size, off_t offset)
+        : ring_(ring), fd_(fd), buffer_(buffer), size_(size),
+          offset_(offset) {}
+
+    bool await_ready() {
+      if (ring_.initialized())
+        return false;
+      readSync();
+      return true;
+    }
+    // returns false to continue right away once the read is done without
+    // the ring
+    bool await_suspend(std::coroutine_handle<> handle) {
+      handle_ = handle;
+      while (!ring_.push(fd_, buffer_, size_, offset_,
+                         reinterpret_cast<uintptr_t>(this))) {
+        if (ring_.enter(0) == -1) {
+          readSync();
+          return false;
+        }
+      }
+      return true;
+    }
+    ssize_t await_resume() const { return result_; }
+
+    // reap() callback of reads pushed by await_suspend
+    static void complete(uint64_t user_data, int32_t result) {
+      Read &read = *reinterpret_cast<Read *>(user_data);
+      read.result_ = result;
+      // Kernels without IORING_OP_READ reject it, serve those synchronously.
+      if (result == -EINVAL)
+        read.readSync();
+      read.handle_.resume();
+    }
+  };
+
+  Read read(int fd, char *buffer, size_t size, off_t offset) {
+    return Read(*this, fd, buffer, size, offset);
+  }
+
+  /**
+   * @brief Submits queued reads and resumes coroutines of completed ones,
+   * waiting for at least one completion if wait is set and reads are in
+   * flight.
+   * @return Number of coroutines resumed, or -1 if the ring failed.
+   */
+  ssize_t resume(bool wait) {
+    if (!initialized() || in_flight_ == 0)
+      return 0;
+    if ((unsubmitted_ > 0 || wait) && enter(wait ? 1 : 0) == -1)
+      return -1;
+    return reap(Read::complete);
+  }
+};
+
+} // namespace humming::util::io
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>     // For perror
+#include <sys/mman.h> // For mmap, madvise, munmap
+#include <unistd.h>
+
+#include "util/io/common.h"
+
+namespace humming::util::io {
+
+/**
+ * @class MmapFileInput
+ * @brief Read-only mapping of a whole file, data is accessed through pointers
+ * instead of read system calls.
+ *
+ * Suits files mostly resident in memory, a read of a resident page costs no
+ * system call. Pages that are not resident are faulted in synchronously.
+ */
+class MmapFileInput {
+private:
+  char *data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  MmapFileInput() = default;
+  ~MmapFileInput() { unmap(); }
+
+  MmapFileInput(const MmapFileInput &) = delete;
+  MmapFileInput &operator=(const MmapFileInput &) = delete;
+  MmapFileInput(MmapFileInput &&other)
+      : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  MmapFileInput &operator=(MmapFileInput &&other) {
+    if (this != &other) {
+      unmap();
+      data_ = other.data_;
+      size_ = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Maps first size bytes of the file, descriptor may be closed after.
+   * @return 0 on success, -1 on failure.
+   */
+  int map(int fd, size_t size) {
+    unmap();
+    if (size == 0)
+      return 0;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      perror("Error mapping file");
+      return -1;
+    }
+    data_ = static_cast<char *>(data);
+    size_ = size;
+    return 0;
+  }
+
+  void unmap() {
+    if (data_ != nullptr && munmap(data_, size_) != 0)
+      perror("Error unmapping file");
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  /**
+   * @brief Gives the kernel an access pattern hint for a range, e.g.
+   * MADV_RANDOM or MADV_WILLNEED. Range start is rounded down to a page.
+   * @return 0 on success, -1 on failure.
+   */
+  int advise(size_t offset, size_t length, int advice) const {
+    if (data_ == nullptr || offset >= size_)
+      return 0;
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t aligned_offset = offset / page_size * page_size;
+    length =
+        std::min(length + (offset - aligned_offset), size_ - aligned_offset);
+    if (madvise(data_ + aligned_offset, length, advice) != 0) {
+      perror("madvise failed");
+      return -1;
+    }
+    return 0;
+  }
+
+  bool mapped() const { return data_ != nullptr; }
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Returns pointer to size bytes at offset, nullptr if the range is
+   * outside of the mapping.
+   */
+  const char *view(size_t offset, size_t size) const {
+    if (offset > size_ || size > size_ - offset)
+      return nullptr;
+    return data_ + offset;
+  }
+};
+
+} // namespace humming::util::io
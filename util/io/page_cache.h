@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <cstring> // For memcpy, memset
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "util/io/common.h"
+
+namespace humming::util::io {
+
+/**
+ * @class PageCache
+ * @brief Fixed budget cache of k_sector_size pages shared by all readers.
+ *
+ * Pages are keyed by (file id, page offset) and live in sector aligned frames,
+ * so they can be loaded with O_DIRECT. The cache is split into shards, each
+ * with its own lock, map and CLOCK hand. Readers get pinned handles, a pinned
+ * frame is never evicted. Loading happens outside of the shard lock, readers
+ * of a page being loaded wait for it.
+ */
+class PageCache {
+private:
+  struct Key {
+    uint64_t _file_id;
+    size_t _offset;
+    bool operator==(const Key &other) const {
+      return _file_id == other._file_id && _offset == other._offset;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return (key._file_id * 0x9E3779B97F4A7C15ull) ^
+             (key._offset / k_sector_size * 0xC2B2AE3D27D4EB4Full);
+    }
+  };
+
+  enum State : uint32_t { k_free, k_loading, k_ready };
+  struct Frame {
+    Key _key;
+    char *_data;
+    std::atomic<uint32_t> _pins{0};
+    std::atomic<uint32_t> _state{k_free};
+    std::atomic<bool> _referenced{false};
+  };
+
+  struct alignas(64) Shard {
+    std::mutex _mutex;
+    std::unordered_map<Key, Frame *, KeyHash> _map;
+    std::unique_ptr<Frame[]> _frames;
+    size_t _frames_num = 0;
+    size_t _clock_hand = 0;
+    std::atomic<size_t> _hits{0};
+    std::atomic<size_t> _misses{0};
+  };
+
+  size_t _shards_num;
+  std::unique_ptr<char, AlignedBufferDeleter> _memory;
+  std::unique_ptr<Shard[]> _shards;
+
+  Shard &shard(const Key &key) {
+    return _shards[KeyHash()(key) % _shards_num];
+  }
+
+  // Picks unpinned frame that was not referenced since last sweep. Returns
+  // nullptr if all frames are pinned. Requires shard lock.
+  static Frame *evict(Shard &shard) {
+    for (size_t i = 0; i < 2 * shard._frames_num; ++i) {
+      Frame &frame = shard._frames[shard._clock_hand];
+      shard._clock_hand = (shard._clock_hand + 1) % shard._frames_num;
+      if (frame._pins.load(std::memory_order_acquire) > 0)
+        continue;
+      if (frame._referenced.exchange(false, std::memory_order_relaxed))
+        continue;
+      if (frame._state.load(std::memory_order_relaxed) != k_free)
+        shard._map.erase(frame._key);
+      frame._state.store(k_free, std::memory_order_relaxed);
+      return &frame;
+    }
+    return nullptr;
+  }
+
+public:
+  /**
+   * @brief Pinned reference to a cached page, frame stays in the cache until
+   * the handle is released or destroyed.
+   */
+  class Handle {
+  private:
+    Frame *_frame = nullptr;
+
+  public:
+    Handle() = default;
+    explicit Handle(Frame *frame) : _frame(frame) {}
+    Handle(Handle &&other) : _frame(other._frame) { other._frame = nullptr; }
+    Handle &operator=(Handle &&other) {
+      if (this != &other) {
+        release();
+        _frame = other._frame;
+        other._frame = nullptr;
+      }
+      return *this;
+    }
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+    ~Handle() { release(); }
+
+    void release() {
+      if (_frame)
+        _frame->_pins.fetch_sub(1, std::memory_order_release);
+      _frame = nullptr;
+    }
+    explicit operator bool() const { return _frame != nullptr; }
+    const char *data() const { return _frame->_data; }
+  };
+
+  /**
+   * @brief Creates a cache holding up to budget_bytes of pages.
+   * @param budget_bytes Memory budget, rounded down to whole pages per shard.
+   * @param shards_num Number of independently locked shards.
+   */
+  explicit PageCache(size_t budget_bytes, size_t shards_num = 16)
+      : _shards_num(shards_num), _shards(new Shard[shards_num]) {
+    size_t frames_per_shard =
+        std::max<size_t>(1, budget_bytes / k_sector_size / shards_num);
+    _memory.reset(
+        allocate_aligned_buffer(frames_per_shard * shards_num * k_sector_size));
+    char *data = _memory.get();
+    for (size_t s = 0; s < shards_num; ++s) {
+      Shard &shard = _shards[s];
+      shard._frames.reset(new Frame[frames_per_shard]);
+      shard._frames_num = frames_per_shard;
+      shard._map.reserve(frames_per_shard);
+      for (size_t f = 0; f < frames_per_shard; ++f, data += k_sector_size)
+        shard._frames[f]._data = data;
+    }
+  }
+
+  PageCache(const PageCache &) = delete;
+  PageCache &operator=(const PageCache &) = delete;
+
+  /**
+   * @brief Returns pinned page, loading it on a miss.
+   * @param file_id Unique id of the file, ids must not be reused.
+   * @param offset Page offset, multiple of k_sector_size.
+   * @param load Callable `bool(char *frame)` filling k_sector_size bytes.
+   * @return Empty handle if loading failed or all frames are pinned, the
+   * caller should then read the page on its own.
+   */
+  template <typename Loader>
+  Handle get(uint64_t file_id, size_t offset, Loader &&load) {
+    const Key key{file_id, offset};
+    Shard &s = shard(key);
+    Frame *frame;
+    bool loading = false;
+    {
+      std::lock_guard lock(s._mutex);
+      if (auto it = s._map.find(key); it != s._map.end()) {
+        frame = it->second;
+        frame->_pins.fetch_add(1, std::memory_order_acquire);
+        frame->_referenced.store(true, std::memory_order_relaxed);
+        s._hits.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        s._misses.fetch_add(1, std::memory_order_relaxed);
+        frame = evict(s);
+        if (frame == nullptr)
+          return {};
+        frame->_key = key;
+        frame->_pins.store(1, std::memory_order_relaxed);
+        frame->_state.store(k_loading, std::memory_order_relaxed);
+        s._map.emplace(key, frame);
+        loading = true;
+      }
+    }
+    if (!loading) {
+      // wait until other reader finishes loading the page
+      uint32_t state;
+      while ((state = frame->_state.load(std::memory_order_acquire)) ==
+             k_loading)
+        std::this_thread::yield();
+      if (state != k_ready) {
+        frame->_pins.fetch_sub(1, std::memory_order_release);
+        return {};
+      }
+      return Handle(frame);
+    }
+
+    if (load(frame->_data)) {
+      frame->_state.store(k_ready, std::memory_order_release);
+      return Handle(frame);
+    }
+    std::lock_guard lock(s._mutex);
+    s._map.erase(key);
+    frame->_state.store(k_free, std::memory_order_release);
+    frame->_pins.fetch_sub(1, std::memory_order_release);
+    return {};
+  }
+
+  /**
+   * @brief Returns pinned page if it's already cached, never loads it.
+   */
+  Handle find(uint64_t file_id, size_t offset) {
+    const Key key{file_id, offset};
+    Shard &s = shard(key);
+    std::lock_guard lock(s._mutex);
+    auto it = s._map.find(key);
+    if (it == s._map.end() ||
+        it->second->_state.load(std::memory_order_acquire) != k_ready) {
+      s._misses.fetch_add(1, std::memory_order_relaxed);
+      return {};
+    }
+    it->second->_pins.fetch_add(1, std::memory_order_acquire);
+    it->second->_referenced.store(true, std::memory_order_relaxed);
+    s._hits.fetch_add(1, std::memory_order_relaxed);
+    return Handle(it->second);
+  }
+
+  /**
+   * @brief Copies size bytes at offset of a file, possibly spanning many
+   * pages, loading missing pages with `load_page(char *frame, size_t
+   * page_offset)`. Pages that cannot get a frame are read into a temporary
+   * buffer.
+   * @return false if some page could not be read.
+   */
+  template <typename PageLoader>
+  bool read(uint64_t file_id, size_t offset, char *out, size_t size,
+            PageLoader &&load_page) {
+    while (size > 0) {
+      const size_t page_offset = offset / k_sector_size * k_sector_size;
+      Handle page = get(file_id, page_offset, [&](char *frame) {
+        return load_page(frame, page_offset);
+      });
+      alignas(k_sector_size) char uncached[k_sector_size];
+      const char *data = uncached;
+      if (page)
+        data = page.data();
+      else if (!load_page(uncached, page_offset))
+        return false;
+      const size_t in_page =
+          std::min(size, k_sector_size - (offset - page_offset));
+      memcpy(out, data + (offset - page_offset), in_page);
+      out += in_page;
+      offset += in_page;
+      size -= in_page;
+    }
+    return true;
+  }
+
+  size_t hits() const {
+    size_t hits = 0;
+    for (size_t s = 0; s < _shards_num; ++s)
+      hits += _shards[s]._hits.load(std::memory_order_relaxed);
+    return hits;
+  }
+  size_t misses() const {
+    size_t misses = 0;
+    for (size_t s = 0; s < _shards_num; ++s)
+      misses += _shards[s]._misses.load(std::memory_order_relaxed);
+    return misses;
+  }
+  size_t byteSize() const {
+    return _shards_num * _shards[0]._frames_num * k_sector_size;
+  }
+};
+
+} // namespace humming::util::io
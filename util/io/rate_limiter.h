@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace humming::util::io {
+
+/**
+ * @class RateLimiter
+ * @brief Paces background I/O to a number of bytes per second.
+ *
+ * Every request moves forward the moment at which all granted bytes would be
+ * transferred at the configured rate, callers sleep until then. Requests are
+ * cheap, so they can be made per record.
+ */
+class RateLimiter {
+private:
+  using clock = std::chrono::steady_clock;
+
+  size_t _bytes_per_second;
+  std::mutex _mutex;
+  clock::time_point _next_free = clock::now();
+
+public:
+  /**
+   * @param bytes_per_second Allowed rate, 0 means unlimited.
+   */
+  explicit RateLimiter(size_t bytes_per_second = 0)
+      : _bytes_per_second(bytes_per_second) {}
+
+  void setRate(size_t bytes_per_second) {
+    std::lock_guard lock(_mutex);
+    _bytes_per_second = bytes_per_second;
+  }
+
+  /**
+   * @brief Blocks until transferring bytes fits within the rate.
+   */
+  void request(size_t bytes) {
+    clock::duration wait;
+    {
+      std::lock_guard lock(_mutex);
+      if (_bytes_per_second == 0)
+        return;
+      auto now = clock::now();
+      // unused budget does not accumulate over idle periods
+      if (_next_free < now)
+        _next_free = now;
+      _next_free += std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(double(bytes) / _bytes_per_second));
+      wait = _next_free - now;
+    }
+    // short waits are merged into following ones to avoid sleeping per record
+    if (wait > std::chrono::milliseconds(1))
+      std::this_thread::sleep_for(wait);
+  }
+};
+
+} // namespace humming::util::io
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace humming::util::io {
+
+// Longest LEB128 encoding of a 64 bit value.
+static constexpr size_t k_max_varint_size = 10;
+
+/**
+ * @brief Returns number of bytes of LEB128 encoding of value, 7 bits per
+ * byte.
+ */
+inline size_t varintSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    ++size;
+  return size;
+}
+
+/**
+ * @brief Writes LEB128 encoding of value to out, which must have room for
+ * varintSize(value) bytes.
+ * @return Number of bytes written.
+ */
+inline size_t encodeVarint(char *out, uint64_t value) {
+  size_t size = 0;
+  for (; value >= 0x80; value >>= 7)
+    out[size++] = char(value | 0x80);
+  out[size++] = char(value);
+  return size;
+}
+
+/**
+ * @brief Decodes LEB128 value from bytes in [data, end).
+ * @return Number of bytes consumed, 0 if the encoding is truncated or longer
+ * than k_max_varint_size.
+ */
+inline size_t decodeVarint(const char *data, const char *end,
+                           uint64_t &value) {
+  value = 0;
+  for (size_t size = 0; size < k_max_varint_size && data + size < end;
+       ++size) {
+    const uint8_t byte = data[size];
+    value |= uint64_t(byte & 0x7f) << (7 * size);
+    if ((byte & 0x80) == 0)
+      return size + 1;
+  }
+  return 0;
+}
+
+} // namespace humming::util::io
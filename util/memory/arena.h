@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring> // For memcpy
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace humming::util::memory {
+
+/**
+ * @class Arena
+ * @brief Bump allocator handing out memory from large chunks.
+ *
+ * Memory is never freed piecewise, clear() releases all allocations at once
+ * but keeps the chunks, so an arena reused for similar work stops allocating
+ * from the heap. Not thread-safe.
+ */
+class Arena {
+private:
+  struct Chunk {
+    std::unique_ptr<char[]> data_;
+    size_t size_;
+  };
+
+  size_t chunk_size_;
+  std::vector<Chunk> chunks_;
+  // chunk that will be used when the current one runs out
+  size_t next_chunk_ = 0;
+  char *pos_ = nullptr;
+  char *end_ = nullptr;
+  size_t allocated_bytes_ = 0;
+
+  static char *align(char *p, size_t alignment) {
+    return reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(alignment - 1));
+  }
+
+  // moves to the first unused chunk of at least min_size bytes, chunks too
+  // small for it are skipped until clear()
+  void nextChunk(size_t min_size) {
+    for (; next_chunk_ < chunks_.size(); ++next_chunk_) {
+      if (chunks_[next_chunk_].size_ >= min_size)
+        break;
+    }
+    if (next_chunk_ == chunks_.size()) {
+      const size_t size = std::max(chunk_size_, min_size);
+      chunks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    }
+    Chunk &chunk = chunks_[next_chunk_++];
+    pos_ = chunk.data_.get();
+    end_ = pos_ + chunk.size_;
+  }
+
+public:
+  /**
+   * @brief Creates an empty arena, nothing is allocated before first use.
+   * @param chunk_size Size of chunks, larger allocations get their own chunk.
+   */
+  explicit Arena(size_t chunk_size = 1 << 20) : chunk_size_(chunk_size) {}
+
+  Arena(Arena &&) = default;
+  Arena &operator=(Arena &&) = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  /**
+   * @brief Returns size bytes valid until clear() or destruction.
+   * @param alignment Power of two the address is a multiple of.
+   */
+  char *allocate(size_t size, size_t alignment = 1) {
+    char *p = align(pos_, alignment);
+    if (pos_ == nullptr || size > size_t(end_ - p)) {
+      nextChunk(size + alignment - 1);
+      p = align(pos_, alignment);
+    }
+    pos_ = p + size;
+    allocated_bytes_ += size;
+    return p;
+  }
+
+  /**
+   * @brief Copies s into the arena.
+   */
+  std::string_view copy(std::string_view s) {
+    if (s.empty())
+      return {};
+    char *p = allocate(s.size());
+    memcpy(p, s.data(), s.size());
+    return {p, s.size()};
+  }
+
+  /**
+   * @brief Invalidates all allocations, chunks are kept for reuse.
+   */
+  void clear() {
+    next_chunk_ = 0;
+    pos_ = end_ = nullptr;
+    allocated_bytes_ = 0;
+  }
+
+  size_t allocatedBytes() const { return allocated_bytes_; }
+  size_t reservedBytes() const {
+    size_t bytes = 0;
+    for (const auto &chunk : chunks_)
+      bytes += chunk.size_;
+    return bytes;
+  }
+};
+
+} // namespace humming::util::memory
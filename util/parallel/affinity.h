@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace humming::util::parallel {
+
+/**
+ * @brief CPUs the process is allowed to run on, ascending.
+ */
+inline std::vector<size_t> allowedCpus() {
+  std::vector<size_t> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    perror("sched_getaffinity failed");
+    return cpus;
+  }
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+/**
+ * @brief CPUs of a NUMA node, as listed by sysfs in ranges like "0-3,8-11".
+ * @return Empty if the node does not exist or the kernel has no NUMA support.
+ */
+inline std::vector<size_t> numaNodeCpus(size_t node) {
+  std::vector<size_t> cpus;
+  std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) +
+                   "/cpulist");
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    size_t first, last;
+    const int matched = sscanf(range.c_str(), "%zu-%zu", &first, &last);
+    if (matched < 1)
+      continue;
+    if (matched == 1)
+      last = first;
+    for (size_t cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+/**
+ * @brief Restricts the calling thread to run only on cpu.
+ * @return 0 on success, -1 on error.
+ */
+inline int pinCurrentThread(size_t cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_setaffinity_np failed");
+    return -1;
+  }
+  return 0;
+}
+
+} // namespace humming::util::parallel
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace humming::util::parallel {
+
+/**
+ * @brief Number of threads to use when the caller has no preference.
+ */
+inline size_t defaultThreadsNum() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief Splits [0, size) into at most threads_num contiguous chunks and runs
+ * `body(size_t thread_id, size_t begin, size_t end)` for each on its own
+ * thread. The calling thread processes the first chunk.
+ * @param min_chunk Chunks are never smaller than this, so small inputs don't
+ * pay for thread creation.
+ */
+template <typename Body>
+void parallelFor(size_t size, size_t threads_num, Body &&body,
+                 size_t min_chunk = 1) {
+  threads_num = std::clamp<size_t>(size / std::max<size_t>(1, min_chunk), 1,
+                                   std::max<size_t>(1, threads_num));
+  const size_t chunk = (size + threads_num - 1) / threads_num;
+  std::vector<std::thread> threads;
+  threads.reserve(threads_num - 1);
+  for (size_t t = 1; t < threads_num; ++t) {
+    const size_t begin = std::min(size, t * chunk);
+    const size_t end = std::min(size, begin + chunk);
+    threads.emplace_back([&body, t, begin, end] { body(t, begin, end); });
+  }
+  body(0, 0, std::min(size, chunk));
+  for (auto &thread : threads)
+    thread.join();
+}
+
+} // namespace humming::util::parallel
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "util/parallel/parallel_for.h"
+
+namespace humming::util::parallel {
+
+/**
+ * @brief Sorts items by `uint64_t key(const T &)` using threads_num threads.
+ *
+ * One MSD radix pass distributes items by the top k_radix_bits of the key into
+ * buckets: every thread builds a histogram of its chunk, then scatters the
+ * chunk into its own slice of each bucket. Buckets are then finished
+ * independently with std::sort, each fits in cache for uniform keys such as
+ * hashes. The sort is not stable.
+ */
+template <typename T, typename Key>
+void parallelRadixSort(std::vector<T> &items, Key &&key, size_t threads_num) {
+  constexpr size_t k_radix_bits = 11;
+  constexpr size_t k_buckets_num = size_t(1) << k_radix_bits;
+  // below it a single std::sort beats the extra pass
+  constexpr size_t k_min_size = 1 << 14;
+  auto less = [&key](const T &l, const T &r) { return key(l) < key(r); };
+  const size_t size = items.size();
+  if (size < k_min_size) {
+    std::sort(items.begin(), items.end(), less);
+    return;
+  }
+  auto bucket = [&key](const T &item) {
+    return size_t(uint64_t(key(item)) >> (64 - k_radix_bits));
+  };
+  threads_num = std::clamp<size_t>(threads_num, 1, size / k_min_size);
+
+  // histograms[t * k_buckets_num + b] becomes the position of thread t in b
+  std::vector<size_t> histograms(threads_num * k_buckets_num);
+  parallelFor(size, threads_num, [&](size_t t, size_t begin, size_t end) {
+    size_t *histogram = &histograms[t * k_buckets_num];
+    for (size_t i = begin; i < end; ++i)
+      ++histogram[bucket(items[i])];
+  });
+  std::vector<size_t> bucket_begins(k_buckets_num + 1);
+  size_t position = 0;
+  for (size_t b = 0; b < k_buckets_num; ++b) {
+    bucket_begins[b] = position;
+    for (size_t t = 0; t < threads_num; ++t) {
+      const size_t count = histograms[t * k_buckets_num + b];
+      histograms[t * k_buckets_num + b] = position;
+      position += count;
+    }
+  }
+  bucket_begins[k_buckets_num] = size;
+
+  // both passes use the same chunks, as parallelFor splits deterministically
+  std::vector<T> sorted(size);
+  parallelFor(size, threads_num, [&](size_t t, size_t begin, size_t end) {
+    size_t *positions = &histograms[t * k_buckets_num];
+    for (size_t i = begin; i < end; ++i)
+      sorted[positions[bucket(items[i])]++] = std::move(items[i]);
+  });
+
+  std::atomic<size_t> next_bucket{0};
+  parallelFor(threads_num, threads_num, [&](size_t, size_t, size_t) {
+    for (size_t b; (b = next_bucket.fetch_add(1, std::memory_order_relaxed)) <
+                   k_buckets_num;)
+      std::sort(sorted.begin() + bucket_begins[b],
+                sorted.begin() + bucket_begins[b + 1], less);
+  });
+  items.swap(sorted);
+}
+
+} // namespace humming::util::parallel
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace humming::util::parallel {
+
+template <typename T> class Task;
+
+namespace detail {
+
+// Resumes the coroutine awaiting a finished task, symmetric transfer keeps
+// chains of nested tasks from growing the stack.
+struct FinalAwaiter {
+  bool await_ready() noexcept { return false; }
+  template <typename Promise>
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    if (auto continuation = handle.promise().continuation_)
+      return continuation;
+    return std::noop_coroutine();
+  }
+  void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation_;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  // lookups report failures through their results, an escaping exception is
+  // a bug
+  void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <typename T> struct Promise : PromiseBase {
+  std::optional<T> value_;
+
+  Task<T> get_return_object() noexcept;
+  template <typename U> void return_value(U &&value) {
+    value_.emplace(std::forward<U>(value));
+  }
+  T result() { return std::move(*value_); }
+};
+
+template <> struct Promise<void> : PromiseBase {
+  Task<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+  void result() noexcept {}
+};
+
+} // namespace detail
+
+/**
+ * @class Task
+ * @brief Lazily started coroutine returning T, run by co_await from another
+ * coroutine or as the root of a detached chain by spawn().
+ *
+ * The awaiting coroutine is resumed when the task finishes, the task's frame
+ * is destroyed with the Task object.
+ */
+template <typename T = void> class [[nodiscard]] Task {
+public:
+  using promise_type = detail::Promise<T>;
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+
+public:
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (handle_)
+      handle_.destroy();
+    handle_ = std::exchange(other.handle_, {});
+    return *this;
+  }
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> continuation) noexcept {
+    handle_.promise().continuation_ = continuation;
+    return handle_;
+  }
+  T await_resume() { return handle_.promise().result(); }
+};
+
+namespace detail {
+
+template <typename T> Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+// coroutine that starts right away and frees itself when it finishes
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+} // namespace detail
+
+/**
+ * @brief Runs task until its first suspension and lets it finish on its own,
+ * its frame is freed once it's done.
+ */
+inline detail::Detached spawn(Task<void> task) { co_await std::move(task); }
+
+} // namespace humming::util::parallel
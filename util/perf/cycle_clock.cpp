@@ -0,0 +1,31 @@
+#include "cycle_clock.h"
+
+#include <thread>
+
+namespace humming::util::perf {
+
+namespace {
+
+double calibrate() {
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+  using std::chrono::steady_clock;
+  const auto start = steady_clock::now();
+  const uint64_t start_ticks = CycleClock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  const uint64_t ticks = CycleClock::now() - start_ticks;
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      steady_clock::now() - start);
+  return ticks == 0 ? 1.0 : double(elapsed.count()) / ticks;
+#else
+  return 1.0;
+#endif
+}
+
+} // namespace
+
+double CycleClock::nsPerTick() {
+  static const double ns_per_tick = calibrate();
+  return ns_per_tick;
+}
+
+} // namespace humming::util::perf
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace humming::util::perf {
+
+/**
+ * @class CycleClock
+ * @brief Timestamp counter of the cpu, a few cycles to read instead of tens of
+ * nanoseconds of a clock_gettime call.
+ *
+ * Reads rdtsc on x86 and the virtual counter on aarch64, falls back to
+ * steady_clock elsewhere. The counter is assumed to be invariant, ticking at a
+ * constant rate on all cores as on every recent x86 and arm server, and is
+ * calibrated against steady_clock once per process.
+ */
+class CycleClock {
+public:
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  /**
+   * @brief Nanoseconds per tick, measured on first use over a few
+   * milliseconds.
+   */
+  static double nsPerTick();
+
+  static uint64_t toNanos(uint64_t ticks) {
+    return uint64_t(double(ticks) * nsPerTick());
+  }
+};
+
+} // namespace humming::util::perf
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+namespace humming::util::perf {
+
+/**
+ * @class Histogram
+ * @brief Log-linear histogram of non-negative values, like HdrHistogram.
+ *
+ * Every power of two range is split into k_sub_buckets linear buckets, so a
+ * recorded value is known within 1/k_sub_buckets of itself, about 3%, over the
+ * whole range. Values up to 2^k_max_bits are kept apart, larger ones fall into
+ * the last bucket. The range covers 18 minutes in nanoseconds, which is all
+ * latencies of interest to a store.
+ *
+ * One thread records, any thread may read or merge it concurrently: counts
+ * are relaxed atomics updated with plain load and store, so recording costs
+ * no more than with plain integers. Copies are snapshots of the counts.
+ */
+class Histogram {
+public:
+  static constexpr size_t k_sub_bucket_bits = 5;
+  static constexpr size_t k_sub_buckets = size_t(1) << k_sub_bucket_bits;
+  static constexpr size_t k_max_bits = 40;
+  static constexpr size_t k_buckets_num =
+      (k_max_bits - k_sub_bucket_bits + 1) * k_sub_buckets;
+
+private:
+  std::array<std::atomic<uint64_t>, k_buckets_num> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> min_{std::numeric_limits<uint64_t>::max()};
+  std::atomic<uint64_t> max_{0};
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+public:
+  Histogram() = default;
+  Histogram(const Histogram &other) { *this = other; }
+  Histogram &operator=(const Histogram &other) {
+    if (this == &other)
+      return *this;
+    for (size_t i = 0; i < k_buckets_num; ++i)
+      buckets_[i].store(other.buckets_[i].load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+    count_.store(other.count(), std::memory_order_relaxed);
+    sum_.store(other.sum(), std::memory_order_relaxed);
+    min_.store(other.min_.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+    max_.store(other.max(), std::memory_order_relaxed);
+    return *this;
+  }
+
+  /**
+   * @brief Index of the bucket holding value. Values below 2 * k_sub_buckets
+   * get a bucket each, above that the top k_sub_bucket_bits + 1 bits pick it.
+   */
+  static size_t bucketOf(uint64_t value) {
+    const size_t bits = std::bit_width(value);
+    if (bits <= k_sub_bucket_bits + 1)
+      return value;
+    if (bits > k_max_bits)
+      return k_buckets_num - 1;
+    const size_t shift = bits - k_sub_bucket_bits - 1;
+    return (shift << k_sub_bucket_bits) + (value >> shift);
+  }
+  /**
+   * @brief Largest value falling into bucket.
+   */
+  static uint64_t bucketUpperBound(size_t bucket) {
+    if (bucket < 2 * k_sub_buckets)
+      return bucket;
+    const size_t shift = (bucket >> k_sub_bucket_bits) - 1;
+    const uint64_t mantissa = bucket - (shift << k_sub_bucket_bits);
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  /**
+   * @brief Records value count times, only one thread may record at a time.
+   */
+  void record(uint64_t value, uint64_t count = 1) {
+    add(buckets_[bucketOf(value)], count);
+    add(count_, count);
+    add(sum_, value * count);
+    if (value < min_.load(std::memory_order_relaxed))
+      min_.store(value, std::memory_order_relaxed);
+    if (value > max_.load(std::memory_order_relaxed))
+      max_.store(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Adds values of other, which may be recorded concurrently, to this
+   * histogram, which must not be.
+   */
+  void merge(const Histogram &other) {
+    for (size_t i = 0; i < k_buckets_num; ++i) {
+      if (const uint64_t n = other.buckets_[i].load(std::memory_order_relaxed))
+        add(buckets_[i], n);
+    }
+    add(count_, other.count());
+    add(sum_, other.sum());
+    if (other.count() > 0) {
+      min_.store(std::min(min(), other.min()), std::memory_order_relaxed);
+      max_.store(std::max(max(), other.max()), std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t min() const {
+    return count() == 0 ? 0 : min_.load(std::memory_order_relaxed);
+  }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  double mean() const { return count() == 0 ? 0 : double(sum()) / count(); }
+
+  /**
+   * @brief Value that quantile (0 to 1) of recorded values is at or below,
+   * the upper bound of its bucket capped by the largest recorded value.
+   */
+  uint64_t percentile(double quantile) const {
+    const uint64_t total = count();
+    if (total == 0)
+      return 0;
+    const uint64_t rank = std::max<uint64_t>(
+        1, uint64_t(std::clamp(quantile, 0.0, 1.0) * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < k_buckets_num; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+        return std::clamp(bucketUpperBound(i), min(), max());
+    }
+    return max();
+  }
+};
+
+} // namespace humming::util::perf
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "util/perf/cycle_clock.h"
+#include "util/perf/histogram.h"
+
+// Set to 0 to compile out recording of counters and timers, metrics then stay
+// zero and cost nothing on hot paths.
+#ifndef HUMMING_METRICS
+#define HUMMING_METRICS 1
+#endif
+
+namespace humming::util::perf {
+
+inline constexpr bool k_metrics_enabled = HUMMING_METRICS;
+
+/**
+ * @class Counter
+ * @brief Event counter written by one thread and read by any, a relaxed
+ * atomic updated with plain load and store instead of a locked add.
+ */
+class Counter {
+private:
+  std::atomic<uint64_t> value_{0};
+
+public:
+  Counter() = default;
+  Counter(const Counter &other) : value_(other.value()) {}
+  Counter &operator=(const Counter &other) {
+    value_.store(other.value(), std::memory_order_relaxed);
+    return *this;
+  }
+
+  void add(uint64_t n = 1) {
+    value_.store(value_.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+  }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+};
+
+/**
+ * @class ScopedTimer
+ * @brief Records nanoseconds from construction to destruction or stop() into
+ * a histogram, measured with CycleClock. Compiled out when metrics are.
+ */
+class ScopedTimer {
+#if HUMMING_METRICS
+private:
+  Histogram *histogram_;
+  uint64_t start_ = CycleClock::now();
+
+public:
+  explicit ScopedTimer(Histogram &histogram) : histogram_(&histogram) {}
+  ~ScopedTimer() { stop(); }
+  void stop() {
+    if (histogram_)
+      histogram_->record(CycleClock::toNanos(CycleClock::now() - start_));
+    histogram_ = nullptr;
+  }
+#else
+public:
+  explicit ScopedTimer(Histogram &) {}
+  // not trivial, so timers without a use don't warn
+  ~ScopedTimer() {}
+  void stop() {}
+#endif
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
+/**
+ * @class MetricSet
+ * @brief Counters and histograms named by two enums, each ending with k_num.
+ *
+ * Meant to be written by a single thread, e.g. owned by a per-thread context
+ * or held in PerThread, and merged into a snapshot when asked for. Names
+ * used by print() come from `metricName(id)` found by argument dependent
+ * lookup for both enums.
+ */
+template <typename CounterId, typename HistogramId> class MetricSet {
+private:
+  std::array<Counter, size_t(CounterId::k_num)> counters_;
+  std::array<Histogram, size_t(HistogramId::k_num)> histograms_;
+
+public:
+  void add(CounterId id, uint64_t n = 1) {
+    if constexpr (k_metrics_enabled)
+      counters_[size_t(id)].add(n);
+  }
+  void record(HistogramId id, uint64_t value) {
+    if constexpr (k_metrics_enabled)
+      histograms_[size_t(id)].record(value);
+  }
+  // times the rest of the scope into histogram id
+  [[nodiscard]] ScopedTimer time(HistogramId id) {
+    return ScopedTimer(histograms_[size_t(id)]);
+  }
+
+  uint64_t count(CounterId id) const { return counters_[size_t(id)].value(); }
+  const Histogram &histogram(HistogramId id) const {
+    return histograms_[size_t(id)];
+  }
+
+  /**
+   * @brief Adds metrics of other, which may be recorded concurrently, to this
+   * set, which must not be.
+   */
+  void merge(const MetricSet &other) {
+    for (size_t i = 0; i < counters_.size(); ++i)
+      counters_[i].add(other.counters_[i].value());
+    for (size_t i = 0; i < histograms_.size(); ++i)
+      histograms_[i].merge(other.histograms_[i]);
+  }
+
+  /**
+   * @brief Writes non-zero counters and percentiles of non-empty histograms,
+   * one per line.
+   */
+  void print(std::ostream &out) const {
+    for (size_t i = 0; i < counters_.size(); ++i) {
+      if (const uint64_t value = counters_[i].value())
+        out << metricName(CounterId(i)) << ": " << value << '\n';
+    }
+    for (size_t i = 0; i < histograms_.size(); ++i) {
+      const Histogram &h = histograms_[i];
+      if (h.count() == 0)
+        continue;
+      out << metricName(HistogramId(i)) << ": count " << h.count()
+          << " mean " << uint64_t(h.mean()) << " p50 " << h.percentile(0.5)
+          << " p99 " << h.percentile(0.99) << " p99.9 "
+          << h.percentile(0.999) << " max " << h.max() << '\n';
+    }
+  }
+};
+
+/**
+ * @class PerThread
+ * @brief One instance of T for every thread using it, merged on demand.
+ *
+ * local() finds the calling thread's instance in a thread local list without
+ * locking, only the first use by a thread registers a new instance. Instances
+ * outlive their threads, so merged() still counts work of exited threads. T
+ * needs a default constructor and `merge(const T &)`.
+ */
+template <typename T> class PerThread {
+private:
+  // ids are never reused, so a thread local entry of a destroyed PerThread
+  // can't be mistaken for one of a new PerThread at the same address
+  static inline std::atomic<uint64_t> s_next_id{0};
+
+  const uint64_t id_ = s_next_id.fetch_add(1, std::memory_order_relaxed);
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<T>> instances_;
+
+public:
+  PerThread() = default;
+  PerThread(const PerThread &) = delete;
+  PerThread &operator=(const PerThread &) = delete;
+
+  T &local() {
+    thread_local std::vector<std::pair<uint64_t, T *>> s_locals;
+    // newest first, a thread mostly uses instances created last
+    for (auto it = s_locals.rbegin(); it != s_locals.rend(); ++it) {
+      if (it->first == id_)
+        return *it->second;
+    }
+    std::lock_guard lock(mutex_);
+    instances_.push_back(std::make_unique<T>());
+    s_locals.emplace_back(id_, instances_.back().get());
+    return *instances_.back();
+  }
+
+  T merged() const {
+    T result;
+    std::lock_guard lock(mutex_);
+    for (const auto &instance : instances_)
+      result.merge(*instance);
+    return result;
+  }
+};
+
+} // namespace humming::util::perf
@@ -24,4 +24,19 @@ std::string printElapsed(const nanoseconds &elapsed_ns) {
   return ss.str();
 }
 
+std::string printBytes(size_t bytes) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(3);
+  if (bytes < 1024) {
+    ss << bytes << " B";
+  } else if (bytes < 1024 * 1024) {
+    ss << bytes / 1024.0 << " KiB";
+  } else if (bytes < 1024 * 1024 * 1024) {
+    ss << bytes / (1024.0 * 1024) << " MiB";
+  } else {
+    ss << bytes / (1024.0 * 1024 * 1024) << " GiB";
+  }
+  return ss.str();
+}
+
 } // namespace humming::util::perf
@@ -17,6 +17,7 @@ using std::chrono::seconds;
 namespace humming::util::perf {
 
 std::string printElapsed(const nanoseconds &elapsed_ns);
+std::string printBytes(size_t bytes);
 
 class Timer {
 private:
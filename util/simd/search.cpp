@@ -0,0 +1,230 @@
+#include "util/simd/search.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace humming::util::simd {
+
+namespace {
+
+// Halves [lo, lo + n) holding the lower bound of key until at most max_n
+// keys are left, written so the compiler emits conditional moves.
+inline void narrow(const uint32_t *keys, uint32_t key, size_t max_n,
+                   size_t &lo, size_t &n) {
+  while (n > max_n) {
+    const size_t half = n / 2;
+    lo = keys[lo + half] < key ? lo + half : lo;
+    n -= half;
+  }
+}
+
+size_t countLessScalar(const uint64_t *values, size_t n, uint64_t key) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i)
+    count += values[i] < key;
+  return count;
+}
+
+size_t countGreaterScalar(const uint64_t *values, size_t n, uint64_t key) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i)
+    count += values[i] > key;
+  return count;
+}
+
+size_t lowerBoundScalar(const uint32_t *keys, size_t n, uint32_t key) {
+  if (n == 0)
+    return 0;
+  size_t lo = 0;
+  narrow(keys, key, 1, lo, n);
+  return lo + (keys[lo] < key);
+}
+
+constexpr SearchKernels k_scalar = {._name = "scalar",
+                                    ._count_less = countLessScalar,
+                                    ._count_greater = countGreaterScalar,
+                                    ._lower_bound = lowerBoundScalar};
+
+#if defined(__x86_64__)
+
+// AVX2 compares only signed 64 bit integers, flipping the sign bit maps
+// unsigned order onto signed one
+__attribute__((target("avx2"))) inline __m256i toSigned(__m256i v) {
+  return _mm256_xor_si256(v, _mm256_set1_epi64x(INT64_MIN));
+}
+
+// lanes [0, n) of 4, all ones in enabled lanes
+__attribute__((target("avx2"))) inline __m256i laneMask(size_t n) {
+  const __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+  return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lanes);
+}
+
+__attribute__((target("avx2"))) inline size_t countMask(__m256i lanes) {
+  return __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lanes)));
+}
+
+__attribute__((target("avx2"))) size_t
+countLessAvx2(const uint64_t *values, size_t n, uint64_t key) {
+  const __m256i k = toSigned(_mm256_set1_epi64x(key));
+  size_t count = 0;
+  for (size_t i = 0; i < n; i += 4) {
+    const __m256i mask = laneMask(n - i);
+    const __m256i v = toSigned(
+        _mm256_maskload_epi64((const long long *)(values + i), mask));
+    count += countMask(_mm256_and_si256(_mm256_cmpgt_epi64(k, v), mask));
+  }
+  return count;
+}
+
+__attribute__((target("avx2"))) size_t
+countGreaterAvx2(const uint64_t *values, size_t n, uint64_t key) {
+  const __m256i k = toSigned(_mm256_set1_epi64x(key));
+  size_t count = 0;
+  for (size_t i = 0; i < n; i += 4) {
+    const __m256i mask = laneMask(n - i);
+    const __m256i v = toSigned(
+        _mm256_maskload_epi64((const long long *)(values + i), mask));
+    count += countMask(_mm256_and_si256(_mm256_cmpgt_epi64(v, k), mask));
+  }
+  return count;
+}
+
+// binary search down to 16 keys, which are compared 8 at once
+__attribute__((target("avx2"))) size_t
+lowerBoundAvx2(const uint32_t *keys, size_t n, uint32_t key) {
+  size_t lo = 0;
+  narrow(keys, key, 16, lo, n);
+  const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+  size_t count = 0;
+  for (size_t i = 0; i < n; i += 8) {
+    const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), lanes);
+    const __m256i v = _mm256_xor_si256(
+        _mm256_maskload_epi32((const int *)(keys + lo + i), mask), sign);
+    count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_and_si256(_mm256_cmpgt_epi32(k, v), mask))));
+  }
+  return lo + count;
+}
+
+constexpr SearchKernels k_avx2 = {._name = "avx2",
+                                  ._count_less = countLessAvx2,
+                                  ._count_greater = countGreaterAvx2,
+                                  ._lower_bound = lowerBoundAvx2};
+
+__attribute__((target("avx512f"))) size_t
+countLessAvx512(const uint64_t *values, size_t n, uint64_t key) {
+  const __mmask8 mask = (1u << n) - 1;
+  const __m512i v = _mm512_maskz_loadu_epi64(mask, values);
+  return __builtin_popcount(
+      _mm512_mask_cmplt_epu64_mask(mask, v, _mm512_set1_epi64(key)));
+}
+
+__attribute__((target("avx512f"))) size_t
+countGreaterAvx512(const uint64_t *values, size_t n, uint64_t key) {
+  const __mmask8 mask = (1u << n) - 1;
+  const __m512i v = _mm512_maskz_loadu_epi64(mask, values);
+  return __builtin_popcount(
+      _mm512_mask_cmpgt_epu64_mask(mask, v, _mm512_set1_epi64(key)));
+}
+
+// binary search down to 16 keys, which are compared at once
+__attribute__((target("avx512f"))) size_t
+lowerBoundAvx512(const uint32_t *keys, size_t n, uint32_t key) {
+  size_t lo = 0;
+  narrow(keys, key, 16, lo, n);
+  const __mmask16 mask = (1u << n) - 1;
+  const __m512i v = _mm512_maskz_loadu_epi32(mask, keys + lo);
+  return lo + __builtin_popcount(_mm512_mask_cmplt_epu32_mask(
+                  mask, v, _mm512_set1_epi32(key)));
+}
+
+constexpr SearchKernels k_avx512 = {._name = "avx512",
+                                    ._count_less = countLessAvx512,
+                                    ._count_greater = countGreaterAvx512,
+                                    ._lower_bound = lowerBoundAvx512};
+
+#elif defined(__aarch64__)
+
+// NEON is part of every AArch64 CPU, so it needs no runtime check
+size_t countLessNeon(const uint64_t *values, size_t n, uint64_t key) {
+  const uint64x2_t k = vdupq_n_u64(key);
+  uint64x2_t counts = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    counts = vsubq_u64(counts, vcltq_u64(vld1q_u64(values + i), k));
+  size_t count = vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1);
+  return count + (i < n && values[i] < key);
+}
+
+size_t countGreaterNeon(const uint64_t *values, size_t n, uint64_t key) {
+  const uint64x2_t k = vdupq_n_u64(key);
+  uint64x2_t counts = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    counts = vsubq_u64(counts, vcgtq_u64(vld1q_u64(values + i), k));
+  size_t count = vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1);
+  return count + (i < n && values[i] > key);
+}
+
+size_t lowerBoundNeon(const uint32_t *keys, size_t n, uint32_t key) {
+  size_t lo = 0;
+  narrow(keys, key, 16, lo, n);
+  const uint32x4_t k = vdupq_n_u32(key);
+  uint32x4_t counts = vdupq_n_u32(0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    counts = vsubq_u32(counts, vcltq_u32(vld1q_u32(keys + lo + i), k));
+  size_t count = vaddvq_u32(counts);
+  for (; i < n; ++i)
+    count += keys[lo + i] < key;
+  return lo + count;
+}
+
+constexpr SearchKernels k_neon = {._name = "neon",
+                                  ._count_less = countLessNeon,
+                                  ._count_greater = countGreaterNeon,
+                                  ._lower_bound = lowerBoundNeon};
+
+#endif
+
+const SearchKernels *pickSearchKernels() {
+#if defined(__x86_64__)
+  // runs during static initialization, possibly before libgcc's own one
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return &k_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return &k_avx2;
+#elif defined(__aarch64__)
+  return &k_neon;
+#endif
+  return &k_scalar;
+}
+
+const SearchKernels *const s_search_kernels = pickSearchKernels();
+
+} // namespace
+
+const SearchKernels &searchKernels() { return *s_search_kernels; }
+
+const SearchKernels *findSearchKernels(std::string_view name) {
+  if (name == k_scalar._name)
+    return &k_scalar;
+#if defined(__x86_64__)
+  if (name == k_avx2._name && __builtin_cpu_supports("avx2"))
+    return &k_avx2;
+  if (name == k_avx512._name && __builtin_cpu_supports("avx512f"))
+    return &k_avx512;
+#elif defined(__aarch64__)
+  if (name == k_neon._name)
+    return &k_neon;
+#endif
+  return nullptr;
+}
+
+} // namespace humming::util::simd
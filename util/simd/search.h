@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace humming::util::simd {
+
+/**
+ * @brief Search kernels for small sorted arrays of keys, one table per
+ * instruction set. The best table supported by the CPU is picked once at
+ * startup, so a binary built for generic x86-64 still uses AVX2 or AVX-512
+ * where available.
+ */
+struct SearchKernels {
+  const char *_name;
+  // number of the first n <= 8 ascending values that are less than key
+  size_t (*_count_less)(const uint64_t *values, size_t n, uint64_t key);
+  // number of the first n <= 8 descending values that are greater than key
+  size_t (*_count_greater)(const uint64_t *values, size_t n, uint64_t key);
+  // index of the first of n ascending 32 bit keys that is not less than key,
+  // e.g. in a column of truncated hashes
+  size_t (*_lower_bound)(const uint32_t *keys, size_t n, uint32_t key);
+};
+
+/**
+ * @brief Kernels picked for this CPU.
+ */
+const SearchKernels &searchKernels();
+
+/**
+ * @brief Kernels of a given name ("scalar", "avx2", "avx512", "neon"), for
+ * tests and benchmarks comparing them.
+ * @return nullptr if the kernels are not built in or not supported by CPU.
+ */
+const SearchKernels *findSearchKernels(std::string_view name);
+
+inline size_t countLess(const uint64_t *values, size_t n, uint64_t key) {
+  return searchKernels()._count_less(values, n, key);
+}
+
+inline size_t countGreater(const uint64_t *values, size_t n, uint64_t key) {
+  return searchKernels()._count_greater(values, n, key);
+}
+
+inline size_t lowerBound(const uint32_t *keys, size_t n, uint32_t key) {
+  return searchKernels()._lower_bound(keys, n, key);
+}
+
+} // namespace humming::util::simd